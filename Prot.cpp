@@ -1,58 +1,126 @@
 #include "Prot.h"
 
-void CalculateCRC(const FL_MODBUS_MESSAGE &mm, const QByteArray &data, UCHAR crc[2])
+namespace {
+
+struct Crc16Tables
 {
-    UCHAR c, CRChi, CRClo;
-    CRChi = CRClo = 0xFF;
+    quint16 t[8][256];
+};
 
-    if(mm.FUNCT == 0x6E)
+// t[0] is the classic byte table, t[k] advances t[k-1] by one more zero byte
+constexpr Crc16Tables makeCrc16Tables()
+{
+    Crc16Tables tables{};
+    for (int i = 0; i < 256; i++)
+    {
+        quint16 crc = static_cast<quint16>(i);
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? static_cast<quint16>((crc >> 1) ^ 0xA001) : static_cast<quint16>(crc >> 1);
+        tables.t[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++)
     {
-        char* bf = (char*)&mm;
-        for(unsigned int i = 0; i < sizeof(FL_MODBUS_MESSAGE); i++)
+        for (int i = 0; i < 256; i++)
         {
-            c = bf[i];
-            c ^= CRClo;
-            CRClo = CRChi^CRC_Table_Hi[c];
-            CRChi = CRC_Table_Lo[c];
-        };
+            quint16 prev = tables.t[k - 1][i];
+            tables.t[k][i] = static_cast<quint16>((prev >> 8) ^ tables.t[0][prev & 0xFF]);
+        }
     }
-    else
+    return tables;
+}
+
+constexpr Crc16Tables CRC16 = makeCrc16Tables();
+
+static_assert(CRC16.t[0][0x01] == 0xC0C1 && CRC16.t[0][0xFF] == 0x4040,
+              "CRC16 table does not match the Modbus reference table");
+
+}
+
+void Crc16::update(UCHAR byte)
+{
+    reg = static_cast<quint16>((reg >> 8) ^ CRC16.t[0][(reg ^ byte) & 0xFF]);
+}
+
+void Crc16::update(const void *ptr, size_t len)
+{
+    const UCHAR *p = static_cast<const UCHAR*>(ptr);
+    quint16 crc = reg;
+
+    while (len >= 8)
+    {
+        crc ^= static_cast<quint16>(p[0] | (p[1] << 8));
+        crc = CRC16.t[7][crc & 0xFF] ^ CRC16.t[6][crc >> 8] ^
+              CRC16.t[5][p[2]] ^ CRC16.t[4][p[3]] ^
+              CRC16.t[3][p[4]] ^ CRC16.t[2][p[5]] ^
+              CRC16.t[1][p[6]] ^ CRC16.t[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = static_cast<quint16>((crc >> 8) ^ CRC16.t[0][(crc ^ *p++) & 0xFF]);
+
+    reg = crc;
+}
+
+void Crc16::combine(quint16 crcFromZero, const Crc16Shift &shift)
+{
+    reg = shift.apply(reg) ^ crcFromZero;
+}
+
+Crc16Shift::Crc16Shift()
+{
+    for (int bit = 0; bit < 16; bit++)
+        columns[bit] = static_cast<quint16>(1 << bit);
+}
+
+Crc16Shift::Crc16Shift(size_t len)
+{
+    static const UCHAR zeros[64] = {};
+    for (int bit = 0; bit < 16; bit++)
     {
-        char* bf = (char*)&mm.message_short;
-        for(unsigned int i=0; i < sizeof(FL_MODBUS_MESSAGE_SHORT); i++)
+        Crc16 crc(static_cast<quint16>(1 << bit));
+        for (size_t left = len; left > 0; )
         {
-            c = bf[i];
-            c ^= CRClo;
-            CRClo = CRChi ^ CRC_Table_Hi[c];
-            CRChi = CRC_Table_Lo[c];
-        };
+            size_t chunk = qMin(left, sizeof(zeros));
+            crc.update(zeros, chunk);
+            left -= chunk;
+        }
+        columns[bit] = crc.state();
     }
+}
 
-    for(unsigned int i = 0; i < data.size(); i++)
+quint16 Crc16Shift::apply(quint16 reg) const
+{
+    quint16 result = 0;
+    for (int bit = 0; reg; bit++, reg >>= 1)
     {
-        c = data[i];
-        c ^= CRClo;
-        CRClo = CRChi ^ CRC_Table_Hi[c];
-        CRChi = CRC_Table_Lo[c];
-    };
+        if (reg & 1)
+            result ^= columns[bit];
+    }
+    return result;
+}
+
+void CalculateCRC(const FL_MODBUS_MESSAGE &mm, const QByteArray &data, UCHAR crc[2])
+{
+    Crc16 crc16;
 
-    crc[0] = CRClo;
-    crc[1] = CRChi;
+    if(mm.FUNCT == 0x6E)
+        crc16.update(&mm, sizeof(FL_MODBUS_MESSAGE));
+    else
+        crc16.update(&mm.message_short, sizeof(FL_MODBUS_MESSAGE_SHORT));
+
+    crc16.update(data);
+    crc16.finish(crc);
 }
 
 void CalculateCRC(QByteArray &msg)
 {
-    UCHAR c, CRChi, CRClo;
-    CRChi = CRClo = 0xFF;
+    UCHAR crc[2];
+    Crc16 crc16;
+    crc16.update(msg);
+    crc16.finish(crc);
 
-    for (unsigned int i = 0; i < msg.size(); i++)
-    {
-        c = msg[i];
-        c ^= CRClo;
-        CRClo = CRChi ^ CRC_Table_Hi[c];
-        CRChi = CRC_Table_Lo[c];
-    };
-
-    msg.append(CRClo);
-    msg.append(CRChi);
+    msg.append(crc[0]);
+    msg.append(crc[1]);
 }
@@ -12,44 +12,6 @@
 #endif
 
 
-static UCHAR CRC_Table_Hi[0x100]= {
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40
-};
-
-static UCHAR CRC_Table_Lo[0x100]= {
-    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7, 0x05, 0xC5, 0xC4, 0x04,
-    0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09, 0x08, 0xC8,
-    0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC,
-    0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3, 0x11, 0xD1, 0xD0, 0x10,
-    0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32, 0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4,
-    0x3C, 0xFC, 0xFD, 0x3D, 0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38,
-    0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF, 0x2D, 0xED, 0xEC, 0x2C,
-    0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26, 0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0,
-    0xA0, 0x60, 0x61, 0xA1, 0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4,
-    0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68,
-    0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA, 0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C,
-    0xB4, 0x74, 0x75, 0xB5, 0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0,
-    0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54,
-    0x9C, 0x5C, 0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98,
-    0x88, 0x48, 0x49, 0x89, 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
-    0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83, 0x41, 0x81, 0x80, 0x40
-};
-
 struct FL_MODBUS_MESSAGE_SHORT
 {
     UCHAR tx_id;
@@ -103,6 +65,52 @@ struct FL_MODBUS_STATE_CMD_MESSAGE
     QByteArray data;
 };
 
+class Crc16Shift;
+
+// Modbus CRC16 (poly 0xA001, init 0xFFFF) with incremental update.
+// Slicing-by-8 tables are generated at compile time in Prot.cpp.
+class Crc16
+{
+public:
+    Crc16() : reg(0xFFFF) {}
+    explicit Crc16(quint16 state) : reg(state) {}
+
+    void reset() { reg = 0xFFFF; }
+    void update(UCHAR byte);
+    void update(const void *ptr, size_t len);
+    void update(const QByteArray &data) { update(data.constData(), static_cast<size_t>(data.size())); }
+    // Writes low byte first, as it goes on the wire
+    void finish(UCHAR crc[2]) const
+    {
+        crc[0] = static_cast<UCHAR>(reg & 0xFF);
+        crc[1] = static_cast<UCHAR>(reg >> 8);
+    }
+    quint16 state() const { return reg; }
+
+    // Appends data whose CRC was calculated in advance, see Crc16Shift
+    void combine(quint16 crcFromZero, const Crc16Shift &shift);
+
+private:
+    quint16 reg;
+};
+
+// CRC register update is linear, so CRC of a||b equals shift(crc(a)) ^ crc0(b),
+// where crc0(b) is CRC of b started from zero register and shift advances the
+// register over len(b) zero bytes. Lets frames reuse CRC of constant parts.
+class Crc16Shift
+{
+public:
+    // Identity, len = 0
+    Crc16Shift();
+    explicit Crc16Shift(size_t len);
+
+    quint16 apply(quint16 reg) const;
+
+private:
+    // Image of every register bit
+    quint16 columns[16];
+};
+
 void CalculateCRC(const FL_MODBUS_MESSAGE& mm, const QByteArray& data, UCHAR crc[2]);
 
 void CalculateCRC(QByteArray &msg);
@@ -265,6 +273,74 @@ void CalculateCRC(QByteArray &msg);
 #define PROT_LOG_CONTROL_OK			0xD9
 
 
+// Every request command with its reply code, used to build the command dispatch table
+struct ProtCommand
+{
+    UCHAR cmd;
+    UCHAR ok;
+    const char *name;
+};
+
+inline constexpr ProtCommand PROT_COMMANDS[] = {
+    { PROT_RESET_CMD,            PROT_RESET_OK,             "RESET" },
+    { PROT_ID_CMD,               PROT_ID_OK,                "ID" },
+    { PROT_STATE_REQ_CMD,        PROT_STATE_REQ_OK,         "STATE_REQ" },
+    { PROT_TIME_SET_CMD,         PROT_TIME_SET_OK,          "TIME_SET" },
+    { PROT_TIME_REQ_CMD,         PROT_TIME_REQ_OK,          "TIME_REQ" },
+    { PROT_SYSLOG_WR_CMD,        PROT_SYSLOG_WR_OK,         "SYSLOG_WR" },
+    { PROT_CALL_CMD,             PROT_CALL_OK,              "CALL" },
+    { PROT_CLOCK_SYNC_CMD,       PROT_CLOCK_SYNC_OK,        "CLOCK_SYNC" },
+    { PROT_BRIDGE_ON_CMD,        PROT_BRIDGE_ON_OK,         "BRIDGE_ON" },
+    { PROT_BRIDGE_OFF_CMD,       PROT_BRIDGE_OFF_OK,        "BRIDGE_OFF" },
+    { PROT_CONF_START_CMD,       PROT_CONF_START_OK,        "CONF_START" },
+    { PROT_CONF_WR_CMD,          PROT_CONF_WR_OK,           "CONF_WR" },
+    { PROT_CONF_RD_CMD,          PROT_CONF_RD_OK,           "CONF_RD" },
+    { PROT_CONF_END_CMD,         PROT_CONF_END_OK,          "CONF_END" },
+    { PROT_FIRMWARE_START_CMD,   PROT_FIRMWARE_START_OK,    "FIRMWARE_START" },
+    { PROT_FIRMWARE_WR_CMD,      PROT_FIRMWARE_WR_OK,       "FIRMWARE_WR" },
+    { PROT_FIRMWARE_END_CMD,     PROT_FIRMWARE_END_OK,      "FIRMWARE_END" },
+    { PROT_FILE_SRCH_INIT_CMD,   PROT_FILE_SRCH_INIT_OK,    "FILE_SRCH_INIT" },
+    { PROT_FILE_SRCH_CMD,        PROT_FILE_SRCH_OK,         "FILE_SRCH" },
+    { PROT_FILE_DEL_CMD,         PROT_FILE_DEL_OK,          "FILE_DEL" },
+    { PROT_FILE_OPEN_WR_CMD,     PROT_FILE_OPEN_WR_OK,      "FILE_OPEN_WR" },
+    { PROT_FILE_OPEN_RD_CMD,     PROT_FILE_OPEN_RD_OK,      "FILE_OPEN_RD" },
+    { PROT_FILE_CLOSE_CMD,       PROT_FILE_CLOSE_OK,        "FILE_CLOSE" },
+    { PROT_FILE_RESULT_CMD,      PROT_FILE_RESULT_OK,       "FILE_RESULT" },
+    { PROT_FILE_WR_CMD,          PROT_FILE_WR_OK,           "FILE_WR" },
+    { PROT_FILE_RD_CMD,          PROT_FILE_RD_OK,           "FILE_RD" },
+    { PROT_FILE_RENAME_CMD,      PROT_FILE_RENAME_OK,       "FILE_RENAME" },
+    { PROT_FILE_FLASH_CLR_CMD,   PROT_FILE_FLASH_CLR_OK,    "FILE_FLASH_CLR" },
+    { PROT_DMX_CONTROL_CMD,      PROT_DMX_CONTROL_OK,       "DMX_CONTROL" },
+    { PROT_DMX_COMPLETE_CMD,     PROT_DMX_COMPLETE_OK,      "DMX_COMPLETE" },
+    { PROT_DMX_REC_CTRL_CMD,     PROT_DMX_REC_CTRL_OK,      "DMX_REC_CTRL" },
+    { PROT_DMX_REC_CMPL_CMD,     PROT_DMX_REC_CMPL_OK,      "DMX_REC_CMPL" },
+    { PROT_DMX_SET_CMD,          PROT_DMX_SET_OK,           "DMX_SET" },
+    { PROT_DMX_RELEASE_CMD,      PROT_DMX_RELEASE_OK,       "DMX_RELEASE" },
+    { PROT_DMX_MODE_CMD,         PROT_DMX_MODE_OK,          "DMX_MODE" },
+    { PROT_DMX_MCONTROL_CMD,     PROT_DMX_MCONTROL_OK,      "DMX_MCONTROL" },
+    { PROT_RELAY_SET_CMD,        PROT_RELAY_SET_OK,         "RELAY_SET" },
+    { PROT_RELAY_REQ_CMD,        PROT_RELAY_REQ_OK,         "RELAY_REQ" },
+    { PROT_INPUT_REQ_CMD,        PROT_INPUT_REQ_OK,         "INPUT_REQ" },
+    { PROT_INPUT_STATE_CMD,      PROT_INPUT_STATE_OK,       "INPUT_STATE" },
+    { PROT_CNTR_REQ_CMD,         PROT_CNTR_REQ_OK,          "CNTR_REQ" },
+    { PROT_PROC_CONTROL_CMD,     PROT_PROC_CONTROL_OK,      "PROC_CONTROL" },
+    { PROT_PROC_REQ_CMD,         PROT_PROC_REQ_OK,          "PROC_REQ" },
+    { PROT_LOG_CONTROL_CMD,      PROT_LOG_CONTROL_OK,       "LOG_CONTROL" },
+};
+
+// Name of a request or reply command code, nullptr for unknown codes
+constexpr const char *ProtCommandName(UCHAR code)
+{
+    for (const ProtCommand &command : PROT_COMMANDS)
+    {
+        if (command.cmd == code || command.ok == code)
+            return command.name;
+    }
+    return nullptr;
+}
+
+
+
 
 
 // error codes
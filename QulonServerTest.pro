@@ -12,29 +12,80 @@ SOURCES += \
     Prot.cpp \
     ahpstatewindow.cpp \
     calculatebytewidget.cpp \
+    connectscheduler.cpp \
     device.cpp \
+    devicebitmap.cpp \
+    devicegroups.cpp \
+    deviceindex.cpp \
+    devicestatus.cpp \
+    devicetablemodel.cpp \
+    devicepool.cpp \
+    filestore.cpp \
+    framedecoder.cpp \
+    framewriter.cpp \
+    headlessrunner.cpp \
     iniparser.cpp \
     lamplist.cpp \
+    latencystats.cpp \
     lightdeviceswindow.cpp \
     logger.cpp \
+    logmodel.cpp \
     main.cpp \
     mainwindow.cpp \
     modbushandler.cpp \
-    tcpclient.cpp
+    phasescheduler.cpp \
+    slip.cpp \
+    sourceaddresspool.cpp \
+    tcpclient.cpp \
+    timingwheel.cpp \
+    trafficcapture.cpp \
+    transport.cpp \
+    virtualfiles.cpp
 
 HEADERS += \
     Prot.h \
     ahpstatewindow.h \
     calculatebytewidget.h \
+    capturefile.h \
     checkboxheader.h \
+    connectscheduler.h \
     device.h \
+    devicebitmap.h \
+    devicebitset.h \
+    devicegroups.h \
+    deviceindex.h \
+    devicestatus.h \
+    devicetablemodel.h \
+    devicepool.h \
+    filestore.h \
+    framedecoder.h \
+    framewriter.h \
+    headlessrunner.h \
     iniparser.h \
     lamplist.h \
+    latencystats.h \
     lightdeviceswindow.h \
     logger.h \
+    logmodel.h \
+    logring.h \
     mainwindow.h \
     modbushandler.h \
-    tcpclient.h
+    phasescheduler.h \
+    slip.h \
+    sourceaddresspool.h \
+    tcpclient.h \
+    timingwheel.h \
+    trafficcapture.h \
+    transport.h \
+    virtualfiles.h
+
+# Linux: qmake CONFIG+=io_uring, needs liburing 2.4+ and kernel 6.0+
+linux:CONFIG(io_uring) {
+    DEFINES += QULON_IO_URING
+    LIBS += -luring
+    SOURCES += uringtransport.cpp
+    HEADERS += uringtransport.h
+}
 
 FORMS += \
     ahpstatewindow.ui \
@@ -21,7 +21,7 @@ AhpStateWindow::~AhpStateWindow()
     delete ui;
 }
 
-void AhpStateWindow::setDevices(const QMap<QString, Device *> &devices)
+void AhpStateWindow::setDevices(const DeviceIndex &devices)
 {
     this->devices = devices;
 }
@@ -2,6 +2,7 @@
 #define AHPSTATEWINDOW_H
 
 #include "device.h"
+#include "deviceindex.h"
 #include <QDialog>
 #include <QCloseEvent>
 
@@ -17,13 +18,13 @@ public:
     explicit AhpStateWindow(QWidget *parent = nullptr);
     ~AhpStateWindow();
 
-    void setDevices(const QMap<QString, Device*> &devices);
+    void setDevices(const DeviceIndex &devices);
 
 private:
     Ui::AhpStateWindow *ui;
     USHORT currentValue;
     USHORT prevValue;
-    QMap<QString, Device*> devices;
+    DeviceIndex devices;
 
     void changeAhpState();
     QByteArray getStateArray();
@@ -0,0 +1,60 @@
+#ifndef CAPTUREFILE_H
+#define CAPTUREFILE_H
+
+#include <QtGlobal>
+#include <cstring>
+
+// Формат файла захвата трафика (.qcap), общий для симулятора и qulondump.
+// Файл: FileHeader, затем записи RecordHeader + байты, выровненные на 8.
+// Байты записи - ровно то, что прошло через сокет (SLIP, кадры с 0xC0),
+// разбор кадров делается только при чтении. Порядок байт - little-endian.
+namespace Capture {
+
+constexpr char MAGIC[8] = { 'Q', 'L', 'N', 'C', 'A', 'P', '0', '1' };
+constexpr quint32 VERSION = 1;
+constexpr int RECORD_ALIGN = 8;
+
+enum class Direction : quint8
+{
+    FromServer = 0,     // bytes read from the socket
+    ToServer = 1,       // bytes written to the socket
+    DeviceName = 2      // phone of the device index, written before its traffic
+};
+
+struct FileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 headerSize;
+    // Wall clock in microseconds at monotonic zero, record time + wallBase is wall time
+    qint64 wallBase;
+    qint64 created;
+};
+static_assert(sizeof(FileHeader) == 32, "FileHeader layout is part of the file format");
+
+struct RecordHeader
+{
+    // Monotonic clock, microseconds
+    qint64 time;
+    quint32 device;
+    quint16 size;
+    Direction direction;
+    quint8 reserved;
+};
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader layout is part of the file format");
+
+// Bytes taken by the record with its payload and padding
+constexpr qint64 recordSpan(quint16 size)
+{
+    return (static_cast<qint64>(sizeof(RecordHeader)) + size + RECORD_ALIGN - 1) & ~qint64(RECORD_ALIGN - 1);
+}
+
+inline bool isValidHeader(const FileHeader &header)
+{
+    return memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION &&
+           header.headerSize >= sizeof(FileHeader);
+}
+
+}
+
+#endif // CAPTUREFILE_H
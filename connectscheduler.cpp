@@ -0,0 +1,191 @@
+#include "connectscheduler.h"
+#include "device.h"
+#include <cmath>
+
+namespace {
+
+constexpr qint64 NSECS_PER_MSEC = 1000000;
+constexpr qint64 NSECS_PER_SEC = 1000000000;
+
+}
+
+ConnectScheduler::ConnectScheduler()
+{
+    thread.setObjectName("ConnectScheduler");
+    ticker.setTimerType(Qt::PreciseTimer);
+    ticker.setInterval(1);
+    ticker.moveToThread(&thread);
+    QObject::connect(&ticker, &QTimer::timeout, &ticker, [this] { release(); });
+    clock.start();
+}
+
+ConnectScheduler::~ConnectScheduler()
+{
+    stop();
+}
+
+void ConnectScheduler::setProfile(const ConnectProfile &newProfile)
+{
+    QMutexLocker locker(&mutex);
+    profile = newProfile;
+    enabled = profile.shape != ConnectProfile::Shape::Uniform && profile.rate > 0;
+
+    clock.restart();
+    lastUpdate = 0;
+    tokens = 0;
+    draining = false;
+    random.seed(profile.seed);
+    nextArrival = 0;
+}
+
+bool ConnectScheduler::isEnabled() const
+{
+    return enabled;
+}
+
+void ConnectScheduler::start()
+{
+    if (!thread.isRunning())
+        thread.start();
+}
+
+void ConnectScheduler::stop()
+{
+    if (!thread.isRunning())
+        return;
+
+    // Timer must be stopped in its own thread
+    QMetaObject::invokeMethod(&ticker, &QTimer::stop, Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+
+    QMutexLocker locker(&mutex);
+    tickerRunning = false;
+    draining = false;
+    queue.clear();
+    queued.clear();
+    inFlight.clear();
+}
+
+void ConnectScheduler::requestConnect(Device *device)
+{
+    QMutexLocker locker(&mutex);
+    if (queued.contains(device) || inFlight.contains(device))
+        return;
+
+    queue.push_back(device);
+    queued.insert(device);
+
+    if (!tickerRunning && thread.isRunning())
+    {
+        tickerRunning = true;
+        QMetaObject::invokeMethod(&ticker, qOverload<>(&QTimer::start), Qt::QueuedConnection);
+    }
+}
+
+void ConnectScheduler::handshakeFinished(Device *device)
+{
+    QMutexLocker locker(&mutex);
+    inFlight.remove(device);
+}
+
+void ConnectScheduler::cancel(Device *device)
+{
+    // Stale pointers left in the queue are skipped by release()
+    QMutexLocker locker(&mutex);
+    queued.remove(device);
+    inFlight.remove(device);
+}
+
+double ConnectScheduler::rateAt(qint64 nsecs) const
+{
+    const qint64 msecs = nsecs / NSECS_PER_MSEC;
+
+    switch (profile.shape)
+    {
+    case ConnectProfile::Shape::Linear:
+        if (profile.rampTime <= 0 || msecs >= profile.rampTime)
+            return profile.rate;
+        return profile.rate * msecs / profile.rampTime;
+
+    case ConnectProfile::Shape::Step:
+    {
+        if (profile.steps <= 1 || profile.stepTime <= 0)
+            return profile.rate;
+        const qint64 step = qMin<qint64>(msecs / profile.stepTime + 1, profile.steps);
+        return profile.rate * step / profile.steps;
+    }
+
+    case ConnectProfile::Shape::Spike:
+        if (profile.spikePeriod > 0 && msecs % profile.spikePeriod < profile.spikeDuration)
+            return profile.spikeRate;
+        return profile.rate;
+
+    default:
+        return profile.rate;
+    }
+}
+
+void ConnectScheduler::addTokens(qint64 now)
+{
+    if (profile.shape == ConnectProfile::Shape::Poisson)
+    {
+        // Exponential gaps from our own generator, std distributions differ between compilers
+        while (nextArrival <= now)
+        {
+            tokens += 1;
+            const double uniform = (random() >> 11) * (1.0 / (quint64(1) << 53));
+            const double gap = -std::log1p(-uniform) / profile.rate;
+            nextArrival += qMax<qint64>(static_cast<qint64>(gap * NSECS_PER_SEC), 1);
+        }
+    }
+    else
+    {
+        // Midpoint of the interval, ticks are 1 ms so ramps are followed closely
+        const double seconds = double(now - lastUpdate) / NSECS_PER_SEC;
+        tokens += rateAt((lastUpdate + now) / 2) * seconds;
+    }
+    // Only tokens saved up with an empty queue are capped. A busy queue keeps
+    // the fraction and gets all connects owed since lastUpdate, so a late
+    // 1 ms tick or a rate above 1000/s is not cut down
+    if (!draining)
+        tokens = qMin(tokens, profile.burst);
+    lastUpdate = now;
+}
+
+void ConnectScheduler::release()
+{
+    QMutexLocker locker(&mutex);
+    addTokens(clock.nsecsElapsed());
+
+    bool pendingFull = false;
+    while (!queue.empty() && tokens >= 1)
+    {
+        if (profile.maxPending > 0 && inFlight.size() >= profile.maxPending)
+        {
+            pendingFull = true;
+            break;
+        }
+
+        Device *device = queue.front();
+        queue.pop_front();
+        if (!queued.remove(device))
+            continue;
+
+        tokens -= 1;
+        inFlight.insert(device);
+        // Device can't be deleted before it cancels under the same mutex
+        device->connectNow();
+    }
+
+    // Tokens that could not be used are savings, not debt
+    draining = !queue.empty() && !pendingFull;
+    if (!draining)
+        tokens = qMin(tokens, profile.burst);
+
+    if (queue.empty())
+    {
+        tickerRunning = false;
+        ticker.stop();
+    }
+}
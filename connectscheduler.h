@@ -0,0 +1,98 @@
+#ifndef CONNECTSCHEDULER_H
+#define CONNECTSCHEDULER_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QMutex>
+#include <QSet>
+#include <QElapsedTimer>
+#include <atomic>
+#include <deque>
+#include <random>
+
+class Device;
+
+// Профиль подключений из секции #SIMULATOR
+struct ConnectProfile
+{
+    enum class Shape
+    {
+        Uniform,    // old behaviour: every device waits random [0, connectionInterval)
+        Linear,     // rate grows from 0 to rate during rampTime
+        Step,       // rate grows by rate / steps every stepTime
+        Spike,      // rate, spikeRate during the first spikeDuration of every spikePeriod
+        Poisson     // random arrivals with the mean rate
+    };
+
+    Shape shape = Shape::Uniform;
+    double rate = 100;          // connects per second
+    int rampTime = 60000;       // ms
+    int steps = 5;
+    int stepTime = 10000;       // ms
+    double spikeRate = 1000;    // connects per second
+    int spikePeriod = 60000;    // ms
+    int spikeDuration = 1000;   // ms
+    // Token bucket size: connects saved up while nobody waits. Devices in the
+    // queue get everything owed since the last tick, whatever the rate
+    double burst = 1;
+    // TCP handshakes in flight, 0 means no limit
+    int maxPending = 0;
+    quint64 seed = 1;
+};
+
+// Общий планировщик подключений. Устройства встают в очередь вместо случайной
+// задержки, планировщик выдает им разрешения с заданной профилем частотой
+// (token bucket) и не пускает больше maxPending незавершенных рукопожатий.
+// Работает в своем потоке с точным таймером 1 мс, время профиля считается от
+// setProfile(), случайные числа Poisson из seed, так что прогоны повторяемы.
+// Методы очереди вызываются из потоков устройств.
+class ConnectScheduler
+{
+public:
+    ConnectScheduler();
+    ~ConnectScheduler();
+
+    // Call before devices start, restarts the profile time
+    void setProfile(const ConnectProfile &newProfile);
+    bool isEnabled() const;
+
+    void start();
+    void stop();
+
+    // Device gets connectNow() in its thread when its turn comes
+    void requestConnect(Device *device);
+    // Handshake of the device succeeded or failed
+    void handshakeFinished(Device *device);
+    // Forget the device, after return it is never called
+    void cancel(Device *device);
+
+private:
+    QThread thread;
+    QTimer ticker;
+    bool tickerRunning = false;
+
+    mutable QMutex mutex;
+    ConnectProfile profile;
+    std::atomic<bool> enabled{false};
+
+    std::deque<Device*> queue;
+    QSet<Device*> queued;
+    QSet<Device*> inFlight;
+
+    QElapsedTimer clock;
+    qint64 lastUpdate = 0;          // ns of profile time
+    qint64 nextArrival = 0;         // ns, Poisson
+    double tokens = 0;
+    // Queue had devices after the last tick, tokens are owed to them in full
+    bool draining = false;
+    std::mt19937_64 random;
+
+    double rateAt(qint64 nsecs) const;
+    void addTokens(qint64 now);
+    void release();
+
+    Q_DISABLE_COPY(ConnectScheduler)
+};
+
+#endif // CONNECTSCHEDULER_H
@@ -1,17 +1,31 @@
 #include "device.h"
+#include "devicepool.h"
+#include "devicestatus.h"
+#include "connectscheduler.h"
+#include "phasescheduler.h"
+#include <QCoreApplication>
 #include <sstream>
 #include <iomanip>
 
 Device::Device(QObject *parent)
     : QObject{parent},
+    connectionStatus(false),
     autoRegen(true),
-    connectionTimer(new QTimer(this)),
-    disconnectionTimer(new QTimer(this)),
-    sendStatusTimer(new QTimer(this)),
-    changeStatusTimer(new QTimer(this)),
-    lampList(new LampList(this))
+    // No parent: the device moves to its pool thread, the list stays with the GUI
+    lampList(new LampList),
+    connectionTimer([this] { onConnectionTimerTimeout(); }),
+    disconnectionTimer([this] { onDisconnectionTimerTimeout(); }),
+    sendStatusTimer([this] { onSendStatusTimerTimeout(); }),
+    changeStatusTimer([this] { onChangeStatusTimeTimeout(); })
 {
+    // Devices are built in the pool threads
+    if (QCoreApplication::instance())
+        lampList->moveToThread(QCoreApplication::instance()->thread());
 
+    connectionTimer.setSingleShot(true);
+    disconnectionTimer.setSingleShot(true);
+    // Restarted for every send to stay on the device phase
+    sendStatusTimer.setSingleShot(true);
 }
 
 Device::Device(const QString &phone, const QString &name, Logger *logger, QObject *parent)
@@ -28,30 +42,51 @@ Device::Device(const QString &phone, const QString &name, Logger *logger, QObjec
     modbusHandler->initModbusHandler(devicePhone);
 
     connect(tcpClient, &TcpClient::connectionChanged, this, &Device::onConnectionChanged);
-    connect(tcpClient, &TcpClient::messageReceived, modbusHandler, &ModbusHandler::parseMessage);
+    // The message is a view of the read buffer, it is handled before the next read
+    connect(tcpClient, &TcpClient::messageReceived, modbusHandler, &ModbusHandler::parseMessage, Qt::DirectConnection);
     connect(modbusHandler, &ModbusHandler::messageToSend, tcpClient, &TcpClient::sendMessage);
     connect(modbusHandler, &ModbusHandler::wrongCRC, tcpClient, &TcpClient::onWrongCRC);
     connect(modbusHandler, &ModbusHandler::wrongTx, tcpClient, &TcpClient::onWrongTx);
     connect(modbusHandler, &ModbusHandler::unknownCommand, tcpClient, &TcpClient::onUnknownCommand);
 
-    connect(connectionTimer, &QTimer::timeout, this, &Device::onConnectionTimerTimeout);
-    connect(disconnectionTimer, &QTimer::timeout, this, &Device::onDisconnectionTimerTimeout);
-    connect(sendStatusTimer, &QTimer::timeout, this, &Device::onSendStatusTimerTimeout);
-    connect(changeStatusTimer, &QTimer::timeout, this, &Device::onChangeStatusTimeTimeout);
+    // Traffic statistics for DevicePool snapshots
+    connect(tcpClient, &TcpClient::messageReceived, this, [this](const QByteArray &message) {
+        if (counters)
+            counters->bytesReceived.fetch_add(message.size(), std::memory_order_relaxed);
+    }, Qt::DirectConnection);
+    connect(modbusHandler, &ModbusHandler::messageToSend, this, [this](const QByteArray &message) {
+        if (counters)
+        {
+            counters->bytesSent.fetch_add(message.size(), std::memory_order_relaxed);
+            counters->framesSent.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
     connect(lampList, &LampList::nodesUpdated, this, &Device::onNodesUpdated);
+    // Failed handshake frees its place in the scheduler
+    connect(tcpClient, &TcpClient::socketError, this, [this] {
+        if (scheduler)
+            scheduler->handshakeFinished(this);
+    });
 }
 
 Device::~Device()
 {
     isBeingDestroyed = true;
     stopWork();
-    delete connectionTimer;
-    delete disconnectionTimer;
-    delete sendStatusTimer;
-    delete changeStatusTimer;
 
     if (tcpClient->isConnected())
         tcpClient->disconnectFromServer();
+
+    // Deleted by the GUI thread, which may be reading it now
+    lampList->deleteLater();
+
+    if (counters)
+    {
+        counters->devices.fetch_sub(1, std::memory_order_relaxed);
+        if (connectionStatus)
+            counters->connected.fetch_sub(1, std::memory_order_relaxed);
+    }
 }
 
 QString Device::getPhone() const
@@ -76,77 +111,120 @@ bool Device::isConnected() const
 
 void Device::setIp(const QString &ip)
 {
-    serverIp = ip;
+    inDeviceThread([this, ip] { serverIp = ip; });
 }
 
 void Device::setPort(const quint16 &port)
 {
-    serverPort = port;
+    inDeviceThread([this, port] { serverPort = port; });
 }
 
 void Device::setAutoRegen(const bool &regen)
 {
-    autoRegen = regen;
+    inDeviceThread([this, regen] { autoRegen = regen; });
 }
 
 void Device::setDefaults(const DeviceDefaults &defaults)
 {
-    setConnectionInterval(defaults.connectionInterval);
-    setDisconnectionInterval(defaults.disconnectionFromInterval, defaults.disconnectionToInterval);
-    setSendStatusInterval(defaults.sendStatusInterval);
-    setChangeStatusInterval(defaults.changeStatusInterval);
-    setAutoRegen(defaults.autoRegen);
+    inDeviceThread([this, defaults] {
+        setConnectionInterval(defaults.connectionInterval);
+        setDisconnectionInterval(defaults.disconnectionFromInterval, defaults.disconnectionToInterval);
+        setSendStatusInterval(defaults.sendStatusInterval);
+        setChangeStatusInterval(defaults.changeStatusInterval);
+        autoRegen = defaults.autoRegen;
+    });
 }
 
+// Lamp list is edited by GUI only, device gets the file through nodesUpdated
 void Device::setLampsList(int size, int level, UCHAR status)
 {
     lampList->init(size, level, status);
 }
 
+void Device::setCounters(ShardCounters *shardCounters)
+{
+    counters = shardCounters;
+}
+
+void Device::setStatusTable(const std::shared_ptr<DeviceStatusTable> &table, quint32 index, int shard)
+{
+    statusTable = table;
+    statusIndex = index;
+    statusShard = shard;
+    statusTable->set(statusIndex, statusShard, connectionStatus ? DeviceStatusTable::Connected : 0);
+}
+
+void Device::setScheduler(ConnectScheduler *connectScheduler)
+{
+    scheduler = connectScheduler;
+}
+
 void Device::startWork()
 {
-    startConnectionTimer();
+    inDeviceThread([this] { startConnectionTimer(); });
 }
 
 void Device::stopWork()
 {
-    if (connectionTimer->isActive())
+    if (QThread::currentThread() != thread())
     {
-        connectionTimer->stop();
+        inDeviceThread([this] { stopWork(); });
+        return;
     }
-    if (disconnectionTimer->isActive())
+
+    if (connectionTimer.isActive())
     {
-        disconnectionTimer->stop();
+        connectionTimer.stop();
+    }
+    if (scheduler)
+    {
+        waitingForScheduler = false;
+        scheduler->cancel(this);
+    }
+    if (disconnectionTimer.isActive())
+    {
+        disconnectionTimer.stop();
         tcpClient->disconnectFromServer();
     }
-    if (sendStatusTimer->isActive())
+    if (sendStatusTimer.isActive())
     {
-        sendStatusTimer->stop();
+        sendStatusTimer.stop();
     }
-    if (changeStatusTimer->isActive())
+    if (changeStatusTimer.isActive())
     {
-        changeStatusTimer->stop();
+        changeStatusTimer.stop();
     }
 }
 
+void Device::connectNow()
+{
+    inDeviceThread([this] {
+        // Stopped after the scheduler let it through
+        if (!waitingForScheduler)
+            return;
+        waitingForScheduler = false;
+        onConnectionTimerTimeout();
+    });
+}
+
 void Device::debugConnect(const QString &serverAddress, quint16 serverPort)
 {
-    tcpClient->connectToServer(serverAddress, serverPort);
+    inDeviceThread([this, serverAddress, serverPort] { tcpClient->connectToServer(serverAddress, serverPort); });
 }
 
 void Device::editLogStatus(const bool &status)
 {
-    tcpClient->editLogStatus(status);
+    inDeviceThread([this, status] { tcpClient->editLogStatus(status); });
 }
 
 void Device::editState(const UCHAR &stateByte, const QByteArray &data)
 {
-    modbusHandler->editState(stateByte, data);
+    inDeviceThread([this, stateByte, data] { modbusHandler->editState(stateByte, data); });
 }
 
 void Device::sendState()
 {
-    modbusHandler->formStateMessage(true);
+    inDeviceThread([this] { modbusHandler->formStateMessage(true); });
 }
 
 void Device::setConnectionInterval(const int &interval)
@@ -172,24 +250,34 @@ void Device::setChangeStatusInterval(const int &interval)
 
 void Device::startConnectionTimer()
 {
+    if (scheduler && scheduler->isEnabled())
+    {
+        waitingForScheduler = true;
+        scheduler->requestConnect(this);
+        return;
+    }
     int randomInterval = QRandomGenerator::global()->bounded(_defaults.connectionInterval);
-    connectionTimer->start(randomInterval);
+    connectionTimer.start(randomInterval);
 }
 
 void Device::startDisconnectionTimer()
 {
     int randomInterval = QRandomGenerator::global()->bounded(_defaults.disconnectionFromInterval, _defaults.disconnectionToInterval);
-    disconnectionTimer->start(randomInterval);
+    disconnectionTimer.start(randomInterval);
 }
 
 void Device::startSendStatusTimer()
 {
-    sendStatusTimer->start(_defaults.sendStatusInterval);
+    PhaseScheduler &phases = PhaseScheduler::instance();
+    if (sendPhase < 0)
+        sendPhase = phases.nextPhase();
+    nextSendPoint = phases.firstPoint(sendPhase, _defaults.sendStatusInterval);
+    sendStatusTimer.start(phases.delayTo(nextSendPoint));
 }
 
 void Device::startChangeStatusTimer()
 {
-    changeStatusTimer->start(_defaults.changeStatusInterval);
+    changeStatusTimer.start(_defaults.changeStatusInterval);
 }
 
 void Device::onConnectionChanged(const bool &status)
@@ -197,7 +285,20 @@ void Device::onConnectionChanged(const bool &status)
     if (isBeingDestroyed)
         return;
     if (status == false)
+    {
         stopWork();
+        modbusHandler->resetConnection();
+    }
+    if (status)
+    {
+        modbusHandler->connectionEstablished();
+        if (scheduler)
+            scheduler->handshakeFinished(this);
+    }
+    if (counters && connectionStatus != status)
+        counters->connected.fetch_add(status ? 1 : -1, std::memory_order_relaxed);
+    if (statusTable && connectionStatus != status)
+        statusTable->set(statusIndex, statusShard, status ? DeviceStatusTable::Connected : 0);
     emit connectionChanged(status);
     connectionStatus = status;
 }
@@ -205,7 +306,6 @@ void Device::onConnectionChanged(const bool &status)
 void Device::onConnectionTimerTimeout()
 {
     tcpClient->connectToServer(serverIp, serverPort);
-    connectionTimer->stop();
     startSendStatusTimer();
     startDisconnectionTimer();
     startChangeStatusTimer();
@@ -214,15 +314,21 @@ void Device::onConnectionTimerTimeout()
 void Device::onDisconnectionTimerTimeout()
 {
     tcpClient->disconnectFromServer();
-    disconnectionTimer->stop();
-    sendStatusTimer->stop();
-    changeStatusTimer->stop();
+    sendStatusTimer.stop();
+    changeStatusTimer.stop();
     startConnectionTimer();
 }
 
 void Device::onSendStatusTimerTimeout()
 {
     modbusHandler->formStateMessage(true);
+
+    // Points follow each other exactly, jitter doesn't accumulate
+    PhaseScheduler &phases = PhaseScheduler::instance();
+    nextSendPoint += qMax(_defaults.sendStatusInterval, 1);
+    if (nextSendPoint <= PhaseScheduler::now())
+        nextSendPoint = phases.firstPoint(sendPhase, _defaults.sendStatusInterval);
+    sendStatusTimer.start(phases.delayTo(nextSendPoint));
 }
 
 void Device::onChangeStatusTimeTimeout()
@@ -232,8 +338,7 @@ void Device::onChangeStatusTimeTimeout()
     else return;
 }
 
-void Device::onNodesUpdated()
+void Device::onNodesUpdated(const QByteArray &file)
 {
-    QByteArray file = lampList->getFile();
     modbusHandler->addFileToMap("STATE2.DAT", file);
 }
@@ -2,11 +2,14 @@
 #define DEVICE_H
 
 #include <QObject>
-#include <QTimer>
+#include <QThread>
+#include <atomic>
+#include <memory>
 #include "logger.h"
 #include "tcpclient.h"
 #include "lamplist.h"
 #include "modbushandler.h"
+#include "timingwheel.h"
 
 struct DeviceDefaults
 {
@@ -19,6 +22,12 @@ struct DeviceDefaults
     bool logStatus = true;
 };
 
+struct ShardCounters;
+class ConnectScheduler;
+class DeviceStatusTable;
+
+// Public methods can be called from any thread, they are executed in the thread
+// of the device (see DevicePool)
 class Device : public QObject
 {
     Q_OBJECT
@@ -39,9 +48,16 @@ public:
     void setAutoRegen(const bool &regen);
     void setDefaults(const DeviceDefaults& defaults);
     void setLampsList(int size, int level, UCHAR status);
+    // Called by DevicePool before the device is moved to its thread
+    void setCounters(ShardCounters *shardCounters);
+    void setScheduler(ConnectScheduler *connectScheduler);
+    // Called by DevicePool in the device thread, connection changes go to the table
+    void setStatusTable(const std::shared_ptr<DeviceStatusTable> &table, quint32 index, int shard);
 
     void startWork();
     void stopWork();
+    // Called by ConnectScheduler when the device may connect
+    void connectNow();
 
     void debugConnect(const QString &serverAddress, quint16 serverPort);
     void editLogStatus(const bool &status);
@@ -54,23 +70,43 @@ private:
     QString serverIp;
     quint16 serverPort;
     int devicePhoneId;
-    bool connectionStatus;
+    std::atomic<bool> connectionStatus;
     bool autoRegen;
     bool isBeingDestroyed = false;
     DeviceDefaults _defaults;
+    ShardCounters *counters = nullptr;
+    ConnectScheduler *scheduler = nullptr;
+    std::shared_ptr<DeviceStatusTable> statusTable;
+    quint32 statusIndex = 0;
+    int statusShard = 0;
+    bool waitingForScheduler = false;
+    // Place in sendStatusInterval, kept between connections (see PhaseScheduler)
+    double sendPhase = -1;
+    qint64 nextSendPoint = 0;
 
+    // Owned by the GUI thread, deleted there together with the device
     LampList* lampList;
     Logger* logger;
     TcpClient* tcpClient;
     ModbusHandler* modbusHandler;
 
-    // Таймеры
-    QTimer *connectionTimer;
-    QTimer *disconnectionTimer;
-    QTimer *sendStatusTimer;
-    QTimer *changeStatusTimer;
+    // Таймеры, общее колесо потока устройства
+    WheelTimer connectionTimer;
+    WheelTimer disconnectionTimer;
+    WheelTimer sendStatusTimer;
+    WheelTimer changeStatusTimer;
 
 private:
+    // Runs call in the device thread: directly if already there, queued otherwise
+    template <typename Func>
+    void inDeviceThread(Func &&call)
+    {
+        if (QThread::currentThread() == thread())
+            call();
+        else
+            QMetaObject::invokeMethod(this, std::forward<Func>(call), Qt::QueuedConnection);
+    }
+
     // Таймеры
     void setConnectionInterval(const int &interval);
     void setDisconnectionInterval(const int &from, const int &to);
@@ -88,7 +124,7 @@ private slots:
     void onDisconnectionTimerTimeout();
     void onSendStatusTimerTimeout();
     void onChangeStatusTimeTimeout();
-    void onNodesUpdated();
+    void onNodesUpdated(const QByteArray &file);
 
 signals:
     void connectionChanged(const bool &status);
@@ -0,0 +1,240 @@
+#include "devicebitmap.h"
+#include <algorithm>
+#include <iterator>
+
+DeviceBitmap DeviceBitmap::range(quint32 from, quint32 to)
+{
+    DeviceBitmap result;
+    while (from < to)
+    {
+        const quint32 blockEnd = static_cast<quint32>(qMin<quint64>(to, (quint64(from >> 16) + 1) << 16));
+        Container container;
+        container.key = static_cast<quint16>(from >> 16);
+        container.cardinality = blockEnd - from;
+        if (container.cardinality <= ARRAY_LIMIT)
+        {
+            container.values.reserve(container.cardinality);
+            for (quint32 index = from; index < blockEnd; index++)
+                container.values.push_back(static_cast<quint16>(index));
+        }
+        else
+        {
+            container.words.assign(CONTAINER_WORDS, 0);
+            for (quint32 low = from & 0xFFFF; low <= ((blockEnd - 1) & 0xFFFF); low++)
+                container.words[low >> 6] |= quint64(1) << (low & 63);
+        }
+        result.containers.push_back(std::move(container));
+        from = blockEnd;
+    }
+    return result;
+}
+
+DeviceBitmap DeviceBitmap::fromBitset(const DeviceBitset &bits)
+{
+    DeviceBitmap result;
+    bits.forEach([&](quint32 index) { result.add(index); });
+    return result;
+}
+
+void DeviceBitmap::add(quint32 index)
+{
+    const quint16 key = static_cast<quint16>(index >> 16);
+    const quint16 low = static_cast<quint16>(index);
+
+    auto it = std::lower_bound(containers.begin(), containers.end(), key,
+                               [](const Container &c, quint16 k) { return c.key < k; });
+    if (it == containers.end() || it->key != key)
+    {
+        Container container;
+        container.key = key;
+        container.cardinality = 0;
+        it = containers.insert(it, std::move(container));
+    }
+
+    if (!it->words.empty())
+    {
+        quint64 &word = it->words[low >> 6];
+        const quint64 bit = quint64(1) << (low & 63);
+        if (!(word & bit))
+        {
+            word |= bit;
+            it->cardinality++;
+        }
+        return;
+    }
+
+    // Devices are usually added in ascending order
+    auto value = it->values.empty() || it->values.back() < low
+            ? it->values.end()
+            : std::lower_bound(it->values.begin(), it->values.end(), low);
+    if (value != it->values.end() && *value == low)
+        return;
+    it->values.insert(value, low);
+    it->cardinality++;
+    normalize(*it);
+}
+
+bool DeviceBitmap::contains(quint32 index) const
+{
+    const quint16 key = static_cast<quint16>(index >> 16);
+    const quint16 low = static_cast<quint16>(index);
+
+    auto it = std::lower_bound(containers.begin(), containers.end(), key,
+                               [](const Container &c, quint16 k) { return c.key < k; });
+    if (it == containers.end() || it->key != key)
+        return false;
+    if (!it->words.empty())
+        return it->words[low >> 6] & (quint64(1) << (low & 63));
+    return std::binary_search(it->values.begin(), it->values.end(), low);
+}
+
+quint32 DeviceBitmap::cardinality() const
+{
+    quint32 result = 0;
+    for (const Container &container : containers)
+        result += container.cardinality;
+    return result;
+}
+
+DeviceBitmap DeviceBitmap::operator|(const DeviceBitmap &other) const
+{
+    return combine(*this, other, Op::Or);
+}
+
+DeviceBitmap DeviceBitmap::operator&(const DeviceBitmap &other) const
+{
+    return combine(*this, other, Op::And);
+}
+
+DeviceBitmap DeviceBitmap::operator-(const DeviceBitmap &other) const
+{
+    return combine(*this, other, Op::AndNot);
+}
+
+void DeviceBitmap::toBitset(DeviceBitset &bits) const
+{
+    forEach([&](quint32 index) { bits.set(index); });
+}
+
+DeviceBitmap DeviceBitmap::combine(const DeviceBitmap &a, const DeviceBitmap &b, Op op)
+{
+    DeviceBitmap result;
+    auto first = a.containers.begin();
+    auto second = b.containers.begin();
+    while (first != a.containers.end() || second != b.containers.end())
+    {
+        if (second == b.containers.end() || (first != a.containers.end() && first->key < second->key))
+        {
+            // Only in a
+            if (op != Op::And)
+                result.containers.push_back(*first);
+            ++first;
+        }
+        else if (first == a.containers.end() || second->key < first->key)
+        {
+            // Only in b
+            if (op == Op::Or)
+                result.containers.push_back(*second);
+            ++second;
+        }
+        else
+        {
+            Container container = combine(*first, *second, op);
+            if (container.cardinality)
+                result.containers.push_back(std::move(container));
+            ++first;
+            ++second;
+        }
+    }
+    return result;
+}
+
+DeviceBitmap::Container DeviceBitmap::combine(const Container &a, const Container &b, Op op)
+{
+    Container result;
+    result.key = a.key;
+
+    if (a.words.empty() && b.words.empty())
+    {
+        auto out = std::back_inserter(result.values);
+        switch (op)
+        {
+        case Op::Or:
+            std::set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out);
+            break;
+        case Op::And:
+            std::set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out);
+            break;
+        case Op::AndNot:
+            std::set_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), out);
+            break;
+        }
+        result.cardinality = static_cast<quint32>(result.values.size());
+        normalize(result);
+        return result;
+    }
+
+    std::vector<quint64> other;
+    toWords(a, result.words);
+    toWords(b, other);
+    result.cardinality = 0;
+    for (int i = 0; i < CONTAINER_WORDS; i++)
+    {
+        switch (op)
+        {
+        case Op::Or:
+            result.words[i] |= other[i];
+            break;
+        case Op::And:
+            result.words[i] &= other[i];
+            break;
+        case Op::AndNot:
+            result.words[i] &= ~other[i];
+            break;
+        }
+        result.cardinality += qPopulationCount(result.words[i]);
+    }
+    normalize(result);
+    return result;
+}
+
+void DeviceBitmap::toWords(const Container &container, std::vector<quint64> &words)
+{
+    if (!container.words.empty())
+    {
+        words = container.words;
+        return;
+    }
+    words.assign(CONTAINER_WORDS, 0);
+    for (quint16 low : container.values)
+        words[low >> 6] |= quint64(1) << (low & 63);
+}
+
+void DeviceBitmap::normalize(Container &container)
+{
+    if (container.words.empty())
+    {
+        if (container.values.size() <= ARRAY_LIMIT)
+            return;
+        toWords(container, container.words);
+        container.values.clear();
+        container.values.shrink_to_fit();
+        return;
+    }
+
+    if (container.cardinality > ARRAY_LIMIT)
+        return;
+    container.values.clear();
+    container.values.reserve(container.cardinality);
+    for (int i = 0; i < CONTAINER_WORDS; i++)
+    {
+        quint64 word = container.words[i];
+        while (word)
+        {
+            container.values.push_back(static_cast<quint16>(i * 64 + qCountTrailingZeroBits(word)));
+            word &= word - 1;
+        }
+    }
+    container.words.clear();
+    container.words.shrink_to_fit();
+}
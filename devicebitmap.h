@@ -0,0 +1,83 @@
+#ifndef DEVICEBITMAP_H
+#define DEVICEBITMAP_H
+
+#include <QtAlgorithms>
+#include <vector>
+#include "devicebitset.h"
+
+// Сжатое множество номеров устройств (DeviceIndex) по схеме roaring bitmap:
+// номера делятся на блоки по 65536 по старшим 16 битам, редкий блок хранится
+// отсортированным массивом младших 16 бит, плотный - битовой картой из 1024
+// слов. Объединение, пересечение и разность идут поблочно.
+class DeviceBitmap
+{
+public:
+    // Devices [from, to)
+    static DeviceBitmap range(quint32 from, quint32 to);
+    static DeviceBitmap fromBitset(const DeviceBitset &bits);
+
+    void add(quint32 index);
+    bool contains(quint32 index) const;
+    quint32 cardinality() const;
+    bool isEmpty() const { return containers.empty(); }
+    void clear() { containers.clear(); }
+
+    DeviceBitmap operator|(const DeviceBitmap &other) const;
+    DeviceBitmap operator&(const DeviceBitmap &other) const;
+    DeviceBitmap operator-(const DeviceBitmap &other) const;
+
+    // Sets the bits of the devices, bits must be large enough
+    void toBitset(DeviceBitset &bits) const;
+
+    // Calls f(quint32 index) for every device in ascending order
+    template <typename Func>
+    void forEach(Func &&f) const
+    {
+        for (const Container &container : containers)
+        {
+            const quint32 high = quint32(container.key) << 16;
+            if (container.words.empty())
+            {
+                for (quint16 low : container.values)
+                    f(high | low);
+                continue;
+            }
+            for (int i = 0; i < CONTAINER_WORDS; i++)
+            {
+                quint64 word = container.words[i];
+                while (word)
+                {
+                    f(high | (quint32(i) * 64 + qCountTrailingZeroBits(word)));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+private:
+    // Larger arrays take more memory than a bitmap container
+    static constexpr quint32 ARRAY_LIMIT = 4096;
+    static constexpr int CONTAINER_WORDS = 1024;
+
+    enum class Op { Or, And, AndNot };
+
+    struct Container
+    {
+        quint16 key;
+        quint32 cardinality;
+        // Sorted, used while words is empty
+        std::vector<quint16> values;
+        std::vector<quint64> words;
+    };
+
+    // Sorted by key, none of them empty
+    std::vector<Container> containers;
+
+    static DeviceBitmap combine(const DeviceBitmap &a, const DeviceBitmap &b, Op op);
+    static Container combine(const Container &a, const Container &b, Op op);
+    static void toWords(const Container &container, std::vector<quint64> &words);
+    // Picks the smaller representation for the cardinality
+    static void normalize(Container &container);
+};
+
+#endif // DEVICEBITMAP_H
@@ -0,0 +1,93 @@
+#ifndef DEVICEBITSET_H
+#define DEVICEBITSET_H
+
+#include <QtAlgorithms>
+#include <algorithm>
+#include <vector>
+
+// Набор устройств по номерам DeviceIndex: один бит на устройство.
+// Операции над наборами и обход идут по 64-битным словам.
+class DeviceBitset
+{
+public:
+    DeviceBitset() = default;
+    explicit DeviceBitset(quint32 size) { resize(size); }
+
+    // Clears all bits
+    void resize(quint32 size)
+    {
+        bits = size;
+        words.assign((size + 63) / 64, 0);
+    }
+    quint32 size() const { return bits; }
+
+    void set(quint32 index) { words[index >> 6] |= quint64(1) << (index & 63); }
+    void reset(quint32 index) { words[index >> 6] &= ~(quint64(1) << (index & 63)); }
+    bool test(quint32 index) const { return words[index >> 6] & (quint64(1) << (index & 63)); }
+
+    void setAll()
+    {
+        std::fill(words.begin(), words.end(), ~quint64(0));
+        trim();
+    }
+    void clear() { std::fill(words.begin(), words.end(), 0); }
+
+    bool isEmpty() const
+    {
+        for (quint64 word : words)
+        {
+            if (word)
+                return false;
+        }
+        return true;
+    }
+
+    quint32 count() const
+    {
+        quint32 result = 0;
+        for (quint64 word : words)
+            result += qPopulationCount(word);
+        return result;
+    }
+
+    // Sets have the same size
+    DeviceBitset &operator|=(const DeviceBitset &other)
+    {
+        for (size_t i = 0; i < words.size(); i++)
+            words[i] |= other.words[i];
+        return *this;
+    }
+    void subtract(const DeviceBitset &other)
+    {
+        for (size_t i = 0; i < words.size(); i++)
+            words[i] &= ~other.words[i];
+    }
+
+    // Calls f(quint32 index) for every set bit in ascending order
+    template <typename Func>
+    void forEach(Func &&f) const
+    {
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            quint64 word = words[i];
+            while (word)
+            {
+                f(static_cast<quint32>(i * 64 + qCountTrailingZeroBits(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+private:
+    std::vector<quint64> words;
+    quint32 bits = 0;
+
+    // Bits past size() stay zero so count() and isEmpty() are exact
+    void trim()
+    {
+        if (bits & 63)
+            words.back() &= (quint64(1) << (bits & 63)) - 1;
+    }
+};
+
+#endif // DEVICEBITSET_H
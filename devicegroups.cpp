@@ -0,0 +1,321 @@
+#include "devicegroups.h"
+#include "device.h"
+#include <algorithm>
+
+namespace
+{
+
+// Stable between runs, unlike the seeded qHash
+quint32 phoneHash(const QString &phone)
+{
+    quint32 hash = 2166136261u;
+    for (QChar c : phone)
+    {
+        hash ^= c.unicode();
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool isSpecial(QChar c)
+{
+    return c == '|' || c == '&' || c == '!' || c == '(' || c == ')' || c == '"';
+}
+
+}
+
+// Разбор выражения рекурсивным спуском:
+//   expression = term { "|" term }
+//   term       = unary { "&" unary }
+//   unary      = "!" unary | primary
+//   primary    = "(" expression ")" | atom
+class DeviceGroups::Parser
+{
+public:
+    Parser(const DeviceGroups &groups, const QHash<QString, DeviceBitmap> *extra, const QString &text)
+        : groups(groups)
+        , extra(extra)
+        , text(text)
+        , pos(0)
+        , count(static_cast<quint32>(groups.samples.size()))
+    {
+    }
+
+    bool parse(DeviceBitmap *result, QString *error)
+    {
+        DeviceBitmap value;
+        skipSpaces();
+        if (pos == text.size())
+            fail(QStringLiteral("пустое выражение"));
+        else if (expression(value))
+        {
+            skipSpaces();
+            if (pos == text.size())
+            {
+                *result = value;
+                return true;
+            }
+            fail(QStringLiteral("лишний символ '%1'").arg(text[pos]));
+        }
+        *error = QStringLiteral("%1, позиция %2").arg(errorText).arg(pos + 1);
+        return false;
+    }
+
+private:
+    const DeviceGroups &groups;
+    // Temporary groups of this evaluation, nullptr if none
+    const QHash<QString, DeviceBitmap> *extra;
+    const QString &text;
+    int pos;
+    quint32 count;
+    QString errorText;
+
+    bool fail(const QString &message)
+    {
+        errorText = message;
+        return false;
+    }
+
+    void skipSpaces()
+    {
+        while (pos < text.size() && text[pos].isSpace())
+            pos++;
+    }
+
+    bool accept(QChar c)
+    {
+        skipSpaces();
+        if (pos < text.size() && text[pos] == c)
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool expression(DeviceBitmap &result)
+    {
+        if (!term(result))
+            return false;
+        while (accept('|'))
+        {
+            DeviceBitmap other;
+            if (!term(other))
+                return false;
+            result = result | other;
+        }
+        return true;
+    }
+
+    bool term(DeviceBitmap &result)
+    {
+        if (!unary(result))
+            return false;
+        while (accept('&'))
+        {
+            DeviceBitmap other;
+            if (!unary(other))
+                return false;
+            result = result & other;
+        }
+        return true;
+    }
+
+    bool unary(DeviceBitmap &result)
+    {
+        if (!accept('!'))
+            return primary(result);
+        DeviceBitmap other;
+        if (!unary(other))
+            return false;
+        result = DeviceBitmap::range(0, count) - other;
+        return true;
+    }
+
+    bool primary(DeviceBitmap &result)
+    {
+        if (accept('('))
+        {
+            if (!expression(result))
+                return false;
+            if (!accept(')'))
+                return fail(QStringLiteral("нет закрывающей скобки"));
+            return true;
+        }
+
+        QString value;
+        if (!word(value))
+            return false;
+        return atom(value, result);
+    }
+
+    // Bare word up to a space or an operator; "..." for a whole word or after ':'
+    bool word(QString &value)
+    {
+        skipSpaces();
+        const int start = pos;
+        while (pos < text.size() && !text[pos].isSpace() && !isSpecial(text[pos]))
+            pos++;
+        value = text.mid(start, pos - start);
+
+        if (pos < text.size() && text[pos] == '"' && (value.isEmpty() || value.endsWith(':')))
+        {
+            const int end = text.indexOf('"', pos + 1);
+            if (end < 0)
+                return fail(QStringLiteral("нет закрывающей кавычки"));
+            value += text.mid(pos + 1, end - pos - 1);
+            pos = end + 1;
+            return true;
+        }
+
+        if (value.isEmpty())
+            return fail(pos < text.size() ? QStringLiteral("ожидалась группа вместо '%1'").arg(text[pos])
+                                          : QStringLiteral("выражение оборвано"));
+        return true;
+    }
+
+    bool atom(const QString &value, DeviceBitmap &result)
+    {
+        if (value == QLatin1String("all"))
+        {
+            result = DeviceBitmap::range(0, count);
+            return true;
+        }
+
+        if (value.startsWith(QLatin1String("name:")))
+        {
+            const QString prefix = value.mid(5);
+            for (quint32 i = 0; i < count; i++)
+            {
+                if (groups.deviceNames[i].startsWith(prefix))
+                    result.add(i);
+            }
+            return true;
+        }
+
+        if (value.startsWith(QLatin1String("phone:")))
+        {
+            const QStringList bounds = value.mid(6).split('-');
+            bool fromOk = false;
+            bool toOk = false;
+            const quint64 from = bounds.first().toULongLong(&fromOk);
+            const quint64 to = bounds.size() == 2 ? bounds.last().toULongLong(&toOk) : from;
+            if (!fromOk || (bounds.size() == 2 && !toOk) || bounds.size() > 2 || from > to)
+                return fail(QStringLiteral("неверный диапазон телефонов '%1'").arg(value));
+            for (quint32 i = 0; i < count; i++)
+            {
+                const quint64 phone = groups.phoneNumbers[i];
+                if (phone != NO_PHONE && phone >= from && phone <= to)
+                    result.add(i);
+            }
+            return true;
+        }
+
+        if (value.endsWith('%'))
+        {
+            bool ok = false;
+            const double percent = value.chopped(1).toDouble(&ok);
+            if (!ok || percent < 0 || percent > 100)
+                return fail(QStringLiteral("неверная доля '%1'").arg(value));
+            const int limit = qRound(percent * SAMPLE_BUCKETS / 100);
+            for (quint32 i = 0; i < count; i++)
+            {
+                if (groups.samples[i] < limit)
+                    result.add(i);
+            }
+            return true;
+        }
+
+        if (extra)
+        {
+            auto group = extra->constFind(value);
+            if (group != extra->constEnd())
+            {
+                result = group.value();
+                return true;
+            }
+        }
+
+        auto group = groups.groups.constFind(value);
+        if (group == groups.groups.constEnd())
+            return fail(QStringLiteral("неизвестная группа '%1'").arg(value));
+        result = group.value();
+        return true;
+    }
+};
+
+void DeviceGroups::setDevices(const DeviceIndex &devices)
+{
+    deviceNames.clear();
+    phoneNumbers.clear();
+    samples.clear();
+    deviceNames.reserve(devices.size());
+    phoneNumbers.reserve(devices.size());
+    samples.reserve(devices.size());
+    for (int i = 0; i < devices.size(); i++)
+    {
+        const QString &phone = devices.phone(i);
+        bool ok = false;
+        const quint64 number = phone.toULongLong(&ok);
+        deviceNames.push_back(devices.at(i)->getName());
+        phoneNumbers.push_back(ok ? number : NO_PHONE);
+        samples.push_back(static_cast<quint16>(phoneHash(phone) % SAMPLE_BUCKETS));
+    }
+}
+
+void DeviceGroups::clear()
+{
+    groups.clear();
+    deviceNames.clear();
+    phoneNumbers.clear();
+    samples.clear();
+}
+
+bool DeviceGroups::addTag(const QString &group, quint32 index, QString *error)
+{
+    if (!checkName(group, error))
+        return false;
+    groups[group].add(index);
+    return true;
+}
+
+bool DeviceGroups::checkName(const QString &group, QString *error)
+{
+    if (group.isEmpty() || group == QLatin1String("all") || group.contains(':') || group.endsWith('%') ||
+        std::any_of(group.begin(), group.end(), [](QChar c) { return c.isSpace() || isSpecial(c); }))
+    {
+        *error = QStringLiteral("недопустимое имя группы '%1'").arg(group);
+        return false;
+    }
+    return true;
+}
+
+bool DeviceGroups::define(const QString &group, const QString &expression, QString *error)
+{
+    if (!checkName(group, error))
+        return false;
+
+    DeviceBitmap devices;
+    if (!evaluate(expression, &devices, error))
+        return false;
+    groups.insert(group, devices);
+    return true;
+}
+
+QStringList DeviceGroups::names() const
+{
+    QStringList result = groups.keys();
+    result.sort();
+    return result;
+}
+
+bool DeviceGroups::evaluate(const QString &expression, DeviceBitmap *result, QString *error) const
+{
+    return Parser(*this, nullptr, expression).parse(result, error);
+}
+
+bool DeviceGroups::evaluate(const QString &expression, const QHash<QString, DeviceBitmap> &extra,
+                            DeviceBitmap *result, QString *error) const
+{
+    return Parser(*this, &extra, expression).parse(result, error);
+}
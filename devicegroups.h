@@ -0,0 +1,64 @@
+#ifndef DEVICEGROUPS_H
+#define DEVICEGROUPS_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "devicebitmap.h"
+#include "deviceindex.h"
+
+// Именованные группы устройств (DeviceBitmap) и выражения над ними.
+// Группы задаются тегами в #SETDEVICE (groups="a,b") и секциями #SETGROUP
+// с выражением. Временные группы одного вычисления (selected/toggled в
+// MainWindow) передаются в evaluate() и не сохраняются.
+//
+// Выражение:
+//   a | b       объединение
+//   a & b       пересечение
+//   !a          все устройства, кроме a (разность: a & !b)
+//   (...)       скобки
+// Атомы:
+//   all                   все устройства
+//   имя                   группа
+//   name:Префикс          имя устройства начинается с префикса ("..." для пробелов)
+//   phone:FROM-TO         номер телефона в диапазоне, границы включаются
+//   10%                   стабильная выборка: доля устройств по хешу телефона,
+//                         одно и то же устройство попадает в 10% при каждом запуске
+class DeviceGroups
+{
+public:
+    // Device attributes for name:, phone: and N%, groups stay as they are
+    void setDevices(const DeviceIndex &devices);
+    void clear();
+
+    // Same name rules as define(), the tag is not added if the name is wrong
+    bool addTag(const QString &group, quint32 index, QString *error);
+    // Evaluates the expression now, later groups do not change it
+    bool define(const QString &group, const QString &expression, QString *error);
+    bool contains(const QString &group) const { return groups.contains(group); }
+    QStringList names() const;
+
+    bool evaluate(const QString &expression, DeviceBitmap *result, QString *error) const;
+    // Names in extra hide the groups with the same name for this call only
+    bool evaluate(const QString &expression, const QHash<QString, DeviceBitmap> &extra,
+                  DeviceBitmap *result, QString *error) const;
+
+private:
+    class Parser;
+
+    // The name must read back as a group in expressions
+    static bool checkName(const QString &group, QString *error);
+
+    // Sample buckets of N%, 0..SAMPLE_BUCKETS-1
+    static constexpr int SAMPLE_BUCKETS = 10000;
+    static constexpr quint64 NO_PHONE = ~quint64(0);
+
+    QHash<QString, DeviceBitmap> groups;
+    std::vector<QString> deviceNames;
+    // NO_PHONE if the phone is not a number
+    std::vector<quint64> phoneNumbers;
+    std::vector<quint16> samples;
+};
+
+#endif // DEVICEGROUPS_H
@@ -0,0 +1,92 @@
+#include "deviceindex.h"
+#include <QHash>
+
+quint32 DeviceIndex::add(const QString &phone)
+{
+    const quint32 hash = hashOf(phone);
+    if (!table.empty())
+    {
+        const Slot &slot = table[find(phone, hash)];
+        if (slot.index != NONE)
+            return NONE;
+    }
+
+    if ((devices.size() + 1) * 2 > table.size())
+        grow();
+
+    const quint32 index = static_cast<quint32>(devices.size());
+    devices.push_back(nullptr);
+    phones.push_back(phone);
+    table[find(phone, hash)] = { hash, index };
+    return index;
+}
+
+void DeviceIndex::reserve(int size)
+{
+    devices.reserve(size);
+    phones.reserve(size);
+    while (static_cast<size_t>(size) * 2 > table.size())
+        grow();
+}
+
+void DeviceIndex::clear()
+{
+    devices.clear();
+    phones.clear();
+    table.clear();
+}
+
+quint32 DeviceIndex::indexOf(const QString &phone) const
+{
+    if (table.empty())
+        return NONE;
+    return table[find(phone, hashOf(phone))].index;
+}
+
+Device *DeviceIndex::value(const QString &phone) const
+{
+    const quint32 index = indexOf(phone);
+    return index == NONE ? nullptr : devices[index];
+}
+
+quint32 DeviceIndex::hashOf(const QString &phone)
+{
+    // Mixed, phones differ mostly in the last digits
+    quint64 hash = qHash(phone);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return static_cast<quint32>(hash);
+}
+
+size_t DeviceIndex::find(const QString &phone, quint32 hash) const
+{
+    const size_t mask = table.size() - 1;
+    size_t slot = hash & mask;
+    while (table[slot].index != NONE)
+    {
+        if (table[slot].hash == hash && phones[table[slot].index] == phone)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void DeviceIndex::grow()
+{
+    const size_t capacity = table.empty() ? 64 : table.size() * 2;
+    std::vector<Slot> old;
+    old.swap(table);
+    table.assign(capacity, Slot{ 0, NONE });
+
+    const size_t mask = capacity - 1;
+    for (const Slot &entry : old)
+    {
+        if (entry.index == NONE)
+            continue;
+        size_t slot = entry.hash & mask;
+        while (table[slot].index != NONE)
+            slot = (slot + 1) & mask;
+        table[slot] = entry;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef DEVICEINDEX_H
+#define DEVICEINDEX_H
+
+#include <QString>
+#include <vector>
+
+class Device;
+
+// Список устройств с плотными номерами 0..size()-1 в порядке добавления.
+// Номер устройства совпадает со строкой таблицы и битом в DeviceBitset.
+// Телефон ищется по хеш-таблице с открытой адресацией (линейное
+// пробирование), строки сравниваются только при совпадении хеша.
+class DeviceIndex
+{
+public:
+    static constexpr quint32 NONE = 0xFFFFFFFF;
+
+    using const_iterator = std::vector<Device*>::const_iterator;
+
+    // Index for the phone, NONE if it is already there. The device is set
+    // separately, so the devices can be created after the whole file is read
+    quint32 add(const QString &phone);
+    void set(quint32 index, Device *device) { devices[index] = device; }
+    void reserve(int size);
+    void clear();
+
+    bool isEmpty() const { return devices.empty(); }
+    int size() const { return static_cast<int>(devices.size()); }
+
+    Device *at(quint32 index) const { return devices[index]; }
+    const QString &phone(quint32 index) const { return phones[index]; }
+    // NONE if there is no such phone
+    quint32 indexOf(const QString &phone) const;
+    bool contains(const QString &phone) const { return indexOf(phone) != NONE; }
+    // nullptr if there is no such phone
+    Device *value(const QString &phone) const;
+
+    const_iterator begin() const { return devices.begin(); }
+    const_iterator end() const { return devices.end(); }
+
+private:
+    struct Slot
+    {
+        quint32 hash;
+        quint32 index;      // NONE for an empty slot
+    };
+
+    std::vector<Device*> devices;
+    std::vector<QString> phones;
+    // Power of two, at most half full
+    std::vector<Slot> table;
+
+    static quint32 hashOf(const QString &phone);
+    // Slot with the phone or the empty slot where it would go
+    size_t find(const QString &phone, quint32 hash) const;
+    void grow();
+};
+
+#endif // DEVICEINDEX_H
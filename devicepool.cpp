@@ -0,0 +1,138 @@
+#include "devicepool.h"
+#include "device.h"
+#include <QSemaphore>
+
+DevicePool::DevicePool(QObject *parent)
+    : QObject{parent}
+{}
+
+DevicePool::~DevicePool()
+{
+    stop();
+}
+
+void DevicePool::start(int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = qMax(QThread::idealThreadCount(), 1);
+    if (threadCount == static_cast<int>(shards.size()))
+        return;
+
+    stop();
+    scheduler.start();
+    for (int i = 0; i < threadCount; i++)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->thread.setObjectName(QString("DeviceShard%1").arg(i));
+        shard->context.moveToThread(&shard->thread);
+        shard->thread.start();
+        shards.push_back(std::move(shard));
+    }
+}
+
+void DevicePool::stop()
+{
+    // Deferred deletes of removed devices are processed when the thread finishes
+    for (auto &shard : shards)
+        shard->thread.quit();
+    for (auto &shard : shards)
+        shard->thread.wait();
+    shards.clear();
+    scheduler.stop();
+}
+
+int DevicePool::threadCount() const
+{
+    return static_cast<int>(shards.size());
+}
+
+void DevicePool::addDevice(Device *device)
+{
+    if (shards.empty())
+        start(0);
+
+    Shard *target = shards.front().get();
+    for (auto &shard : shards)
+    {
+        if (shard->counters.devices.load(std::memory_order_relaxed) <
+            target->counters.devices.load(std::memory_order_relaxed))
+            target = shard.get();
+    }
+
+    target->counters.devices.fetch_add(1, std::memory_order_relaxed);
+    device->setCounters(&target->counters);
+    device->setScheduler(&scheduler);
+    device->moveToThread(&target->thread);
+}
+
+std::vector<Device*> DevicePool::createDevices(int count, const std::function<Device*(int)> &create)
+{
+    if (shards.empty())
+        start(0);
+
+    std::vector<Device*> devices(count, nullptr);
+    QSemaphore done;
+    int chunks = 0;
+
+    // Even contiguous part per thread. Chunks let the thread serve its other
+    // events in between
+    const int threads = static_cast<int>(shards.size());
+    status = std::make_shared<DeviceStatusTable>(count, threads);
+    for (int t = 0; t < threads; t++)
+    {
+        Shard *shard = shards[t].get();
+        const int begin = static_cast<int>(qint64(count) * t / threads);
+        const int end = static_cast<int>(qint64(count) * (t + 1) / threads);
+        for (int first = begin; first < end; first += CREATE_CHUNK)
+        {
+            const int last = qMin(first + CREATE_CHUNK, end);
+            chunks++;
+            QMetaObject::invokeMethod(&shard->context, [&, shard, t, first, last] {
+                for (int i = first; i < last; i++)
+                {
+                    Device *device = create(i);
+                    device->setCounters(&shard->counters);
+                    device->setScheduler(&scheduler);
+                    device->setStatusTable(status, i, t);
+                    devices[i] = device;
+                }
+                shard->counters.devices.fetch_add(last - first, std::memory_order_relaxed);
+                done.release();
+            }, Qt::QueuedConnection);
+        }
+    }
+
+    done.acquire(chunks);
+    return devices;
+}
+
+void DevicePool::removeDevice(Device *device)
+{
+    device->deleteLater();
+}
+
+ConnectScheduler *DevicePool::connectScheduler()
+{
+    return &scheduler;
+}
+
+std::shared_ptr<DeviceStatusTable> DevicePool::statusTable() const
+{
+    return status;
+}
+
+PoolSnapshot DevicePool::snapshot() const
+{
+    PoolSnapshot result;
+    result.threads = static_cast<int>(shards.size());
+    for (const auto &shard : shards)
+    {
+        const ShardCounters &counters = shard->counters;
+        result.devices += counters.devices.load(std::memory_order_relaxed);
+        result.connected += counters.connected.load(std::memory_order_relaxed);
+        result.bytesReceived += counters.bytesReceived.load(std::memory_order_relaxed);
+        result.bytesSent += counters.bytesSent.load(std::memory_order_relaxed);
+        result.framesSent += counters.framesSent.load(std::memory_order_relaxed);
+    }
+    return result;
+}
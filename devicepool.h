@@ -0,0 +1,87 @@
+#ifndef DEVICEPOOL_H
+#define DEVICEPOOL_H
+
+#include <QObject>
+#include <QThread>
+#include "connectscheduler.h"
+#include "devicestatus.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Device;
+
+// Счетчики одного рабочего потока. Устройства меняют их из своего потока,
+// GUI только читает
+struct ShardCounters
+{
+    std::atomic<int> devices{0};
+    std::atomic<int> connected{0};
+    std::atomic<quint64> bytesReceived{0};
+    std::atomic<quint64> bytesSent{0};
+    std::atomic<quint64> framesSent{0};
+};
+
+// Сумма счетчиков всех потоков на момент вызова snapshot()
+struct PoolSnapshot
+{
+    int threads = 0;
+    int devices = 0;
+    int connected = 0;
+    quint64 bytesReceived = 0;
+    quint64 bytesSent = 0;
+    quint64 framesSent = 0;
+};
+
+// Пул рабочих потоков. Каждый поток крутит свой цикл событий и владеет частью
+// устройств вместе с их сокетами и таймерами. GUI обращается к устройствам
+// только через очередь событий (публичные методы Device сами переходят в поток
+// устройства) и читает общую статистику через snapshot().
+class DevicePool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DevicePool(QObject *parent = nullptr);
+    ~DevicePool();
+
+    // Starts threadCount threads, 0 or less means one per core. Keeps running
+    // threads if their number is the same. All devices must be removed before restart
+    void start(int threadCount);
+    // Waits until all threads finish, devices removed before are deleted by then
+    void stop();
+    int threadCount() const;
+
+    // Moves the device to the least loaded thread. Device must not have a parent
+    void addDevice(Device *device);
+    // Creates count devices right in the worker threads, create(i) runs there in
+    // chunks and must only read data that does not change meanwhile. Blocks until
+    // all devices exist, result[i] is the device for i. The devices report their
+    // state to a new statusTable() under the same i
+    std::vector<Device*> createDevices(int count, const std::function<Device*(int)> &create);
+    // Deletes the device in its own thread
+    void removeDevice(Device *device);
+
+    PoolSnapshot snapshot() const;
+    ConnectScheduler *connectScheduler();
+    // Table of the last createDevices, devices being deleted keep theirs
+    std::shared_ptr<DeviceStatusTable> statusTable() const;
+
+private:
+    // Devices per queued call of createDevices
+    static constexpr int CREATE_CHUNK = 512;
+
+    struct Shard
+    {
+        QThread thread;
+        // Lives in the thread, target of queued calls
+        QObject context;
+        ShardCounters counters;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    ConnectScheduler scheduler;
+    std::shared_ptr<DeviceStatusTable> status;
+};
+
+#endif // DEVICEPOOL_H
@@ -0,0 +1,18 @@
+#include "devicestatus.h"
+
+DeviceStatusTable::DeviceStatusTable(int devices, int shards)
+    : devices(devices)
+    , words((devices + 63) / 64)
+    , states(new std::atomic<quint8>[devices])
+{
+    for (int i = 0; i < devices; i++)
+        states[i].store(0, std::memory_order_relaxed);
+
+    dirty.reserve(shards);
+    for (int shard = 0; shard < shards; shard++)
+    {
+        dirty.emplace_back(new std::atomic<quint64>[words]);
+        for (int i = 0; i < words; i++)
+            dirty.back()[i].store(0, std::memory_order_relaxed);
+    }
+}
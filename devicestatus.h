@@ -0,0 +1,58 @@
+#ifndef DEVICESTATUS_H
+#define DEVICESTATUS_H
+
+#include <QtAlgorithms>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Состояние устройств для GUI: байт на устройство по номеру DeviceIndex и
+// биты изменений отдельно для каждого рабочего потока. Устройство пишет из
+// своего потока без блокировок, GUI раз в кадр забирает только изменившиеся
+// номера вместо опроса всех устройств.
+class DeviceStatusTable
+{
+public:
+    enum StatusBit : quint8 { Connected = 1 };
+
+    DeviceStatusTable(int devices, int shards);
+
+    int size() const { return devices; }
+
+    // Device thread, shard is the DevicePool thread of the device
+    void set(quint32 index, int shard, quint8 status)
+    {
+        states[index].store(status, std::memory_order_relaxed);
+        dirty[shard][index >> 6].fetch_or(quint64(1) << (index & 63), std::memory_order_release);
+    }
+    quint8 status(quint32 index) const { return states[index].load(std::memory_order_relaxed); }
+
+    // GUI thread. Calls f(quint32 index) for every device set since the last call
+    template <typename Func>
+    void takeChanged(Func &&f)
+    {
+        for (const auto &bits : dirty)
+        {
+            for (int i = 0; i < words; i++)
+            {
+                if (!bits[i].load(std::memory_order_relaxed))
+                    continue;
+                quint64 word = bits[i].exchange(0, std::memory_order_acquire);
+                while (word)
+                {
+                    f(static_cast<quint32>(i * 64 + qCountTrailingZeroBits(word)));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+private:
+    const int devices;
+    const int words;
+    std::unique_ptr<std::atomic<quint8>[]> states;
+    // One bitset per thread, a word is only written by the devices of that thread
+    std::vector<std::unique_ptr<std::atomic<quint64>[]>> dirty;
+};
+
+#endif // DEVICESTATUS_H
@@ -0,0 +1,168 @@
+#include "devicetablemodel.h"
+#include "device.h"
+
+DeviceTableModel::DeviceTableModel(QObject *parent)
+    : QAbstractTableModel(parent)
+    , dirtyFirst(-1)
+    , dirtyLast(-1)
+{
+    connect(&frameTimer, &QTimer::timeout, this, &DeviceTableModel::onFrameTimerTimeout);
+}
+
+int DeviceTableModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return static_cast<int>(devices.size());
+}
+
+int DeviceTableModel::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return ColumnCount;
+}
+
+QVariant DeviceTableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= static_cast<int>(devices.size()))
+        return QVariant();
+
+    const int row = index.row();
+    switch (index.column())
+    {
+    case ToggleColumn:
+        if (role == Qt::CheckStateRole)
+            return (states[row] & Toggled) ? Qt::Checked : Qt::Unchecked;
+        break;
+    case PhoneColumn:
+        if (role == Qt::DisplayRole)
+            return phones[row];
+        break;
+    case NameColumn:
+        if (role == Qt::DisplayRole)
+            return names[row];
+        break;
+    case StatusColumn:
+        if (role == Qt::DisplayRole)
+            return (states[row] & Connected) ? tr("Подключено") : tr("Нет соединения");
+        break;
+    }
+    return QVariant();
+}
+
+QVariant DeviceTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QAbstractTableModel::headerData(section, orientation, role);
+
+    switch (section)
+    {
+    case PhoneColumn:
+        return tr("ID");
+    case NameColumn:
+        return tr("Имя");
+    case StatusColumn:
+        return tr("Статус соединения");
+    default:
+        return QString();
+    }
+}
+
+void DeviceTableModel::setDevices(const DeviceIndex &deviceIndex, const std::shared_ptr<DeviceStatusTable> &status)
+{
+    beginResetModel();
+    devices.clear();
+    phones.clear();
+    names.clear();
+    states.clear();
+    devices.reserve(deviceIndex.size());
+    phones.reserve(deviceIndex.size());
+    names.reserve(deviceIndex.size());
+    states.reserve(deviceIndex.size());
+    statusTable = deviceIndex.isEmpty() ? nullptr : status;
+    // Changes so far are read below with the rest of the state
+    if (statusTable)
+        statusTable->takeChanged([](quint32) {});
+    for (int row = 0; row < deviceIndex.size(); row++)
+    {
+        Device *device = deviceIndex.at(row);
+        devices.push_back(device);
+        phones.push_back(deviceIndex.phone(row));
+        names.push_back(device->getName());
+        const bool connected = statusTable && (statusTable->status(row) & DeviceStatusTable::Connected);
+        states.push_back(connected ? Connected : 0);
+    }
+    dirtyFirst = -1;
+    dirtyLast = -1;
+    endResetModel();
+
+    if (devices.empty())
+        frameTimer.stop();
+    else
+        frameTimer.start(FRAME_INTERVAL);
+}
+
+void DeviceTableModel::clear()
+{
+    setDevices(DeviceIndex(), nullptr);
+}
+
+QString DeviceTableModel::phone(int row) const
+{
+    return phones[row];
+}
+
+Device *DeviceTableModel::device(int row) const
+{
+    return devices[row];
+}
+
+bool DeviceTableModel::isToggled(int row) const
+{
+    return states[row] & Toggled;
+}
+
+void DeviceTableModel::setToggled(int row, bool toggled)
+{
+    if (isToggled(row) == toggled)
+        return;
+    states[row] ^= Toggled;
+    markDirty(row);
+}
+
+void DeviceTableModel::markDirty(int row)
+{
+    if (dirtyFirst < 0)
+    {
+        dirtyFirst = row;
+        dirtyLast = row;
+        return;
+    }
+    dirtyFirst = qMin(dirtyFirst, row);
+    dirtyLast = qMax(dirtyLast, row);
+}
+
+void DeviceTableModel::onFrameTimerTimeout()
+{
+    // Only the devices that reported a change, no queued signal per change
+    if (statusTable)
+    {
+        statusTable->takeChanged([this](quint32 row) {
+            const quint8 connected = (statusTable->status(row) & DeviceStatusTable::Connected) ? Connected : 0;
+            if ((states[row] & Connected) != connected)
+            {
+                states[row] ^= Connected;
+                markDirty(static_cast<int>(row));
+            }
+        });
+    }
+
+    if (dirtyFirst < 0)
+        return;
+
+    emit dataChanged(index(dirtyFirst, ToggleColumn), index(dirtyLast, StatusColumn),
+                     { Qt::DisplayRole, Qt::CheckStateRole });
+    dirtyFirst = -1;
+    dirtyLast = -1;
+}
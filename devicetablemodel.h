@@ -0,0 +1,62 @@
+#ifndef DEVICETABLEMODEL_H
+#define DEVICETABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QTimer>
+#include <memory>
+#include <vector>
+#include "deviceindex.h"
+#include "devicestatus.h"
+
+class Device;
+
+// Модель таблицы устройств. Состояние строк хранится компактным массивом,
+// раз в кадр (100 мс) из DeviceStatusTable забираются только изменившиеся
+// устройства, и все изменения кадра уходят представлению одним dataChanged.
+class DeviceTableModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    enum Column { ToggleColumn, PhoneColumn, NameColumn, StatusColumn, ColumnCount };
+
+    explicit DeviceTableModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    // Must be called before the devices are removed from DevicePool, device(row)
+    // returns them until then. Rows are the DeviceIndex indices, the same as in status
+    void setDevices(const DeviceIndex &devices, const std::shared_ptr<DeviceStatusTable> &status);
+    void clear();
+
+    QString phone(int row) const;
+    Device *device(int row) const;
+    // Checkbox column, shown with the next frame
+    bool isToggled(int row) const;
+    void setToggled(int row, bool toggled);
+
+private:
+    static constexpr int FRAME_INTERVAL = 100;
+
+    enum StateBit : quint8 { Connected = 1, Toggled = 2 };
+
+    std::vector<Device*> devices;
+    std::vector<QString> phones;
+    std::vector<QString> names;
+    std::vector<quint8> states;
+    std::shared_ptr<DeviceStatusTable> statusTable;
+
+    // Rows changed since the last frame, -1 if none
+    int dirtyFirst;
+    int dirtyLast;
+    QTimer frameTimer;
+
+    void markDirty(int row);
+
+private slots:
+    void onFrameTimerTimeout();
+};
+
+#endif // DEVICETABLEMODEL_H
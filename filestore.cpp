@@ -0,0 +1,50 @@
+#include "filestore.h"
+
+FileStore &FileStore::instance()
+{
+    static FileStore store;
+    return store;
+}
+
+QByteArray FileStore::acquire(const QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+
+    referenced += data.size();
+    auto it = users.find(data);
+    if (it != users.end())
+    {
+        ++it.value();
+        return it.key();
+    }
+
+    users.insert(data, 1);
+    bytes += data.size();
+    return data;
+}
+
+void FileStore::release(const QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+
+    auto it = users.find(data);
+    if (it == users.end())
+        return;
+
+    referenced -= it.key().size();
+    if (--it.value() == 0)
+    {
+        bytes -= it.key().size();
+        users.erase(it);
+    }
+}
+
+FileStore::Usage FileStore::usage() const
+{
+    QMutexLocker locker(&mutex);
+    Usage result;
+    result.files = static_cast<int>(users.size());
+    result.storedBytes = bytes;
+    result.referencedBytes = referenced;
+    return result;
+}
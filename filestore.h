@@ -0,0 +1,46 @@
+#ifndef FILESTORE_H
+#define FILESTORE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+// Общее для всех устройств хранилище содержимого виртуальных файлов.
+// Одинаковые файлы (например STATE2.DAT после "применить ко всем") хранятся
+// один раз, устройства держат ссылки на общий буфер. Запись в буфер
+// отделяет копию (copy-on-write QByteArray), общий экземпляр не меняется.
+class FileStore
+{
+public:
+    struct Usage
+    {
+        // Distinct contents
+        int files = 0;
+        // Memory actually held
+        qint64 storedBytes = 0;
+        // What every device keeping its own copy would take
+        qint64 referencedBytes = 0;
+    };
+
+    static FileStore &instance();
+
+    // Returns a buffer with the same content shared with all other users of it.
+    // Every acquire() must be paired with release() of the returned buffer
+    QByteArray acquire(const QByteArray &data);
+    void release(const QByteArray &data);
+
+    // For the stats line, takes the mutex
+    Usage usage() const;
+
+private:
+    FileStore() = default;
+    Q_DISABLE_COPY(FileStore)
+
+    mutable QMutex mutex;
+    // Key is the shared buffer itself, hashed and compared by content
+    QHash<QByteArray, int> users;
+    qint64 bytes = 0;
+    qint64 referenced = 0;
+};
+
+#endif // FILESTORE_H
@@ -0,0 +1,77 @@
+#include "framedecoder.h"
+#include "slip.h"
+
+FrameDecoder::FrameDecoder()
+    : buffer(2 * PROT_MAX_SIZE, Qt::Uninitialized),
+    used{0},
+    escapePending{false},
+    overflow{false}
+{}
+
+void FrameDecoder::reset()
+{
+    used = 0;
+    escapePending = false;
+    overflow = false;
+}
+
+void FrameDecoder::append(const char *data, int len, bool frameEnds)
+{
+    if (escapePending)
+    {
+        escapePending = false;
+        if (len > 0 && data[0] == static_cast<char>(0xDC))
+        {
+            put(static_cast<char>(0xC0));
+            ++data;
+            --len;
+        }
+        else if (len > 0 && data[0] == static_cast<char>(0xDD))
+        {
+            put(static_cast<char>(0xDB));
+            ++data;
+            --len;
+        }
+        else
+        {
+            put(static_cast<char>(0xDB));
+        }
+    }
+
+    // DB right before the end of chunk can't be decoded yet. If there are more
+    // DB before it they are followed by DB and stay as is anyway
+    if (!frameEnds && len > 0 && data[len - 1] == static_cast<char>(0xDB))
+    {
+        escapePending = true;
+        --len;
+    }
+
+    if (overflow || len <= 0)
+        return;
+
+    if (used + len > MAX_FRAME_SIZE)
+    {
+        overflow = true;
+        used = 0;
+        return;
+    }
+
+    if (buffer.size() < used + len)
+        buffer.resize(qMax(used + len, 2 * static_cast<int>(buffer.size())));
+    used += SlipUnescape(data, len, buffer.data() + used);
+}
+
+void FrameDecoder::put(char byte)
+{
+    if (overflow)
+        return;
+    if (used + 1 > MAX_FRAME_SIZE)
+    {
+        overflow = true;
+        used = 0;
+        return;
+    }
+    if (buffer.size() < used + 1)
+        buffer.resize(2 * static_cast<int>(buffer.size()));
+    buffer.data()[used++] = byte;
+}
@@ -0,0 +1,55 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QByteArray>
+#include <cstring>
+
+// Потоковый разборщик кадров, ограниченных 0xC0.
+// Хранит незавершенный кадр между чтениями из сокета и снимает экранирование
+// сразу в свой буфер, поэтому кадр, разрезанный на несколько TCP сегментов,
+// не теряется.
+class FrameDecoder
+{
+public:
+    FrameDecoder();
+
+    // Drops partial frame, called on reconnect
+    void reset();
+
+    // Calls handler(const char *frame, int size) for every complete unescaped frame.
+    // The frame points into the decoder buffer and is valid only during the call
+    template <typename Handler>
+    void feed(const char *data, int len, Handler &&handler)
+    {
+        const char *end = data + len;
+        while (data < end)
+        {
+            const char *marker = static_cast<const char*>(memchr(data, 0xC0, end - data));
+            const char *segmentEnd = marker ? marker : end;
+            append(data, static_cast<int>(segmentEnd - data), marker != nullptr);
+            if (!marker)
+                break;
+
+            if (used > 0 && !overflow)
+                handler(static_cast<const char*>(buffer.constData()), used);
+            used = 0;
+            overflow = false;
+            data = marker + 1;
+        }
+    }
+
+private:
+    // Frames can't be longer than this, garbage without markers is dropped
+    static constexpr int MAX_FRAME_SIZE = 4096;
+
+    QByteArray buffer;
+    int used;
+    // 0xDB was the last byte of previous chunk, its pair comes with the next one
+    bool escapePending;
+    bool overflow;
+
+    void append(const char *data, int len, bool frameEnds);
+    void put(char byte);
+};
+
+#endif // FRAMEDECODER_H
@@ -0,0 +1,110 @@
+#include "framewriter.h"
+#include "slip.h"
+#include <cstring>
+
+FrameWriter::FrameWriter()
+    : pos{0}
+{
+    // Enough for any frame of PROT_MAX_SIZE without reallocation
+    buffer.reserve(2 * PROT_MAX_SIZE + 2);
+}
+
+void FrameWriter::begin(const FL_MODBUS_MESSAGE &header)
+{
+    pos = 0;
+    crc.reset();
+    reserve(sizeof(FL_MODBUS_MESSAGE) + header.len);
+    buffer.data()[pos++] = static_cast<char>(0xC0);
+
+    // Short header is hashed without addresses, see CalculateCRC
+    if (header.FUNCT == PROT_FUNC_SYSTEM)
+        crc.update(&header, sizeof(FL_MODBUS_MESSAGE));
+    else
+        crc.update(&header.message_short, sizeof(FL_MODBUS_MESSAGE_SHORT));
+    escape(reinterpret_cast<const UCHAR*>(&header), sizeof(FL_MODBUS_MESSAGE));
+}
+
+void FrameWriter::beginRaw()
+{
+    pos = 0;
+    crc.reset();
+    reserve(0);
+    buffer.data()[pos++] = static_cast<char>(0xC0);
+}
+
+void FrameWriter::append(UCHAR byte)
+{
+    reserve(1);
+    crc.update(byte);
+    escape(&byte, 1);
+}
+
+void FrameWriter::append(const void *data, int len)
+{
+    if (len <= 0)
+        return;
+    reserve(len);
+    crc.update(data, static_cast<size_t>(len));
+    escape(static_cast<const UCHAR*>(data), len);
+}
+
+void FrameWriter::append(const EncodedPayload &payload)
+{
+    const QByteArray &encoded = payload.encoded();
+    if (encoded.isEmpty())
+        return;
+    reserve((encoded.size() + 1) / 2);
+    memcpy(buffer.data() + pos, encoded.constData(), encoded.size());
+    pos += encoded.size();
+    crc.combine(payload.crc(), payload.shift());
+}
+
+const QByteArray &FrameWriter::finish()
+{
+    UCHAR crcBytes[2];
+    crc.finish(crcBytes);
+    escape(crcBytes, 2);
+    buffer.data()[pos++] = static_cast<char>(0xC0);
+    // resize() down keeps the capacity, so the next frame does not allocate
+    buffer.resize(pos);
+    return buffer;
+}
+
+const QByteArray &FrameWriter::assign(const QByteArray &frame)
+{
+    pos = 0;
+    reserve(frame.size() / 2);
+    memcpy(buffer.data(), frame.constData(), frame.size());
+    pos = frame.size();
+    buffer.resize(pos);
+    return buffer;
+}
+
+// Makes sure rawBytes more data bytes fit even if every one of them is escaped,
+// plus escaped CRC and closing marker
+void FrameWriter::reserve(int rawBytes)
+{
+    const int needed = pos + 2 * (rawBytes + 2) + 1;
+    if (buffer.size() < needed)
+        buffer.resize(qMax(needed, static_cast<int>(buffer.capacity())));
+}
+
+void FrameWriter::escape(const UCHAR *data, int len)
+{
+    pos += SlipEscape(data, len, buffer.data() + pos);
+}
+
+void EncodedPayload::encode(const char *data, int len)
+{
+    bytes.resize(2 * len);
+    bytes.resize(SlipEscape(reinterpret_cast<const UCHAR*>(data), len, bytes.data()));
+
+    Crc16 crc(0);
+    crc.update(data, static_cast<size_t>(len));
+    crcFromZero = crc.state();
+
+    // Shift only depends on length, which rarely changes
+    if (len != size)
+        crcShift = Crc16Shift(static_cast<size_t>(len));
+    size = len;
+}
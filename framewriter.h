@@ -0,0 +1,61 @@
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <QByteArray>
+#include "Prot.h"
+
+// Данные кадра, закодированные заранее: экранированные байты и CRC исходных
+// байтов от нулевого регистра. Кадр с любым заголовком собирается из них без
+// повторного экранирования и подсчета CRC по данным.
+class EncodedPayload
+{
+public:
+    void encode(const char *data, int len);
+    void encode(const QByteArray &data) { encode(data.constData(), data.size()); }
+
+    const QByteArray &encoded() const { return bytes; }
+    int rawSize() const { return size; }
+    quint16 crc() const { return crcFromZero; }
+    const Crc16Shift &shift() const { return crcShift; }
+
+private:
+    QByteArray bytes;
+    int size = 0;
+    quint16 crcFromZero = 0;
+    Crc16Shift crcShift;
+};
+
+// Собирает готовый кадр (0xC0, экранированные заголовок, данные и CRC, 0xC0)
+// за один проход в переиспользуемый буфер. CRC считается по ходу записи.
+class FrameWriter
+{
+public:
+    FrameWriter();
+
+    // Start a frame with FL_MODBUS_MESSAGE header, header.len bytes are reserved for data
+    void begin(const FL_MODBUS_MESSAGE &header);
+    // Start a frame without header (sync message)
+    void beginRaw();
+
+    void append(UCHAR byte);
+    void append(const void *data, int len);
+    void append(const QByteArray &data) { append(data.constData(), data.size()); }
+    void append(const EncodedPayload &payload);
+
+    // Appends CRC and closing marker. Returned buffer stays valid until next begin()
+    const QByteArray &finish();
+    // Copies a ready frame into the buffer so it can be retransmitted
+    const QByteArray &assign(const QByteArray &frame);
+    // Last finished frame, used for retransmission
+    const QByteArray &frame() const { return buffer; }
+
+private:
+    QByteArray buffer;
+    int pos;
+    Crc16 crc;
+
+    void reserve(int rawBytes);
+    void escape(const UCHAR *data, int len);
+};
+
+#endif // FRAMEWRITER_H
@@ -0,0 +1,317 @@
+#include "headlessrunner.h"
+#include "filestore.h"
+#include "latencystats.h"
+#include "trafficcapture.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QTextStream>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+volatile std::sig_atomic_t stopSignal = 0;
+
+void onStopSignal(int)
+{
+    stopSignal = 1;
+}
+
+// DeviceDefaults keys, the same in the defaults file and on the command line
+const QStringList DEFAULT_KEYS = { "connect-interval", "disconnect-from", "disconnect-to",
+                                   "send-interval", "change-status-interval",
+                                   "auto-regen", "device-log" };
+
+bool parseSeconds(const QString &value, int &milliseconds)
+{
+    bool ok;
+    double seconds = value.toDouble(&ok);
+    if (!ok || seconds < 0)
+        return false;
+    milliseconds = static_cast<int>(seconds * 1000);
+    return true;
+}
+
+bool parseBool(const QString &value, bool &result)
+{
+    const QString text = value.toLower();
+    if (text == "1" || text == "true" || text == "yes" || text == "on")
+        result = true;
+    else if (text == "0" || text == "false" || text == "no" || text == "off")
+        result = false;
+    else
+        return false;
+    return true;
+}
+
+void printError(const QString &message)
+{
+    fprintf(stderr, "%s\n", message.toLocal8Bit().constData());
+}
+
+}
+
+HeadlessRunner::HeadlessRunner(QObject *parent)
+    : QObject{parent}
+    , logger(new Logger(this))
+    , devicePool(new DevicePool(this))
+    , iniParser(new IniParser(logger, devicePool, this))
+    , stopped(false)
+    , runDuration(0)
+    , lastStatsTime(0)
+{
+    // Device logs are too loud for a console at full scale
+    defaults.logStatus = false;
+
+    connect(&statsTimer, &QTimer::timeout, this, &HeadlessRunner::onStatsTimerTimeout);
+    connect(&controlTimer, &QTimer::timeout, this, &HeadlessRunner::onControlTimerTimeout);
+}
+
+HeadlessRunner::~HeadlessRunner()
+{
+    stop();
+}
+
+bool HeadlessRunner::requested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            return true;
+    }
+    return false;
+}
+
+bool HeadlessRunner::start(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Qulon server test, run without GUI");
+    parser.addHelpOption();
+    parser.addOption({"headless", "Run without GUI"});
+    parser.addOption({"ini", "Devices and server settings", "file"});
+    parser.addOption({"defaults", "Device defaults, key=value lines with the option names below", "file"});
+    parser.addOption({"connect-interval", "Connect delay range, seconds", "s"});
+    parser.addOption({"disconnect-from", "Shortest connection time, seconds", "s"});
+    parser.addOption({"disconnect-to", "Longest connection time, seconds", "s"});
+    parser.addOption({"send-interval", "State push interval, seconds", "s"});
+    parser.addOption({"change-status-interval", "Relay state change interval, seconds", "s"});
+    parser.addOption({"auto-regen", "Change relay states randomly (default true)", "bool"});
+    parser.addOption({"device-log", "Log traffic of every device (default false)", "bool"});
+    parser.addOption({"log-level", "Lowest printed log level: info, warning, error (default warning)", "level", "warning"});
+    parser.addOption({"stats-interval", "Seconds between stats lines (default 10)", "s", "10"});
+    parser.addOption({"duration", "Stop after this many seconds, 0 runs until SIGINT/SIGTERM", "s", "0"});
+    parser.addOption({"latency-file", "Server latency histograms are saved here on exit", "file"});
+    parser.addOption({"target", "Devices to start, a group expression like \"10% & !spare\" (default all)", "expr", "all"});
+
+    if (!parser.parse(arguments))
+    {
+        printError(parser.errorText());
+        return false;
+    }
+    if (parser.isSet("help"))
+        parser.showHelp(0);
+    if (!parser.isSet("ini"))
+    {
+        printError("--ini is required");
+        return false;
+    }
+
+    const QString level = parser.value("log-level").toLower();
+    if (level == "info")
+        logger->setConsoleOutput(LogLevel::Info);
+    else if (level == "warning")
+        logger->setConsoleOutput(LogLevel::Warning);
+    else if (level == "error")
+        logger->setConsoleOutput(LogLevel::Error);
+    else
+    {
+        printError("Unknown --log-level " + level);
+        return false;
+    }
+
+    // The file first, options on the command line override it
+    QString error;
+    if (parser.isSet("defaults") && !readDefaultsFile(parser.value("defaults"), &error))
+    {
+        printError(error);
+        return false;
+    }
+    for (const QString &key : DEFAULT_KEYS)
+    {
+        if (parser.isSet(key) && !applyDefault(key, parser.value(key), &error))
+        {
+            printError(error);
+            return false;
+        }
+    }
+
+    int statsInterval;
+    int duration;
+    if (!parseSeconds(parser.value("stats-interval"), statsInterval) || statsInterval == 0 ||
+        !parseSeconds(parser.value("duration"), duration))
+    {
+        printError("--stats-interval and --duration must be seconds");
+        return false;
+    }
+    runDuration = duration;
+    latencyFile = parser.value("latency-file");
+
+    iniParser->parseIniFile(parser.value("ini"));
+    if (iniParser->devices.isEmpty())
+    {
+        printError("No devices in " + parser.value("ini"));
+        return false;
+    }
+
+    DeviceBitmap targets;
+    if (!iniParser->groups.evaluate(parser.value("target"), &targets, &error))
+    {
+        printError("--target: " + error);
+        return false;
+    }
+
+    for (Device *device : iniParser->devices)
+    {
+        device->setDefaults(defaults);
+        device->editLogStatus(defaults.logStatus);
+    }
+    targets.forEach([&](quint32 index) {
+        iniParser->devices.at(index)->startWork();
+    });
+    printf("Started %u of %d devices in %d threads\n", targets.cardinality(),
+           static_cast<int>(iniParser->devices.size()), devicePool->threadCount());
+    fflush(stdout);
+
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+
+    runTime.start();
+    statsTimer.start(statsInterval);
+    controlTimer.start(200);
+    return true;
+}
+
+bool HeadlessRunner::readDefaultsFile(const QString &filePath, QString *error)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        *error = filePath + ": " + file.errorString();
+        return false;
+    }
+
+    QTextStream in(&file);
+    int lineNumber = 0;
+    while (!in.atEnd())
+    {
+        const QString line = in.readLine().trimmed();
+        lineNumber++;
+        if (line.isEmpty() || line.startsWith('#') || line.startsWith(';'))
+            continue;
+
+        const int separator = line.indexOf('=');
+        const QString key = line.left(separator).trimmed();
+        if (separator < 0 || !DEFAULT_KEYS.contains(key))
+        {
+            *error = QString("%1:%2: unknown line %3").arg(filePath).arg(lineNumber).arg(line);
+            return false;
+        }
+        if (!applyDefault(key, line.mid(separator + 1).trimmed(), error))
+        {
+            *error = QString("%1:%2: %3").arg(filePath).arg(lineNumber).arg(*error);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HeadlessRunner::applyDefault(const QString &key, const QString &value, QString *error)
+{
+    bool ok = false;
+    if (key == "connect-interval")
+        ok = parseSeconds(value, defaults.connectionInterval);
+    else if (key == "disconnect-from")
+        ok = parseSeconds(value, defaults.disconnectionFromInterval);
+    else if (key == "disconnect-to")
+        ok = parseSeconds(value, defaults.disconnectionToInterval);
+    else if (key == "send-interval")
+        ok = parseSeconds(value, defaults.sendStatusInterval);
+    else if (key == "change-status-interval")
+        ok = parseSeconds(value, defaults.changeStatusInterval);
+    else if (key == "auto-regen")
+        ok = parseBool(value, defaults.autoRegen);
+    else if (key == "device-log")
+        ok = parseBool(value, defaults.logStatus);
+
+    if (!ok)
+        *error = QString("Wrong value of %1: %2").arg(key, value);
+    return ok;
+}
+
+void HeadlessRunner::printStats()
+{
+    const PoolSnapshot snapshot = devicePool->snapshot();
+    const qint64 now = runTime.elapsed();
+    const double seconds = qMax<qint64>(now - lastStatsTime, 1) / 1000.0;
+
+    const double rxRate = (snapshot.bytesReceived - lastSnapshot.bytesReceived) / 1024.0 / seconds;
+    const double txRate = (snapshot.bytesSent - lastSnapshot.bytesSent) / 1024.0 / seconds;
+    const double frameRate = (snapshot.framesSent - lastSnapshot.framesSent) / seconds;
+    lastSnapshot = snapshot;
+    lastStatsTime = now;
+
+    const LatencyHistogram sync = LatencyStats::collect().connectToSync;
+    auto ms = [](quint64 micros) { return micros / 1000.0; };
+    const FileStore::Usage files = FileStore::instance().usage();
+
+    printf("%s devices %d connected %d threads %d | rx %.1f KB/s tx %.1f KB/s frames %.0f/s | "
+           "sync p50 %.1f p99 %.1f p999 %.1f ms | files %d %.1f of %.1f KB\n",
+           QDateTime::currentDateTime().toString("hh:mm:ss").toLatin1().constData(),
+           snapshot.devices, snapshot.connected, snapshot.threads,
+           rxRate, txRate, frameRate,
+           ms(sync.percentile(0.5)), ms(sync.percentile(0.99)), ms(sync.percentile(0.999)),
+           files.files, files.storedBytes / 1024.0, files.referencedBytes / 1024.0);
+    fflush(stdout);
+}
+
+void HeadlessRunner::stop()
+{
+    if (stopped)
+        return;
+    stopped = true;
+
+    statsTimer.stop();
+    controlTimer.stop();
+    for (Device *device : iniParser->devices)
+        device->stopWork();
+
+    // Devices are deleted in their threads, wait for it while the logger is alive
+    iniParser->clearData();
+    devicePool->stop();
+    TrafficCapture::instance().stop();
+
+    if (!latencyFile.isEmpty())
+    {
+        QString error;
+        if (!LatencyStats::dump(latencyFile, &error))
+            printError("Can't save latency: " + error);
+    }
+}
+
+void HeadlessRunner::onStatsTimerTimeout()
+{
+    printStats();
+}
+
+void HeadlessRunner::onControlTimerTimeout()
+{
+    if (!stopSignal && (runDuration == 0 || runTime.elapsed() < runDuration))
+        return;
+
+    printStats();
+    stop();
+    QCoreApplication::quit();
+}
@@ -0,0 +1,58 @@
+#ifndef HEADLESSRUNNER_H
+#define HEADLESSRUNNER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include "device.h"
+#include "devicepool.h"
+#include "iniparser.h"
+#include "logger.h"
+
+// Запуск без GUI (--headless) на QCoreApplication для нагрузочных прогонов.
+// Загружает .ini через IniParser, берет DeviceDefaults из файла и параметров
+// командной строки, запускает все устройства и периодически печатает
+// статистику в stdout. Лог уходит в stderr.
+class HeadlessRunner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit HeadlessRunner(QObject *parent = nullptr);
+    ~HeadlessRunner();
+
+    // True if the command line asks for headless mode, checked before the application is created
+    static bool requested(int argc, char *argv[]);
+
+    // Parses the arguments and starts the devices. False on errors, they are printed to stderr
+    bool start(const QStringList &arguments);
+
+private:
+    Logger *logger;
+    DevicePool *devicePool;
+    IniParser *iniParser;
+
+    DeviceDefaults defaults;
+    QString latencyFile;
+    bool stopped;
+
+    QTimer statsTimer;
+    // Checks for SIGINT/SIGTERM and the run duration
+    QTimer controlTimer;
+    QElapsedTimer runTime;
+    qint64 runDuration;
+    // Previous stats line, for rates
+    PoolSnapshot lastSnapshot;
+    qint64 lastStatsTime;
+
+    // key=value lines with the same names as the command line options
+    bool readDefaultsFile(const QString &filePath, QString *error);
+    bool applyDefault(const QString &key, const QString &value, QString *error);
+    void printStats();
+    void stop();
+
+private slots:
+    void onStatsTimerTimeout();
+    void onControlTimerTimeout();
+};
+
+#endif // HEADLESSRUNNER_H
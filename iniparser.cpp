@@ -1,10 +1,16 @@
 #include "iniparser.h"
 #include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QSet>
+#include <array>
+#include <cstring>
 #include <QTextCodec>
 
-IniParser::IniParser(Logger *logger, QObject *parent)
+IniParser::IniParser(Logger *logger, DevicePool *pool, QObject *parent)
     : QObject{parent}
     , _logger{logger}
+    , _pool{pool}
 {
 
 }
@@ -14,89 +20,289 @@ IniParser::~IniParser()
     clearData();
 }
 
-QMap<QString, QString> IniParser::parseSection(QTextStream& in, const QStringList& keys)
+namespace
 {
-    QMap<QString, QString> sectionData;
 
-    while (!in.atEnd())
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool same(QByteArrayView a, QByteArrayView b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// Строки отображенного в память файла, без копирования и выделения памяти
+class LineReader
+{
+public:
+    LineReader(const char *data, qint64 size)
+        : pos(data)
+        , end(data + size)
+    {}
+
+    // Next line without spaces around it, false at the end of the file
+    bool next(QByteArrayView &line)
     {
-        QString line = in.readLine().trimmed();
-        if (line.startsWith("}"))
-        {
+        if (pos >= end)
+            return false;
+
+        const char *lineEnd = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if (!lineEnd)
+            lineEnd = end;
+        const char *first = pos;
+        const char *last = lineEnd;
+        pos = lineEnd + 1;
+
+        while (first < last && isSpace(*first))
+            first++;
+        while (last > first && isSpace(last[-1]))
+            last--;
+        line = QByteArrayView(first, last - first);
+        return true;
+    }
+
+private:
+    const char *pos;
+    const char *end;
+};
+
+enum class Section { Other, GprsSettings, Simulator, SetDevice, SetDeviceRange, SetGroup };
+
+Section sectionOf(QByteArrayView name)
+{
+    if (same(name, "SETDEVICE"))
+        return Section::SetDevice;
+    if (same(name, "SETDEVICERANGE"))
+        return Section::SetDeviceRange;
+    if (same(name, "GPRSSETTINGS"))
+        return Section::GprsSettings;
+    if (same(name, "SIMULATOR"))
+        return Section::Simulator;
+    if (same(name, "SETGROUP"))
+        return Section::SetGroup;
+    return Section::Other;
+}
+
+// Values of the keys up to the closing "}", lines look like key="value".
+// Returns a bit per key found
+template <size_t N>
+quint32 parseSection(LineReader &reader, const std::array<QByteArrayView, N> &keys, std::array<QString, N> &values)
+{
+    static_assert(N <= 32, "one bit per key");
+    quint32 found = 0;
+    QByteArrayView line;
+    while (reader.next(line))
+    {
+        if (line.startsWith('}'))
             break;
-        }
 
-        for (const QString& key : keys)
+        const char *equals = static_cast<const char*>(memchr(line.data(), '=', line.size()));
+        if (!equals || equals == line.data())
+            continue;
+        const qsizetype separator = equals - line.data();
+        const QByteArrayView key = line.first(separator);
+        for (size_t i = 0; i < N; i++)
         {
-            if (line.startsWith(key + "="))
-            {
-                QString value = line.mid(key.length() + 2, line.length() - key.length() - 3);
-                sectionData.insert(key, value);
-                break;
-            }
+            if (!same(key, keys[i]))
+                continue;
+            QByteArrayView value = line.sliced(separator + 1);
+            if (value.startsWith('"'))
+                value = value.sliced(1);
+            if (value.endsWith('"'))
+                value.chop(1);
+            // Windows-1251 in the usual files, the system code page
+            values[i] = QString::fromLocal8Bit(value);
+            found |= 1u << i;
+            break;
         }
     }
+    return found;
+}
+
+template <size_t N>
+QMap<QString, QString> parseSettings(LineReader &reader, const std::array<QByteArrayView, N> &keys)
+{
+    std::array<QString, N> values;
+    const quint32 found = parseSection(reader, keys, values);
+
+    QMap<QString, QString> settings;
+    for (size_t i = 0; i < N; i++)
+    {
+        if (found & (1u << i))
+            settings.insert(QString::fromLatin1(keys[i]), values[i]);
+    }
+    return settings;
+}
 
-    return sectionData;
 }
 
 void IniParser::parseIniFile(const QString& filePath)
 {
+    QElapsedTimer loadTime;
+    loadTime.start();
+
     QFile file(filePath);
 
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (!file.open(QIODevice::ReadOnly))
     {
         _logger->logError(tr("Не удалось открыть .ini файл: ") + file.errorString());
         return;
     }
 
-    QTextStream in(&file);
-    in.setEncoding(QStringConverter::System);
-    // не работает если в системе выставить "Использовать Юникод (UTF-8) для поддержки языка во всем мире"
-//    QByteArray fileContent = file.readAll();
-//    QTextCodec* codec1251 = QTextCodec::codecForName("Windows-1251");
-//    QString decodedContent = codec1251->toUnicode(fileContent);
-//    QTextStream in(&decodedContent, QIODevice::ReadOnly);
+    // One pass over the mapped file, read into memory if it can not be mapped
+    qint64 size = file.size();
+    uchar *mapped = size > 0 ? file.map(0, size) : nullptr;
+    QByteArray content;
+    if (!mapped)
+    {
+        content = file.readAll();
+        size = content.size();
+    }
+    LineReader reader(mapped ? reinterpret_cast<const char*>(mapped) : content.constData(), size);
 
-    QString currentSection;
+    static const std::array<QByteArrayView, 2> gprsKeys = { "ip", "port" };
+    static const std::array<QByteArrayView, 19> simulatorKeys = {
+        "threads", "transport",
+        "connect_profile", "connect_rate", "connect_ramp",
+        "connect_steps", "connect_step_time",
+        "spike_rate", "spike_period", "spike_duration",
+        "connect_burst", "connect_max_pending", "connect_seed",
+        "send_phase", "send_jitter",
+        "source_ips", "source_ports",
+        "capture_dir", "capture_file_size" };
+    enum { Phone, Name, Groups, Count };
+    static const std::array<QByteArrayView, 3> deviceKeys = { "phone", "name", "groups" };
+    static const std::array<QByteArrayView, 4> rangeKeys = { "phone", "name", "groups", "count" };
+    static const std::array<QByteArrayView, 2> groupKeys = { "name", "expr" };
 
-    while (!in.atEnd())
-    {
-        QString line = in.readLine().trimmed();
+    // Names by device index, the devices are created after the whole file is read
+    std::vector<QString> names;
+    // #SETGROUP name and expression, evaluated once all devices are known
+    QList<std::array<QString, 2>> groupSections;
+    // Bad tag names are reported once, not for every device of a range
+    QSet<QString> badTags;
 
+    auto addDevice = [&](const QString &phone, const QString &name, const QString &tags) {
+        const quint32 index = devices.add(phone);
+        if (index == DeviceIndex::NONE)
+        {
+            _logger->logWarning(tr("Устройство с номером ") + phone + tr(" уже существует"));
+            return;
+        }
+        names.push_back(name);
+        for (const QString &tag : tags.split(',', Qt::SkipEmptyParts))
+        {
+            const QString group = tag.trimmed();
+            QString error;
+            if (!groups.addTag(group, index, &error) && !badTags.contains(group))
+            {
+                badTags.insert(group);
+                _logger->logWarning(tr("Группа ") + group + ": " + error);
+            }
+        }
+    };
+
+    Section currentSection = Section::Other;
+    QByteArrayView line;
+    while (reader.next(line))
+    {
         if (line.startsWith('#'))
         {
-            QString section = line.mid(1);
-            currentSection = section;
+            currentSection = sectionOf(line.sliced(1));
         }
-        else if (line.startsWith("{"))
+        else if (line.startsWith('{'))
         {
-            if (currentSection == "GPRSSETTINGS")
+            switch (currentSection)
             {
-                QStringList keys = { "ip", "port" };
-                gprsSettings = parseSection(in, keys);
+            case Section::GprsSettings:
+                gprsSettings = parseSettings(reader, gprsKeys);
+                break;
+            case Section::Simulator:
+                simulatorSettings = parseSettings(reader, simulatorKeys);
+                break;
+            case Section::SetDevice:
+            {
+                std::array<QString, 3> values;
+                parseSection(reader, deviceKeys, values);
+                addDevice(values[Phone], values[Name], values[Groups]);
+                break;
             }
-            else if (currentSection == "SETDEVICE")
+            case Section::SetDeviceRange:
             {
-                QStringList keys = { "phone", "name" };
-                QMap<QString, QString> setDevice = parseSection(in, keys);
-                if (!devices.contains(setDevice["phone"]))
+                // phone is the first number, its width is kept: 0700 0701 ...
+                // {n} in the name is the number in the range from 1, {phone} the phone
+                std::array<QString, 4> values;
+                parseSection(reader, rangeKeys, values);
+                bool phoneOk = false;
+                bool countOk = false;
+                const quint64 firstPhone = values[Phone].toULongLong(&phoneOk);
+                const int count = values[Count].toInt(&countOk);
+                if (!phoneOk || !countOk || count <= 0)
                 {
-                    Device* device = new Device(setDevice["phone"], setDevice["name"], _logger);
-                    devices.insert(setDevice["phone"], device);
-
-                    device->setIp(gprsSettings["ip"]);
-                    device->setPort(getPort());
+                    _logger->logWarning(tr("Неверный диапазон устройств: phone=") + values[Phone] +
+                                        " count=" + values[Count]);
+                    break;
                 }
-                else
+                devices.reserve(devices.size() + count);
+                names.reserve(names.size() + count);
+                for (int n = 0; n < count; n++)
                 {
-                    _logger->logWarning(tr("Устройство с номером ") + setDevice["phone"] + tr(" уже существует"));
+                    const QString phone = QString::number(firstPhone + n).rightJustified(values[Phone].size(), '0');
+                    QString name = values[Name];
+                    name.replace("{n}", QString::number(n + 1));
+                    name.replace("{phone}", phone);
+                    addDevice(phone, name, values[Groups]);
                 }
+                break;
+            }
+            case Section::SetGroup:
+            {
+                std::array<QString, 2> values;
+                parseSection(reader, groupKeys, values);
+                groupSections.append(values);
+                break;
+            }
+            case Section::Other:
+                break;
             }
         }
     }
 
+    if (mapped)
+        file.unmap(mapped);
     file.close();
+
+    Transport::setBackend(getTransportBackend());
+    _pool->connectScheduler()->setProfile(getConnectProfile());
+    PhaseScheduler::instance().configure(getSendPhaseMode(), getSendJitter());
+    configureSourceAddresses();
+    configureCapture();
+    _pool->start(getThreadCount());
+
+    // Device with its TcpClient and ModbusHandler is built in the thread that runs it
+    const QString ip = gprsSettings.value("ip");
+    const quint16 port = getPort();
+    const std::vector<Device*> created = _pool->createDevices(devices.size(), [&](int i) {
+        Device *device = new Device(devices.phone(i), names[i], _logger);
+        device->setIp(ip);
+        device->setPort(port);
+        return device;
+    });
+    for (int i = 0; i < devices.size(); i++)
+        devices.set(i, created[i]);
+
+    groups.setDevices(devices);
+    for (const auto &section : groupSections)
+    {
+        QString error;
+        if (!groups.define(section[0], section[1], &error))
+            _logger->logWarning(tr("Группа ") + section[0] + ": " + error);
+    }
+
+    _logger->logInfo(tr("Загружено устройств: ") + QString::number(devices.size()) +
+                     tr(" за ") + QString::number(loadTime.elapsed()) + tr(" мс"));
 }
 
 quint16 IniParser::getPort()
@@ -107,13 +313,134 @@ quint16 IniParser::getPort()
     return port;
 }
 
+int IniParser::getThreadCount()
+{
+    return simulatorSettings.value("threads").toInt();
+}
+
+Transport::Backend IniParser::getTransportBackend()
+{
+    QString transport = simulatorSettings.value("transport").toLower();
+    if (transport != "io_uring" && transport != "uring")
+        return Transport::Backend::QtSocket;
+
+    if (!Transport::isCompiledIn(Transport::Backend::IoUring))
+    {
+        _logger->logWarning(tr("Сборка без поддержки io_uring, используется QTcpSocket"));
+        return Transport::Backend::QtSocket;
+    }
+    return Transport::Backend::IoUring;
+}
+
+ConnectProfile IniParser::getConnectProfile()
+{
+    ConnectProfile profile;
+    QString shape = simulatorSettings.value("connect_profile").toLower();
+    if (shape == "linear")
+        profile.shape = ConnectProfile::Shape::Linear;
+    else if (shape == "step")
+        profile.shape = ConnectProfile::Shape::Step;
+    else if (shape == "spike")
+        profile.shape = ConnectProfile::Shape::Spike;
+    else if (shape == "poisson")
+        profile.shape = ConnectProfile::Shape::Poisson;
+    else if (!shape.isEmpty() && shape != "uniform")
+        _logger->logWarning(tr("Неизвестный профиль подключений ") + shape + tr(", используется uniform"));
+
+    // Missing keys keep the defaults
+    auto readDouble = [this](const QString &key, double &value) {
+        bool ok;
+        double read = simulatorSettings.value(key).toDouble(&ok);
+        if (ok)
+            value = read;
+    };
+    auto readInt = [this](const QString &key, int &value) {
+        bool ok;
+        int read = simulatorSettings.value(key).toInt(&ok);
+        if (ok)
+            value = read;
+    };
+
+    readDouble("connect_rate", profile.rate);
+    readInt("connect_ramp", profile.rampTime);
+    readInt("connect_steps", profile.steps);
+    readInt("connect_step_time", profile.stepTime);
+    readDouble("spike_rate", profile.spikeRate);
+    readInt("spike_period", profile.spikePeriod);
+    readInt("spike_duration", profile.spikeDuration);
+    readDouble("connect_burst", profile.burst);
+    readInt("connect_max_pending", profile.maxPending);
+
+    bool ok;
+    quint64 seed = simulatorSettings.value("connect_seed").toULongLong(&ok);
+    if (ok)
+        profile.seed = seed;
+
+    profile.burst = qMax(profile.burst, 1.0);
+    return profile;
+}
+
+PhaseScheduler::Mode IniParser::getSendPhaseMode()
+{
+    QString mode = simulatorSettings.value("send_phase").toLower();
+    if (mode == "herd")
+        return PhaseScheduler::Mode::Herd;
+    if (!mode.isEmpty() && mode != "spread")
+        _logger->logWarning(tr("Неизвестный режим отправки состояния ") + mode + tr(", используется spread"));
+    return PhaseScheduler::Mode::Spread;
+}
+
+int IniParser::getSendJitter()
+{
+    return simulatorSettings.value("send_jitter").toInt();
+}
+
+void IniParser::configureSourceAddresses()
+{
+    SourceAddressPool &sources = SourceAddressPool::instance();
+    QString list = simulatorSettings.value("source_ips");
+    if (!sources.configure(list, simulatorSettings.value("source_ports").toInt()))
+    {
+        _logger->logWarning(tr("Неверный список source_ips, адрес выбирает система: ") + list);
+        return;
+    }
+    if (!sources.isEmpty())
+        _logger->logInfo(tr("Исходящих адресов: ") + QString::number(sources.addressCount()));
+}
+
+void IniParser::configureCapture()
+{
+    TrafficCapture &capture = TrafficCapture::instance();
+    capture.setLogger(_logger);
+    QString directory = simulatorSettings.value("capture_dir");
+    if (directory.isEmpty())
+    {
+        capture.stop();
+        return;
+    }
+
+    // Megabytes per file, 0 disables rotation
+    bool ok;
+    qint64 fileSize = simulatorSettings.value("capture_file_size").toLongLong(&ok);
+    if (!ok)
+        fileSize = DEFAULT_CAPTURE_FILE_SIZE;
+
+    QString error;
+    if (capture.start(directory, fileSize * 1024 * 1024, &error))
+        _logger->logInfo(tr("Запись трафика в ") + QDir(directory).absolutePath());
+    else
+        _logger->logError(tr("Не удалось начать запись трафика: ") + error);
+}
+
 void IniParser::clearData()
 {
     for (auto &device : devices)
     {
-        delete device;
+        _pool->removeDevice(device);
     }
 
     devices.clear();
+    groups.clear();
     gprsSettings.clear();
+    simulatorSettings.clear();
 }
@@ -3,31 +3,55 @@
 
 #include <QObject>
 #include <QFile>
-#include <QTextStream>
 #include "device.h"
+#include "devicegroups.h"
+#include "deviceindex.h"
 #include "logger.h"
+#include "devicepool.h"
+#include "transport.h"
+#include "phasescheduler.h"
+#include "sourceaddresspool.h"
+#include "trafficcapture.h"
 
 class IniParser : public QObject
 {
     Q_OBJECT
 public:
-    explicit IniParser(Logger *logger, QObject *parent = nullptr);
+    explicit IniParser(Logger *logger, DevicePool *pool, QObject *parent = nullptr);
     ~IniParser();
 
     void parseIniFile(const QString &filePath);
     quint16 getPort();
+    // Number of device threads from #SIMULATOR, 0 means one per core
+    int getThreadCount();
+    // Connection backend from #SIMULATOR: "qt" (default) or "io_uring"
+    Transport::Backend getTransportBackend();
+    // Connect ramp from #SIMULATOR, uniform random delays if not set
+    ConnectProfile getConnectProfile();
+    // Phases of periodic state sends from #SIMULATOR
+    PhaseScheduler::Mode getSendPhaseMode();
+    int getSendJitter();
 
     void clearData();
 
 public:
     QMap<QString, QString> gprsSettings;
-    QMap<QString, Device*> devices;
+    QMap<QString, QString> simulatorSettings;
+    DeviceIndex devices;
+    // Tags from #SETDEVICE groups="a,b" and #SETGROUP name/expr sections
+    DeviceGroups groups;
 
 private:
+    static constexpr qint64 DEFAULT_CAPTURE_FILE_SIZE = 1024;
+
     Logger *_logger;
+    DevicePool *_pool;
 
 private:
-    QMap<QString, QString> parseSection(QTextStream& in, const QStringList& keys);
+    // Local addresses to connect from, "source_ips" in #SIMULATOR
+    void configureSourceAddresses();
+    // Traffic capture files, "capture_dir" and "capture_file_size" (MB) in #SIMULATOR
+    void configureCapture();
 };
 
 #endif // INIPARSER_H
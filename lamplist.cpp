@@ -1,6 +1,7 @@
 #include "lamplist.h"
 #include <QDebug>
 #include <numeric>
+#include <utility>
 
 #define SWAP_HL_UINT(i) ((i&0xFF)<<24)|((i&0xFF00)<<8)|((i&0xFF0000)>>8)|((i&0xFF000000)>>24)
 #define SWAP_HL_SHORT(i) ((i&0xFF)<<8)|((i&0xFF00)>>8)
@@ -62,7 +63,7 @@ void LampList::updateNodes()
 
     prevNodes = nodes;
 
-    emit nodesUpdated();
+    emit nodesUpdated(std::exchange(deviceArray, QByteArray()));
 }
 
 bool LampList::isNodesListEmpty() const
@@ -61,7 +61,8 @@ private:
     bool writeNodesToByteArray(const QList<Node> &nodes);
 
 signals:
-    void nodesUpdated();
+    // File is handed to the device thread, the list keeps no copy of it
+    void nodesUpdated(const QByteArray &file);
 };
 
 #endif // LAMPLIST_H
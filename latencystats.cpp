@@ -0,0 +1,329 @@
+#include "latencystats.h"
+#include "Prot.h"
+#include <QDateTime>
+#include <QFile>
+#include <QMutex>
+#include <QTextStream>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+using Buckets = std::atomic<quint64>[LatencyHistogram::BUCKETS];
+
+// Histograms of one thread. Only the owner writes, collect() reads under the registry mutex
+struct LatencyShard
+{
+    Buckets connectToSync{};
+    Buckets pushToPoll{};
+    // Allocated on the first request of the command
+    std::array<std::atomic<std::atomic<quint64>*>, 256> pollInterval{};
+
+    ~LatencyShard()
+    {
+        for (auto &buckets : pollInterval)
+            delete[] buckets.load(std::memory_order_relaxed);
+    }
+};
+
+struct Registry
+{
+    QMutex mutex;
+    std::vector<LatencyShard*> shards;
+    // Finished threads
+    LatencyStats::Report retired;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+void addBuckets(LatencyHistogram &to, const std::atomic<quint64> *from)
+{
+    for (int bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++)
+    {
+        const quint64 count = from[bucket].load(std::memory_order_relaxed);
+        if (count)
+            to.add(bucket, count);
+    }
+}
+
+// Caller holds the registry mutex
+void addShard(LatencyStats::Report &report, const LatencyShard &shard)
+{
+    addBuckets(report.connectToSync, shard.connectToSync);
+    addBuckets(report.pushToPoll, shard.pushToPoll);
+    for (int command = 0; command < 256; command++)
+    {
+        const std::atomic<quint64> *buckets = shard.pollInterval[command].load(std::memory_order_acquire);
+        if (buckets)
+            addBuckets(report.pollInterval[static_cast<quint8>(command)], buckets);
+    }
+}
+
+void mergeReport(LatencyStats::Report &to, const LatencyStats::Report &from)
+{
+    to.connectToSync.merge(from.connectToSync);
+    to.pushToPoll.merge(from.pushToPoll);
+    for (const auto &entry : from.pollInterval)
+        to.pollInterval[entry.first].merge(entry.second);
+}
+
+// Registers the shard of the thread and keeps its data when the thread finishes
+struct ShardHolder
+{
+    LatencyShard *shard = new LatencyShard;
+
+    ShardHolder()
+    {
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        r.shards.push_back(shard);
+    }
+
+    ~ShardHolder()
+    {
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        addShard(r.retired, *shard);
+        r.shards.erase(std::find(r.shards.begin(), r.shards.end(), shard));
+        delete shard;
+    }
+};
+
+LatencyShard &localShard()
+{
+    static thread_local ShardHolder holder;
+    return *holder.shard;
+}
+
+// Single writer, plain load and store are enough
+inline void increment(std::atomic<quint64> &counter)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+QString commandName(quint8 command)
+{
+    for (const ProtCommand &entry : PROT_COMMANDS)
+    {
+        if (entry.cmd == command)
+            return QString::fromLatin1(entry.name);
+    }
+    return QString("0x%1").arg(command, 2, 16, QChar('0'));
+}
+
+QString formatLine(const QString &name, const LatencyHistogram &histogram)
+{
+    auto ms = [](quint64 micros) { return QString::number(micros / 1000.0, 'f', 3); };
+    return QString("%1 %2 %3 %4 %5 %6\n")
+        .arg(name, -24)
+        .arg(histogram.count(), 10)
+        .arg(ms(histogram.percentile(0.5)), 12)
+        .arg(ms(histogram.percentile(0.99)), 12)
+        .arg(ms(histogram.percentile(0.999)), 12)
+        .arg(ms(histogram.max()), 12);
+}
+
+// Raw buckets for offline analysis: upper bound in us and count
+void dumpBuckets(QTextStream &out, const QString &name, const LatencyHistogram &histogram)
+{
+    for (int bucket = 0; bucket < LatencyHistogram::BUCKETS; bucket++)
+    {
+        if (histogram.countAt(bucket))
+            out << name << ' ' << LatencyHistogram::valueOf(bucket) << ' ' << histogram.countAt(bucket) << '\n';
+    }
+}
+
+}
+
+LatencyHistogram::LatencyHistogram()
+    : counts(BUCKETS, 0)
+{}
+
+int LatencyHistogram::bucketOf(quint64 micros)
+{
+    constexpr quint64 limit = (quint64(1) << MAX_BITS) - 1;
+    if (micros > limit)
+        micros = limit;
+    if (micros < (quint64(2) << SUB_BITS))
+        return static_cast<int>(micros);
+
+    const int exponent = 63 - qCountLeadingZeroBits(micros) - SUB_BITS;
+    return (exponent << SUB_BITS) + static_cast<int>(micros >> exponent);
+}
+
+quint64 LatencyHistogram::valueOf(int bucket)
+{
+    if (bucket < (2 << SUB_BITS))
+        return static_cast<quint64>(bucket);
+
+    const int exponent = (bucket >> SUB_BITS) - 1;
+    const quint64 mantissa = static_cast<quint64>(bucket - (exponent << SUB_BITS));
+    return ((mantissa + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::add(int bucket, quint64 count)
+{
+    counts[bucket] += count;
+    total += count;
+}
+
+void LatencyHistogram::record(quint64 micros)
+{
+    add(bucketOf(micros), 1);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (int bucket = 0; bucket < BUCKETS; bucket++)
+        counts[bucket] += other.counts[bucket];
+    total += other.total;
+}
+
+quint64 LatencyHistogram::countAt(int bucket) const
+{
+    return counts[bucket];
+}
+
+quint64 LatencyHistogram::count() const
+{
+    return total;
+}
+
+quint64 LatencyHistogram::max() const
+{
+    for (int bucket = BUCKETS - 1; bucket >= 0; bucket--)
+    {
+        if (counts[bucket])
+            return valueOf(bucket);
+    }
+    return 0;
+}
+
+quint64 LatencyHistogram::percentile(double fraction) const
+{
+    if (total == 0)
+        return 0;
+
+    const quint64 target = qMax<quint64>(static_cast<quint64>(std::ceil(fraction * total)), 1);
+    quint64 seen = 0;
+    for (int bucket = 0; bucket < BUCKETS; bucket++)
+    {
+        seen += counts[bucket];
+        if (seen >= target)
+            return valueOf(bucket);
+    }
+    return max();
+}
+
+quint64 LatencyStats::now()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyStats::record(LatencyMetric metric, quint64 micros, quint8 command)
+{
+    LatencyShard &shard = localShard();
+    const int bucket = LatencyHistogram::bucketOf(micros);
+
+    switch (metric)
+    {
+    case LatencyMetric::ConnectToSync:
+        increment(shard.connectToSync[bucket]);
+        break;
+    case LatencyMetric::PushToPoll:
+        increment(shard.pushToPoll[bucket]);
+        break;
+    case LatencyMetric::PollInterval:
+    {
+        std::atomic<quint64> *buckets = shard.pollInterval[command].load(std::memory_order_relaxed);
+        if (!buckets)
+        {
+            buckets = new std::atomic<quint64>[LatencyHistogram::BUCKETS]();
+            shard.pollInterval[command].store(buckets, std::memory_order_release);
+        }
+        increment(buckets[bucket]);
+        break;
+    }
+    }
+}
+
+LatencyStats::Report LatencyStats::collect()
+{
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    Report report;
+    mergeReport(report, r.retired);
+    for (const LatencyShard *shard : r.shards)
+        addShard(report, *shard);
+    return report;
+}
+
+void LatencyStats::reset()
+{
+    Registry &r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    r.retired = Report();
+    for (LatencyShard *shard : r.shards)
+    {
+        for (auto &counter : shard->connectToSync)
+            counter.store(0, std::memory_order_relaxed);
+        for (auto &counter : shard->pushToPoll)
+            counter.store(0, std::memory_order_relaxed);
+        for (auto &buckets : shard->pollInterval)
+        {
+            std::atomic<quint64> *poll = buckets.load(std::memory_order_acquire);
+            for (int bucket = 0; poll && bucket < LatencyHistogram::BUCKETS; bucket++)
+                poll[bucket].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+QString LatencyStats::format(const Report &report)
+{
+    QString text = QString("%1 %2 %3 %4 %5 %6\n")
+        .arg("metric", -24)
+        .arg("count", 10)
+        .arg("p50 ms", 12)
+        .arg("p99 ms", 12)
+        .arg("p999 ms", 12)
+        .arg("max ms", 12);
+    text += formatLine("connect->sync", report.connectToSync);
+    text += formatLine("push->poll", report.pushToPoll);
+    for (const auto &entry : report.pollInterval)
+        text += formatLine("poll " + commandName(entry.first), entry.second);
+    return text;
+}
+
+bool LatencyStats::dump(const QString &filePath, QString *error)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    const Report report = collect();
+    QTextStream out(&file);
+    out << "# " << QDateTime::currentDateTime().toString(Qt::ISODate) << "\n";
+    out << format(report);
+
+    out << "\n# buckets: metric upper_us count\n";
+    dumpBuckets(out, "connect->sync", report.connectToSync);
+    dumpBuckets(out, "push->poll", report.pushToPoll);
+    for (const auto &entry : report.pollInterval)
+        dumpBuckets(out, "poll_" + commandName(entry.first), entry.second);
+    return true;
+}
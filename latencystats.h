@@ -0,0 +1,73 @@
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QString>
+#include <QtGlobal>
+#include <map>
+#include <vector>
+
+// Гистограмма задержек в микросекундах в стиле HDR: логарифмические
+// интервалы по 128 линейных ячеек, погрешность меньше 1% от 1 мкс до ~12 суток.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BITS = 7;
+    static constexpr int MAX_BITS = 40;
+    static constexpr int BUCKETS = (MAX_BITS - SUB_BITS) * (1 << SUB_BITS) + (2 << SUB_BITS);
+
+    LatencyHistogram();
+
+    static int bucketOf(quint64 micros);
+    // Highest value that falls into the bucket
+    static quint64 valueOf(int bucket);
+
+    void add(int bucket, quint64 count);
+    void record(quint64 micros);
+    void merge(const LatencyHistogram &other);
+
+    quint64 countAt(int bucket) const;
+    quint64 count() const;
+    quint64 max() const;
+    // Value below which the fraction of samples lies, 0.99 for p99
+    quint64 percentile(double fraction) const;
+
+private:
+    std::vector<quint64> counts;
+    quint64 total = 0;
+};
+
+// Что измеряем
+enum class LatencyMetric
+{
+    ConnectToSync,  // TCP connect to the first sync from the server
+    PushToPoll,     // unsolicited state push to the next server request
+    PollInterval    // between two server requests with the same command
+};
+
+// Задержки реакции сервера. Каждый поток устройств пишет в свои гистограммы
+// без блокировок, collect() складывает их по запросу (GUI, дамп в файл).
+// Гистограммы завершившихся потоков сохраняются до reset().
+class LatencyStats
+{
+public:
+    struct Report
+    {
+        LatencyHistogram connectToSync;
+        LatencyHistogram pushToPoll;
+        // Key is the command code
+        std::map<quint8, LatencyHistogram> pollInterval;
+    };
+
+    // Microseconds of the monotonic clock
+    static quint64 now();
+    // Called in the device thread
+    static void record(LatencyMetric metric, quint64 micros, quint8 command = 0);
+
+    static Report collect();
+    static void reset();
+    // Text table with count, p50, p99, p999 and max in ms for every histogram
+    static QString format(const Report &report);
+    static bool dump(const QString &filePath, QString *error = nullptr);
+};
+
+#endif // LATENCYSTATS_H
@@ -37,7 +37,7 @@ LightDevicesWindow::~LightDevicesWindow()
     delete ui;
 }
 
-void LightDevicesWindow::setDevices(const QMap<QString, Device *> &devices)
+void LightDevicesWindow::setDevices(const DeviceIndex &devices)
 {
     this->devices = devices;
     updateDeviceComboBox();
@@ -51,7 +51,9 @@ void LightDevicesWindow::showEvent(QShowEvent *event)
         return;
 
     QString selectedDeviceName = ui->devicesCombo->currentText();
-    Device* selectedDevice = devices[selectedDeviceName];
+    Device* selectedDevice = devices.value(selectedDeviceName);
+    if (!selectedDevice)
+        return;
     lampList = selectedDevice->getLampList();
     if (lampList->isNodesListEmpty())
         return;
@@ -215,7 +217,7 @@ void LightDevicesWindow::onLampsComboIndexChaned()
         case LampState::SetForChosen:
         {
             QString selectedDeviceName = ui->devicesCombo->currentText();
-            Device* selectedDevice = devices[selectedDeviceName];
+            Device* selectedDevice = devices.value(selectedDeviceName);
 
             lampList = selectedDevice->getLampList();
             lampNode = lampList->getNodeById(currLampID);
@@ -231,7 +233,7 @@ void LightDevicesWindow::onLampsComboIndexChaned()
 
         default:
         {
-            Device* currentDevice = devices.begin().value();
+            Device* currentDevice = devices.at(0);
 
             lampList = currentDevice->getLampList();
             lampNode = lampList->getNodeById(currLampID);
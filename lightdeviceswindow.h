@@ -3,6 +3,7 @@
 
 #include <QDialog>
 #include "device.h"
+#include "deviceindex.h"
 
 namespace Ui {
 class LightDevicesWindow;
@@ -22,14 +23,14 @@ public:
     explicit LightDevicesWindow(QWidget *parent = nullptr);
     ~LightDevicesWindow();
 
-    void setDevices(const QMap<QString, Device*> &devices);
+    void setDevices(const DeviceIndex &devices);
 
 protected:
     void showEvent(QShowEvent *event) override;
 
 private:
     Ui::LightDevicesWindow *ui;
-    QMap<QString, Device*> devices;
+    DeviceIndex devices;
     LampList* lampList;
     Node* lampNode;
     LampState currentState;
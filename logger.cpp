@@ -1,14 +1,48 @@
 #include "logger.h"
+#include "logmodel.h"
+#include <QDateTime>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// Microseconds of the monotonic clock
+qint64 monotonicNow()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+}
 
 Logger::Logger(QObject *parent)
     : QObject{parent}
-    , logWindow(nullptr)
+    , logModel(new LogModel(LogModel::DEFAULT_CAPACITY, this))
     , closing(false)
-{}
+    , stopping(false)
+    , dropped(0)
+    , pendingBatches(0)
+    , console(false)
+    , minimumLevel(0)
+    , ring(RING_SIZE)
+    , wallBase(QDateTime::currentMSecsSinceEpoch() * 1000 - monotonicNow())
+{
+    consumer.reset(QThread::create([this] { consume(); }));
+    consumer->setObjectName("Logger");
+    consumer->start(QThread::LowPriority);
+}
 
-void Logger::setLogWindow(QTextBrowser *logBrowser)
+Logger::~Logger()
 {
-    logWindow = logBrowser;
+    stopping = true;
+    consumer->wait();
+}
+
+LogModel *Logger::model() const
+{
+    return logModel;
 }
 
 void Logger::disableGUI()
@@ -16,42 +50,134 @@ void Logger::disableGUI()
     closing = true;
 }
 
-void Logger::logInfo(const QString &message)
+void Logger::setConsoleOutput(LogLevel level)
 {
-    if (closing) return;
+    minimumLevel = static_cast<int>(level);
+    console = true;
+}
 
-    if (logWindow)
-    {
-        logWindow->append(QString("<font color='green'>[INFO] %1</font>").arg(message));
-    }
+void Logger::logInfo(const QString &message)
+{
+    logEvent(LogLevel::Info, LogEvent::Text, QString(), 0, QByteArray(), message);
 }
 
 void Logger::logWarning(const QString &message)
 {
-    if (closing) return;
+    logEvent(LogLevel::Warning, LogEvent::Text, QString(), 0, QByteArray(), message);
+}
+
+void Logger::logError(const QString &message)
+{
+    logEvent(LogLevel::Error, LogEvent::Text, QString(), 0, QByteArray(), message);
+}
 
-    if (logWindow)
+void Logger::logEvent(LogLevel level, LogEvent event, const QString &device,
+                      quint32 arg, const QByteArray &frame, const QString &text)
+{
+    if (closing || static_cast<int>(level) < minimumLevel.load(std::memory_order_relaxed)) return;
+
+    const qint64 time = wallBase + monotonicNow();
+    const bool pushed = ring.pushWith([&](LogEntry &entry) {
+        entry.time = time;
+        entry.level = level;
+        entry.event = event;
+        entry.arg = frame.isEmpty() ? arg : static_cast<quint32>(frame.size());
+        entry.device = device;
+        entry.text = text;
+        entry.frameSize = static_cast<quint16>(qMin<qsizetype>(frame.size(), MAX_FRAME));
+        memcpy(entry.frame, frame.constData(), entry.frameSize);
+    });
+    // Never wait in a device thread, the loss is reported by the consumer
+    if (!pushed)
+        dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::consume()
+{
+    QVector<LogRecord> batch;
+    // Frame copies are made here, in the logger thread
+    auto take = [&batch](LogEntry &entry) {
+        LogRecord record;
+        record.time = entry.time;
+        record.level = entry.level;
+        record.event = entry.event;
+        record.arg = entry.arg;
+        // Moved out so the cell holds no string references
+        record.device = std::exchange(entry.device, QString());
+        record.text = std::exchange(entry.text, QString());
+        if (entry.frameSize)
+            record.frame = QByteArray(entry.frame, entry.frameSize);
+        batch.append(std::move(record));
+    };
+
+    while (true)
     {
-        logWindow->append(QString("<font color='orange'>[WARNING] %1</font>").arg(message));
+        // Stop only after the ring is drained
+        const bool stop = stopping;
+
+        // The GUI thread is behind, records wait in the ring meanwhile
+        if (!stop && pendingBatches.load(std::memory_order_acquire) >= MAX_PENDING_BATCHES)
+        {
+            QThread::msleep(10);
+            continue;
+        }
+
+        batch.reserve(BATCH_SIZE);
+        while (batch.size() < BATCH_SIZE)
+        {
+            if (!ring.popWith(take))
+                break;
+        }
+
+        const quint64 lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost)
+        {
+            LogRecord warning;
+            warning.time = wallBase + monotonicNow();
+            warning.level = LogLevel::Warning;
+            warning.text = tr("Очередь лога переполнена, пропущено сообщений: %1").arg(lost);
+            batch.append(std::move(warning));
+        }
+
+        if (!batch.isEmpty())
+        {
+            if (console)
+            {
+                print(batch);
+            }
+            else if (!stop)
+            {
+                pendingBatches.fetch_add(1, std::memory_order_acq_rel);
+                QMetaObject::invokeMethod(this, [this, batch] { deliver(batch); }, Qt::QueuedConnection);
+            }
+            batch = QVector<LogRecord>();
+            continue;
+        }
+
+        if (stop)
+            break;
+        QThread::msleep(10);
     }
 }
 
-void Logger::logError(const QString &message)
+// GUI thread
+void Logger::deliver(const QVector<LogRecord> &batch)
 {
+    pendingBatches.fetch_sub(1, std::memory_order_acq_rel);
     if (closing) return;
 
-    if (logWindow)
-    {
-        logWindow->append(QString("<font color='red'>[ERROR] %1</font>").arg(message));
-    }
+    logModel->append(batch);
 }
 
-QString Logger::byteArrToStr(const QByteArray &arr)
+// Logger thread
+void Logger::print(const QVector<LogRecord> &batch)
 {
-    QString result;
-    for (const char &byte : arr)
+    QByteArray lines;
+    for (const LogRecord &record : batch)
     {
-        result.append(QString("%1 ").arg(static_cast<unsigned char>(byte), 2, 16, QChar('0')));
+        lines += LogModel::text(record).toUtf8();
+        lines += '\n';
     }
-    return result.trimmed();
+    fwrite(lines.constData(), 1, static_cast<size_t>(lines.size()), stderr);
+    fflush(stderr);
 }
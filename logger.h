@@ -3,27 +3,110 @@
 
 #include <QObject>
 #include <QString>
-#include <QTextBrowser>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include "logring.h"
 
+enum class LogLevel : quint8 { Info, Warning, Error };
+
+// Событие устройства, текст собирается в потоке логгера
+enum class LogEvent : quint8
+{
+    Text,               // text only
+    Connected,
+    Disconnected,
+    NotConnected,
+    FrameReceived,      // frame
+    FrameSent,          // frame
+    SocketError,        // text
+    WrongCrc,           // arg: expected1, received1, expected2, received2 from the high byte
+    WrongTx,            // arg: expected << 8 | received
+    UnknownCommand      // arg: command
+};
+
+class LogModel;
+
+// Запись лога для модели и консоли: время, уровень, событие и данные
+struct LogRecord
+{
+    // Wall clock in microseconds, advanced by the monotonic clock
+    qint64 time = 0;
+    LogLevel level = LogLevel::Info;
+    LogEvent event = LogEvent::Text;
+    quint32 arg = 0;
+    QString device;
+    QString text;
+    // For FrameReceived/FrameSent arg is the size of the whole frame, frame
+    // may hold only its first Logger::MAX_FRAME bytes
+    QByteArray frame;
+};
+
+// Can be used from any thread. Calls only put a record into a lock-free ring,
+// a background thread hands batches of records to the model in the GUI thread
 class Logger : public QObject
 {
     Q_OBJECT
 public:
     Logger(QObject *parent = nullptr);
+    ~Logger();
 
-    void setLogWindow(QTextBrowser *logWindow);
+    // Rows of the log window, lives in the GUI thread
+    LogModel *model() const;
     void disableGUI();
+    // Runs without GUI: records from the level up are printed to stderr by the
+    // logger thread and the model stays empty. Call before logging starts
+    void setConsoleOutput(LogLevel minimumLevel);
 
     void logInfo(const QString &message);
     void logWarning(const QString &message);
     void logError(const QString &message);
+    // Largest frame: escaped body of PROT_MAX_SIZE and two frame ends
+    static constexpr int MAX_FRAME = 2 * 0x100 + 2;
 
-    QString byteArrToStr(const QByteArray &arr);
+    // Device event. Frame bytes are copied into the ring cell, the caller's
+    // buffer is not shared, longer data keeps only its first MAX_FRAME bytes
+    void logEvent(LogLevel level, LogEvent event, const QString &device,
+                  quint32 arg = 0, const QByteArray &frame = QByteArray(), const QString &text = QString());
 
 private:
-    QTextBrowser *logWindow;
+    static constexpr quint32 RING_SIZE = 65536;
+    // Records handed to the model at once
+    static constexpr int BATCH_SIZE = 4096;
+    // Batches posted but not yet added by the GUI thread
+    static constexpr int MAX_PENDING_BATCHES = 4;
+
+    // Ring cell: the frame lives inline, the device thread never allocates
+    // and never pins the writer or receive buffer
+    struct LogEntry
+    {
+        qint64 time = 0;
+        LogLevel level = LogLevel::Info;
+        LogEvent event = LogEvent::Text;
+        quint32 arg = 0;
+        QString device;
+        QString text;
+        quint16 frameSize = 0;
+        char frame[MAX_FRAME];
+    };
+
+    LogModel *logModel;
+
+    std::atomic<bool> closing;
+    std::atomic<bool> stopping;
+    std::atomic<quint64> dropped;
+    std::atomic<int> pendingBatches;
+    std::atomic<bool> console;
+    std::atomic<int> minimumLevel;
+    MpscRing<LogEntry> ring;
+    std::unique_ptr<QThread> consumer;
+    // Wall clock at the monotonic zero, microseconds
+    qint64 wallBase;
 
-    bool closing;
+    void consume();
+    void deliver(const QVector<LogRecord> &batch);
+    void print(const QVector<LogRecord> &batch);
 };
 
 #endif // LOGGER_H
@@ -0,0 +1,206 @@
+#include "logmodel.h"
+#include <QColor>
+#include <QDateTime>
+#include <algorithm>
+
+namespace {
+
+QString hexByte(quint32 value)
+{
+    return QString::number(value & 0xFF, 16).rightJustified(2, '0');
+}
+
+// Bytes of the frame, with the full size if the ring kept only its start
+QString frameText(const LogRecord &record)
+{
+    QString text = QString::fromLatin1(record.frame.toHex(' '));
+    if (record.arg > static_cast<quint32>(record.frame.size()))
+        text += QObject::tr(" ... (%1 байт)").arg(record.arg);
+    return text;
+}
+
+}
+
+LogModel::LogModel(int capacity, QObject *parent)
+    : QAbstractListModel(parent)
+    , records(static_cast<size_t>(qMax(capacity, 1)))
+    , firstSequence(0)
+    , nextSequence(0)
+    , minimumLevel(LogLevel::Info)
+{}
+
+int LogModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return static_cast<int>(rows.size());
+}
+
+QVariant LogModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= static_cast<int>(rows.size()))
+        return QVariant();
+
+    const LogRecord &entry = record(rows[index.row()]);
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return text(entry);
+    case Qt::ForegroundRole:
+        switch (entry.level)
+        {
+        case LogLevel::Info:
+            return QColor("green");
+        case LogLevel::Warning:
+            return QColor("orange");
+        default:
+            return QColor("red");
+        }
+    default:
+        return QVariant();
+    }
+}
+
+void LogModel::append(const QVector<LogRecord> &batch)
+{
+    const quint64 capacity = records.size();
+    // A batch larger than the ring keeps only its tail
+    const int skipped = batch.size() > static_cast<int>(capacity) ? batch.size() - static_cast<int>(capacity) : 0;
+    const quint64 batchStart = nextSequence;
+    const quint64 newNext = nextSequence + batch.size();
+    const quint64 newFirst = newNext > capacity ? qMax(firstSequence, newNext - capacity) : firstSequence;
+
+    // Evicted rows are always at the top
+    const auto evicted = std::lower_bound(rows.begin(), rows.end(), newFirst);
+    if (evicted != rows.begin())
+    {
+        beginRemoveRows(QModelIndex(), 0, static_cast<int>(evicted - rows.begin()) - 1);
+        rows.erase(rows.begin(), evicted);
+        endRemoveRows();
+    }
+    firstSequence = newFirst;
+
+    std::vector<quint64> added;
+    for (int i = skipped; i < batch.size(); i++)
+    {
+        const quint64 sequence = batchStart + i;
+        records[sequence % capacity] = batch[i];
+        if (accepts(batch[i]))
+            added.push_back(sequence);
+    }
+    nextSequence = newNext;
+
+    if (!added.empty())
+    {
+        const int first = static_cast<int>(rows.size());
+        beginInsertRows(QModelIndex(), first, first + static_cast<int>(added.size()) - 1);
+        rows.insert(rows.end(), added.begin(), added.end());
+        endInsertRows();
+    }
+}
+
+void LogModel::clear()
+{
+    beginResetModel();
+    rows.clear();
+    // Drop the frames too, not only the rows
+    std::fill(records.begin(), records.end(), LogRecord());
+    firstSequence = nextSequence;
+    endResetModel();
+}
+
+void LogModel::setMinimumLevel(LogLevel level)
+{
+    if (minimumLevel == level)
+        return;
+    minimumLevel = level;
+    rebuildRows();
+}
+
+void LogModel::setDeviceFilter(const QString &filter)
+{
+    if (deviceFilter == filter)
+        return;
+    deviceFilter = filter;
+    rebuildRows();
+}
+
+const LogRecord &LogModel::record(quint64 sequence) const
+{
+    return records[sequence % records.size()];
+}
+
+bool LogModel::accepts(const LogRecord &record) const
+{
+    if (record.level < minimumLevel)
+        return false;
+    if (deviceFilter.isEmpty())
+        return true;
+    // Text-only records keep the device ID inside the message
+    return record.device.contains(deviceFilter) || record.text.contains(deviceFilter);
+}
+
+void LogModel::rebuildRows()
+{
+    beginResetModel();
+    rows.clear();
+    for (quint64 sequence = firstSequence; sequence < nextSequence; sequence++)
+    {
+        if (accepts(record(sequence)))
+            rows.push_back(sequence);
+    }
+    endResetModel();
+}
+
+QString LogModel::text(const LogRecord &record)
+{
+    QString message;
+    switch (record.event)
+    {
+    case LogEvent::Text:
+        message = record.text;
+        break;
+    case LogEvent::Connected:
+        message = tr("Устройство с ID ") + record.device + tr(" подключено к серверу. Выполняется синхронизация...");
+        break;
+    case LogEvent::Disconnected:
+        message = tr("Устройство с ID ") + record.device + tr(" отключилось от сервера.");
+        break;
+    case LogEvent::NotConnected:
+        message = tr("Устройство c ID ") + record.device + tr(" не подключено к серверу!");
+        break;
+    case LogEvent::FrameReceived:
+        message = tr("ID ") + record.device + tr(" Получило сообщение: ") + frameText(record);
+        break;
+    case LogEvent::FrameSent:
+        message = tr("ID ") + record.device + tr(" Отправило сообщение: ") + frameText(record);
+        break;
+    case LogEvent::SocketError:
+        message = tr("Ошибка сокета: ") + record.text;
+        break;
+    case LogEvent::WrongCrc:
+        message = tr("Неправильная контрольная сумма. Ожидалось: %1%2 | Получено: %3%4").arg(
+            hexByte(record.arg >> 24), hexByte(record.arg >> 8),
+            hexByte(record.arg >> 16), hexByte(record.arg));
+        break;
+    case LogEvent::WrongTx:
+        message = tr("Tx не совпадают. Ожидалось: %1 | Получено: %2").arg(
+            hexByte(record.arg >> 8), hexByte(record.arg));
+        break;
+    case LogEvent::UnknownCommand:
+        message = tr("Устройство с ID ") + record.device + tr(" встретило незнакомую команду: ") +
+                  QString("0x%1").arg(hexByte(record.arg)) + tr(" Отправляю стандартный ответ...");
+        break;
+    }
+
+    const QString time = QDateTime::fromMSecsSinceEpoch(record.time / 1000).toString("hh:mm:ss.zzz");
+    switch (record.level)
+    {
+    case LogLevel::Info:
+        return QString("%1 [INFO] %2").arg(time, message);
+    case LogLevel::Warning:
+        return QString("%1 [WARNING] %2").arg(time, message);
+    default:
+        return QString("%1 [ERROR] %2").arg(time, message);
+    }
+}
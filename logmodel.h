@@ -0,0 +1,53 @@
+#ifndef LOGMODEL_H
+#define LOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <deque>
+#include <vector>
+#include "logger.h"
+
+// Модель окна лога: кольцо последних записей фиксированной емкости.
+// Старые записи вытесняются новыми, текст строки собирается только
+// когда представление ее запрашивает.
+class LogModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    static constexpr int DEFAULT_CAPACITY = 100000;
+
+    explicit LogModel(int capacity = DEFAULT_CAPACITY, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // GUI thread. Records are in the order they were logged
+    void append(const QVector<LogRecord> &batch);
+    void clear();
+
+    // Rows below the level are hidden
+    void setMinimumLevel(LogLevel level);
+    // Only rows whose device ID or text contains the filter, empty shows all
+    void setDeviceFilter(const QString &filter);
+
+    // Log line without colour: time, level and message
+    static QString text(const LogRecord &record);
+
+private:
+    std::vector<LogRecord> records;
+    // Sequence number of the oldest record kept and of the next one
+    quint64 firstSequence;
+    quint64 nextSequence;
+
+    // Sequence numbers of the rows shown, ascending
+    std::deque<quint64> rows;
+
+    LogLevel minimumLevel;
+    QString deviceFilter;
+
+    const LogRecord &record(quint64 sequence) const;
+    bool accepts(const LogRecord &record) const;
+    void rebuildRows();
+};
+
+#endif // LOGMODEL_H
@@ -0,0 +1,102 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+
+// Ограниченная очередь без блокировок: много писателей, один читатель
+// (кольцо Вьюкова с номерами последовательности в ячейках). Писатель занимает
+// ячейку одним CAS, переполненная очередь отказывает, а не ждет.
+template <typename T>
+class MpscRing
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit MpscRing(quint32 capacity)
+    {
+        quint32 size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (quint32 i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Any thread. False if the ring is full, value is left untouched then
+    bool push(T &&value)
+    {
+        return pushWith([&value](T &cell) { cell = std::move(value); });
+    }
+
+    // Any thread. fill(T &) writes the value right into the cell, for cells
+    // too large to build and move. False if the ring is full, fill is not called then
+    template <typename Fill>
+    bool pushWith(Fill &&fill)
+    {
+        quint64 position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[position & mask];
+            const quint64 sequence = cell.sequence.load(std::memory_order_acquire);
+            const qint64 difference = static_cast<qint64>(sequence - position);
+            if (difference == 0)
+            {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    fill(cell.value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only
+    bool pop(T &value)
+    {
+        return popWith([&value](T &cell) {
+            value = std::move(cell);
+            cell = T();
+        });
+    }
+
+    // Consumer thread only. take(T &) reads the cell in place and must not
+    // leave references to shared data in it
+    template <typename Take>
+    bool popWith(Take &&take)
+    {
+        Cell &cell = cells[dequeuePosition & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+            return false;
+
+        take(cell.value);
+        cell.sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+        dequeuePosition++;
+        return true;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<quint64> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    quint64 mask;
+    // Producers and the consumer write different cache lines
+    alignas(64) std::atomic<quint64> enqueuePosition{0};
+    alignas(64) quint64 dequeuePosition = 0;
+};
+
+#endif // LOGRING_H
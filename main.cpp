@@ -1,9 +1,20 @@
 #include "mainwindow.h"
+#include "headlessrunner.h"
 
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    // Load test boxes have no display, no widget is created in this mode
+    if (HeadlessRunner::requested(argc, argv))
+    {
+        QCoreApplication a(argc, argv);
+        HeadlessRunner runner;
+        if (!runner.start(a.arguments()))
+            return 1;
+        return a.exec();
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.setWindowState(Qt::WindowMaximized);
@@ -1,20 +1,25 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "filestore.h"
+#include "logmodel.h"
 #include <QDebug>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , logger(new Logger(this))
-    , iniParser(new IniParser(logger, this))
+    , devicePool(new DevicePool(this))
+    , iniParser(new IniParser(logger, devicePool, this))
     , lightDevicesWindow{nullptr}
     , ahpStateWindow{nullptr}
+    , deviceModel(new DeviceTableModel(this))
     , isRunning(false)
+    , statsTimer(new QTimer(this))
     , selectedDevices{}
     , toggledDevices{}
 {
     ui->setupUi(this);
-    logger->setLogWindow(ui->logWindow);
+    ui->logWindow->setModel(logger->model());
 
     spinBoxes[0] = {ui->conIntMinBox, DEFAULT_CONNECT_MIN_BOX};
     spinBoxes[1] = {ui->conIntSecBox, DEFAULT_CONNECT_SEC_BOX};
@@ -30,6 +35,7 @@ MainWindow::MainWindow(QWidget *parent)
     initStatusBar();
     initButtonGroups();
     initTabWidget();
+    initDeviceTable();
 
     // GUI connects
     connect(ui->multiConnectButton, &QPushButton::clicked, this, &MainWindow::onMultiConnectButtonClicked);
@@ -43,14 +49,26 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->enableLogForSelectedButton, &QRadioButton::toggled, this, &MainWindow::onEnableLogForSelectedButtonToggled);
     connect(ui->disableLogButton, &QRadioButton::toggled, this, &MainWindow::onDisableLogButtonToggled);
     connect(ui->clearLogButton, &QPushButton::clicked, this, &MainWindow::onClearLogButtonClicked);
+    connect(ui->logLevelBox, &QComboBox::currentIndexChanged, this, &MainWindow::onLogLevelBoxChanged);
+    connect(ui->logFilterEdit, &QLineEdit::textChanged, this, &MainWindow::onLogFilterEditChanged);
+    connect(logger->model(), &LogModel::rowsInserted, this, &MainWindow::onLogRowsInserted);
     connect(ui->turnOnDevicesButton, &QPushButton::clicked, this, &MainWindow::onTurnOnDevicesButtonClicked);
     connect(ui->turnOffDevicesButton, &QPushButton::clicked, this, &MainWindow::onTurnOffDevicesButtonClicked);
     connect(ui->listOfLampsAction, &QAction::triggered, this, &MainWindow::onListOfLampsActionTriggered);
     connect(ui->ahpStateAction, &QAction::triggered, this , &MainWindow::onAhpStateActionTriggered);
+    connect(ui->saveLatencyAction, &QAction::triggered, this, &MainWindow::onSaveLatencyActionTriggered);
+
+    connect(statsTimer, &QTimer::timeout, this, &MainWindow::onStatsTimerTimeout);
+    statsTimer->start(1000);
 }
 
 MainWindow::~MainWindow()
 {
+    // Devices are deleted in their threads, wait for it while the logger is alive
+    deviceModel->clear();
+    iniParser->clearData();
+    devicePool->stop();
+    TrafficCapture::instance().stop();
     delete ui;
 }
 
@@ -72,6 +90,12 @@ void MainWindow::initStatusBar()
     totalDevicesValue = new QLabel("0", this);
     numOfConnectedLabel = new QLabel(tr("Подключено:"), this);
     numOfConnectedValue = new QLabel("0", this);
+    threadsLabel = new QLabel(tr("Потоков:"), this);
+    threadsValue = new QLabel("0", this);
+    latencyLabel = new QLabel(tr("Синхронизация p50/p99/p999, мс:"), this);
+    latencyValue = new QLabel("-", this);
+    filesLabel = new QLabel(tr("Файлы, КБ (без общих):"), this);
+    filesValue = new QLabel("-", this);
 
     ui->statusBar->addWidget(ipLabel);
     ui->statusBar->addWidget(ipValue);
@@ -81,6 +105,12 @@ void MainWindow::initStatusBar()
     ui->statusBar->addWidget(totalDevicesValue);
     ui->statusBar->addWidget(numOfConnectedLabel);
     ui->statusBar->addWidget(numOfConnectedValue);
+    ui->statusBar->addWidget(threadsLabel);
+    ui->statusBar->addWidget(threadsValue);
+    ui->statusBar->addWidget(latencyLabel);
+    ui->statusBar->addWidget(latencyValue);
+    ui->statusBar->addWidget(filesLabel);
+    ui->statusBar->addWidget(filesValue);
 }
 
 void MainWindow::initSpinBoxes()
@@ -124,59 +154,41 @@ void MainWindow::initTabWidget()
     ui->relayStates->setCurrentIndex(0);
 }
 
-void MainWindow::populateDeviceTable(const QMap<QString, Device*> &devices)
+void MainWindow::initDeviceTable()
 {
-    totalDevices = 0;
-    numOfConnected = 0;
-
-    ui->deviceTable->clear();
+    ui->deviceTable->setModel(deviceModel);
     ui->deviceTable->setSelectionBehavior(QAbstractItemView::SelectRows);
     ui->deviceTable->setSelectionMode(QAbstractItemView::ExtendedSelection);
-
-    QStringList headers;
-    headers << tr("") << tr("ID") << tr("Имя") << tr("Статус соединения");
-    ui->deviceTable->setColumnCount(headers.size());
-    ui->deviceTable->setRowCount(devices.size());
-    ui->deviceTable->setHorizontalHeaderLabels(headers);
     ui->deviceTable->setAlternatingRowColors(true);
 
-    // Size Policy
-    ui->deviceTable->horizontalHeader()->setSectionResizeMode(0, QHeaderView::ResizeToContents);
-    ui->deviceTable->horizontalHeader()->setSectionResizeMode(1, QHeaderView::ResizeToContents);
-    ui->deviceTable->horizontalHeader()->setSectionResizeMode(2, QHeaderView::Stretch);
-    ui->deviceTable->horizontalHeader()->setSectionResizeMode(3, QHeaderView::ResizeToContents);
-
-    int row = 0;
-    for (const auto& device : devices)
-    {
-        QCheckBox* checkBox = new QCheckBox();
-        checkBox->setEnabled(false);
-        QTableWidgetItem* phoneItem = new QTableWidgetItem(device->getPhone());
-        QTableWidgetItem* nameItem = new QTableWidgetItem(device->getName());
-        QTableWidgetItem* statusItem = new QTableWidgetItem(device->isConnected() ? tr("Подключено") : tr("Нет соединения"));
-
-        connect(device, &Device::connectionChanged, this, [=](bool status) {
-            status ? (updateDeviceStatus(statusItem, tr("Подключено")), numOfConnected++, numOfConnectedValue->setText(QString::number(numOfConnected))) :
-                      (updateDeviceStatus(statusItem, tr("Нет соединения")), numOfConnected--, numOfConnectedValue->setText(QString::number(numOfConnected)));
-        });
-
-        ui->deviceTable->setCellWidget(row, 0, checkBox);
-        ui->deviceTable->setItem(row, 1, phoneItem);
-        ui->deviceTable->setItem(row, 2, nameItem);
-        ui->deviceTable->setItem(row, 3, statusItem);
-
-        row++;
-        totalDevices++;
-    }
+    // Sizes don't depend on the content, nothing is measured over all rows
+    QHeaderView *header = ui->deviceTable->horizontalHeader();
+    const QFontMetrics metrics = ui->deviceTable->fontMetrics();
+    header->setSectionResizeMode(DeviceTableModel::ToggleColumn, QHeaderView::Fixed);
+    header->resizeSection(DeviceTableModel::ToggleColumn, metrics.height() + 12);
+    header->setSectionResizeMode(DeviceTableModel::PhoneColumn, QHeaderView::Interactive);
+    header->resizeSection(DeviceTableModel::PhoneColumn, metrics.horizontalAdvance("000000000000000") + 12);
+    header->setSectionResizeMode(DeviceTableModel::NameColumn, QHeaderView::Stretch);
+    header->setSectionResizeMode(DeviceTableModel::StatusColumn, QHeaderView::Interactive);
+    header->resizeSection(DeviceTableModel::StatusColumn, metrics.horizontalAdvance(tr("Статус соединения")) + 24);
+    ui->deviceTable->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    ui->deviceTable->verticalHeader()->setDefaultSectionSize(metrics.height() + 8);
 
     // Header
-    headerCheckBox = new QCheckBox(ui->deviceTable->horizontalHeader());
-    int firstColumnWidth = ui->deviceTable->columnWidth(0);
-    int headerHeight = ui->deviceTable->horizontalHeader()->height();
+    headerCheckBox = new QCheckBox(header);
+    headerCheckBox->setGeometry(4, 0, header->sectionSize(DeviceTableModel::ToggleColumn) - 4, header->sizeHint().height());
     headerCheckBox->setVisible(true);
-    headerCheckBox->setGeometry(0, 0, firstColumnWidth, headerHeight);
     connect(headerCheckBox, &QCheckBox::clicked, this, &MainWindow::selectAllDevices);
+}
 
+void MainWindow::populateDeviceTable(const DeviceIndex &devices)
+{
+    deviceModel->setDevices(devices, devicePool->statusTable());
+    selectedDevices.resize(devices.size());
+    toggledDevices.resize(devices.size());
+    headerCheckBox->setChecked(false);
+
+    totalDevices = devices.size();
     totalDevicesValue->setText(QString::number(totalDevices));
 }
 
@@ -204,93 +216,82 @@ void MainWindow::enableSpinBoxes(const bool &arg)
     }
 }
 
+bool MainWindow::targetDevices(DeviceBitset &targets)
+{
+    const QString expression = ui->targetEdit->text().trimmed();
+    if (expression.isEmpty())
+    {
+        targets = toggledDevices;
+        return true;
+    }
+
+    // Only for this expression, the ini groups stay as loaded
+    QHash<QString, DeviceBitmap> tableGroups;
+    tableGroups.insert("selected", DeviceBitmap::fromBitset(selectedDevices));
+    tableGroups.insert("toggled", DeviceBitmap::fromBitset(toggledDevices));
+
+    DeviceBitmap devices;
+    QString error;
+    if (!iniParser->groups.evaluate(expression, tableGroups, &devices, &error))
+    {
+        logger->logWarning(tr("Ошибка в выражении группы: ") + error);
+        return false;
+    }
+    targets.resize(toggledDevices.size());
+    devices.toBitset(targets);
+    return true;
+}
+
 void MainWindow::editByteForSelected(const UCHAR &stateByte, const QByteArray &byte)
 {
-    if (toggledDevices.isEmpty())
+    DeviceBitset targets;
+    if (!targetDevices(targets))
+        return;
+    if (targets.isEmpty())
     {
         logger->logWarning(tr("Устройства не выбраны"));
         return;
     }
 
-    for (const QString& devicePhone : toggledDevices)
-    { 
-        Device* device = iniParser->devices.value(devicePhone);
-        if (!device)
-        {
-            logger->logError(tr("Устройство с ID ") + devicePhone + tr(" не существует или возникла иная ошибка"));
-            continue;
-        }
-        device->editState(stateByte, byte);
-    }
+    targets.forEach([&](quint32 index) {
+        iniParser->devices.at(index)->editState(stateByte, byte);
+    });
 }
 
 void MainWindow::selectAllDevices(bool state)
 {
-    if (ui->deviceTable->rowCount() == 0)
+    if (deviceModel->rowCount() == 0)
         return;
 
     if (state)
-    {
-        for (int row = 0; row < ui->deviceTable->rowCount(); ++row)
-        {
-            toggledDevices.insert(ui->deviceTable->item(row, 1)->text());
-        }
-    }
+        toggledDevices.setAll();
     else
-    {
         toggledDevices.clear();
-    }
 
     updateCheckBoxesFromToggledDevices();
 }
 
 void MainWindow::updateCheckBoxesFromToggledDevices()
 {
-    QString devicePhone{};
-    for (int row = 0; row < ui->deviceTable->rowCount(); ++row)
+    for (int row = 0; row < deviceModel->rowCount(); ++row)
     {
-        devicePhone = ui->deviceTable->item(row, 1)->text();
-        QCheckBox* checkBox = qobject_cast<QCheckBox*>(ui->deviceTable->cellWidget(row, 0));
-
-        if (toggledDevices.contains(devicePhone))
-        {
-            if (checkBox->isChecked())
-                continue;
-            checkBox->setChecked(true);
-
-            if (!isRunning)
-                continue;
-            Device* device = iniParser->devices.value(devicePhone);
-            if (!device)
-            {
-                logger->logError(tr("Устройство с ID ") + devicePhone + tr(" не существует или возникла иная ошибка"));
-                continue;
-            }
-            device->startWork();
-        }
+        const bool toggled = toggledDevices.test(row);
+        if (deviceModel->isToggled(row) == toggled)
+            continue;
+        deviceModel->setToggled(row, toggled);
 
+        if (!isRunning)
+            continue;
+        if (toggled)
+            deviceModel->device(row)->startWork();
         else
-        {
-            if (!checkBox->isChecked())
-                continue;
-            checkBox->setChecked(false);
-
-            if (!isRunning)
-                continue;
-            Device* device = iniParser->devices.value(devicePhone);
-            if (!device)
-            {
-                logger->logError(tr("Устройство с ID ") + devicePhone + tr(" не существует или возникла иная ошибка"));
-                continue;
-            }
-            device->stopWork();
-        }
+            deviceModel->device(row)->stopWork();
     }
 }
 \
 void MainWindow::onConnectButtonClicked()
 {
-    if (ui->deviceTable->rowCount() <= 0)
+    if (deviceModel->rowCount() <= 0)
     {
         logger->logWarning(tr("Устройства не найдены!"));
         return;
@@ -326,42 +327,36 @@ void MainWindow::onConnectButtonClicked()
 
 void MainWindow::onMultiConnectButtonClicked()
 {
-    if (toggledDevices.empty())
-    {
-        logger->logWarning(tr("Устройства не найдены!"));
-        return;
-    }
     if (!isRunning)
     {
+        DeviceBitset targets;
+        if (!targetDevices(targets))
+            return;
+        if (targets.isEmpty())
+        {
+            logger->logWarning(tr("Устройства не найдены!"));
+            return;
+        }
+        // The group becomes the checked rows, so СТОП and later toggles work on it
+        toggledDevices = targets;
+        headerCheckBox->setChecked(toggledDevices.count() == static_cast<quint32>(totalDevices));
+        updateCheckBoxesFromToggledDevices();
+
         updateDeviceDefaults();
         ui->saveValuesButton->setChecked(true);
         logger->logInfo(tr("Запускаю соединения..."));
-        for (const QString& devicePhone : toggledDevices)
-        {
-            Device* device = iniParser->devices.value(devicePhone);
-            if (!device)
-            {
-                logger->logError(tr("Устройство с ID ") + devicePhone + tr(" не существует или возникла иная ошибка"));
-                continue;
-            }
-            device->startWork();
-        }
+        toggledDevices.forEach([&](quint32 index) {
+            iniParser->devices.at(index)->startWork();
+        });
         ui->multiConnectButton->setText(tr("СТОП"));
         isRunning = true;
     }
     else
     {
         logger->logInfo(tr("Закрываю соединения..."));
-        for (const QString& devicePhone : toggledDevices)
-        {
-            Device* device = iniParser->devices.value(devicePhone);
-            if (!device)
-            {
-                logger->logError(tr("Устройство с ID ") + devicePhone + tr(" не существует или возникла иная ошибка"));
-                continue;
-            }
-            device->stopWork();
-        }
+        toggledDevices.forEach([&](quint32 index) {
+            iniParser->devices.at(index)->stopWork();
+        });
         ui->multiConnectButton->setText(tr("СТАРТ"));
         logger->logInfo(tr("Завершено!"));
         isRunning = false;
@@ -370,22 +365,18 @@ void MainWindow::onMultiConnectButtonClicked()
 
 void MainWindow::onSendStateButtonClicked()
 {
-    if (toggledDevices.isEmpty())
+    DeviceBitset targets;
+    if (!targetDevices(targets))
+        return;
+    if (targets.isEmpty())
     {
         logger->logWarning(tr("Устройства не выбраны"));
         return;
     }
 
-    for (const QString& devicePhone : toggledDevices)
-    {
-        Device* device = iniParser->devices.value(devicePhone);
-        if (!device)
-        {
-            logger->logError(tr("Устройство с ID ") + devicePhone + tr(" не существует или возникла иная ошибка"));
-            continue;
-        }
-        device->sendState();
-    }
+    targets.forEach([&](quint32 index) {
+        iniParser->devices.at(index)->sendState();
+    });
 }
 
 void MainWindow::onOpenIniFileActionTriggered()
@@ -404,11 +395,12 @@ void MainWindow::onOpenIniFileActionTriggered()
         return;
     }
 
+    deviceModel->clear();
     iniParser->clearData();
     iniParser->parseIniFile(filePath);
-    selectedDevices.clear();
-    toggledDevices.clear();
     populateDeviceTable(iniParser->devices);
+    if (!iniParser->groups.names().isEmpty())
+        logger->logInfo(tr("Группы устройств: ") + iniParser->groups.names().join(", "));
     ipValue->setText(iniParser->gprsSettings["ip"]);
     portValue->setText(iniParser->gprsSettings["port"]);
 }
@@ -421,11 +413,6 @@ void MainWindow::onSaveValuesButtonStateChanged(int state)
         enableSpinBoxes(true);
 }
 
-void MainWindow::updateDeviceStatus(QTableWidgetItem *item, const QString &status)
-{
-    item->setText(status);
-}
-
 void MainWindow::onRelayManualButtonToggled(bool checked)
 {
     QList<CalculateByteWidget*> widgetList = ui->relayStates->findChildren<CalculateByteWidget*>();
@@ -438,31 +425,25 @@ void MainWindow::onRelayManualButtonToggled(bool checked)
 
 void MainWindow::onSelectionChanged(const QItemSelection &selected, const QItemSelection &deselected)
 {
-    for (const auto &index : selected.indexes())
+    // Whole rows are selected, walk the ranges instead of every cell index
+    const bool logSelected = ui->enableLogForSelectedButton->isChecked();
+    for (const QItemSelectionRange &range : selected)
     {
-        if (index.column() == 1)
+        for (int row = range.top(); row <= range.bottom(); ++row)
         {
-            selectedDevices.insert(ui->deviceTable->item(index.row(), 1)->text());
-            if (ui->enableLogForSelectedButton->isChecked())
-            {
-                Device* device = iniParser->devices.value(ui->deviceTable->item(index.row(), 1)->text());
-                if (device)
-                    device->editLogStatus(true);
-            }
+            selectedDevices.set(row);
+            if (logSelected)
+                deviceModel->device(row)->editLogStatus(true);
         }
     }
 
-    for (const auto &index : deselected.indexes())
+    for (const QItemSelectionRange &range : deselected)
     {
-        if (index.column() == 1)
+        for (int row = range.top(); row <= range.bottom(); ++row)
         {
-            selectedDevices.remove(ui->deviceTable->item(index.row(), 1)->text());
-            if (ui->enableLogForSelectedButton->isChecked())
-            {
-                Device* device = iniParser->devices.value(ui->deviceTable->item(index.row(), 1)->text());
-                if (device)
-                    device->editLogStatus(false);
-            } 
+            selectedDevices.reset(row);
+            if (logSelected)
+                deviceModel->device(row)->editLogStatus(false);
         }
     }
 }
@@ -482,12 +463,12 @@ void MainWindow::onEnableLogForSelectedButtonToggled(bool checked)
     if (selectedDevices.isEmpty() || !checked)
         return;
 
-    for (Device* device : iniParser->devices)
+    for (int index = 0; index < iniParser->devices.size(); ++index)
     {
-        if (selectedDevices.contains(device->getPhone()))
-            device->editLogStatus(checked);
+        if (selectedDevices.test(index))
+            iniParser->devices.at(index)->editLogStatus(checked);
         else
-            device->editLogStatus(!checked);
+            iniParser->devices.at(index)->editLogStatus(!checked);
     }
 }
 
@@ -503,26 +484,43 @@ void MainWindow::onDisableLogButtonToggled(bool checked)
 
 void MainWindow::onClearLogButtonClicked()
 {
-    ui->logWindow->clear();
+    logger->model()->clear();
+}
+
+void MainWindow::onLogLevelBoxChanged(int index)
+{
+    // Items of logLevelBox follow LogLevel
+    logger->model()->setMinimumLevel(static_cast<LogLevel>(index));
+}
+
+void MainWindow::onLogFilterEditChanged(const QString &text)
+{
+    logger->model()->setDeviceFilter(text.trimmed());
+}
+
+void MainWindow::onLogRowsInserted()
+{
+    if (ui->autoScrollBox->isChecked())
+        ui->logWindow->scrollToBottom();
 }
 
 void MainWindow::onTurnOnDevicesButtonClicked()
 {
-    if (selectedDevices.empty())
+    if (selectedDevices.isEmpty())
     {
         logger->logWarning(tr("Ни одно устройство не выделено"));
         return;
     }
 
-    toggledDevices.unite(selectedDevices);
-    if (headerCheckBox->checkState() == Qt::Unchecked && toggledDevices.size() == totalDevices)
+    toggledDevices |= selectedDevices;
+    if (headerCheckBox->checkState() == Qt::Unchecked && toggledDevices.count() == static_cast<quint32>(totalDevices))
         headerCheckBox->setChecked(true);
     updateCheckBoxesFromToggledDevices();
 }
 
 void MainWindow::onTurnOffDevicesButtonClicked()
 {
-    if (selectedDevices.empty())
+    if (selectedDevices.isEmpty())
     {
         logger->logWarning(tr("Ни одно устройство не выделено"));
         return;
@@ -570,6 +568,44 @@ void MainWindow::onListOfLampsActionTriggered()
     }
 }
 
+void MainWindow::onStatsTimerTimeout()
+{
+    PoolSnapshot snapshot = devicePool->snapshot();
+    numOfConnectedValue->setText(QString::number(snapshot.connected));
+    threadsValue->setText(QString::number(snapshot.threads));
+
+    LatencyStats::Report latency = LatencyStats::collect();
+    const LatencyHistogram &sync = latency.connectToSync;
+    if (sync.count())
+    {
+        auto ms = [](quint64 micros) { return QString::number(micros / 1000.0, 'f', 1); };
+        latencyValue->setText(ms(sync.percentile(0.5)) + " / " + ms(sync.percentile(0.99)) + " / " + ms(sync.percentile(0.999)));
+        latencyValue->setToolTip(LatencyStats::format(latency));
+    }
+
+    // Memory saved by sharing identical virtual files
+    const FileStore::Usage files = FileStore::instance().usage();
+    filesValue->setText(QString::number(files.storedBytes / 1024.0, 'f', 1) + " (" +
+                        QString::number(files.referencedBytes / 1024.0, 'f', 1) + ")");
+    filesValue->setToolTip(tr("Разных файлов: ") + QString::number(files.files));
+}
+
+void MainWindow::onSaveLatencyActionTriggered()
+{
+    QString filePath = QFileDialog::getSaveFileName(this,
+                                                    tr("Сохранить задержки сервера"),
+                                                    QApplication::applicationDirPath() + "/latency.txt",
+                                                    tr("Text files (*.txt)"));
+    if (filePath.isEmpty())
+        return;
+
+    QString error;
+    if (LatencyStats::dump(filePath, &error))
+        logger->logInfo(tr("Задержки сохранены в ") + filePath);
+    else
+        logger->logError(tr("Не удалось сохранить задержки: ") + error);
+}
+
 void MainWindow::onAhpStateActionTriggered()
 {
     if (iniParser->devices.isEmpty())
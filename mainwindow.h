@@ -4,7 +4,8 @@
 #include <QMainWindow>
 #include <QFileDialog>
 #include <QInputDialog>
-#include <QTableWidget>
+#include <QTableView>
+#include <QCheckBox>
 #include <QSpinBox>
 #include <QLabel>
 #include <QButtonGroup>
@@ -13,6 +14,9 @@
 #include "calculatebytewidget.h"
 #include "lightdeviceswindow.h"
 #include "ahpstatewindow.h"
+#include "latencystats.h"
+#include "devicetablemodel.h"
+#include "devicebitset.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -33,9 +37,11 @@ protected:
 private:
     Ui::MainWindow* ui;
     Logger* logger;
+    DevicePool* devicePool;
     IniParser* iniParser;
     LightDevicesWindow* lightDevicesWindow;
     AhpStateWindow* ahpStateWindow;
+    DeviceTableModel* deviceModel;
 
     // Запущен ли сервер
     bool isRunning;
@@ -74,17 +80,24 @@ private:
     QLabel* totalDevicesLabel;
     QLabel* numOfConnectedValue;
     QLabel* totalDevicesValue;
+    QLabel* threadsLabel;
+    QLabel* threadsValue;
+    QLabel* latencyLabel;
+    QLabel* latencyValue;
+    QLabel* filesLabel;
+    QLabel* filesValue;
     int totalDevices;
-    int numOfConnected;
+    // Status bar is refreshed from DevicePool snapshots
+    QTimer* statsTimer;
 
     // Разные группы QRadioButton
     QButtonGroup relayRadioButtons;
     QButtonGroup logRadioButtons;
 
-    // Список выделенных устройств
-    QSet<QString> selectedDevices;
-    // Список активных устройств
-    QSet<QString> toggledDevices;
+    // Выделенные устройства, бит на строку таблицы (номер в DeviceIndex)
+    DeviceBitset selectedDevices;
+    // Активные устройства
+    DeviceBitset toggledDevices;
 
     QCheckBox *headerCheckBox;
 
@@ -97,14 +110,19 @@ private:
     void initButtonGroups();
     // Инициализация TabWidget
     void initTabWidget();
+    // Настройка таблицы устройств
+    void initDeviceTable();
     // Заполнение таблицы устройств
-    void populateDeviceTable(const QMap<QString, Device*> &devices);
+    void populateDeviceTable(const DeviceIndex &devices);
     // Обновление значений по умолчанию для устройств
     void updateDeviceDefaults();
     // Включение/отключение QSpinBox
     void enableSpinBoxes(const bool &arg);
     // Вычисление байта на основе QCheckBox
     QByteArray calculateByte();
+    // Устройства для СТАРТ, обновления состояний и реле: выражение групп из
+    // targetEdit или отмеченные строки, если поле пустое
+    bool targetDevices(DeviceBitset &targets);
     // Отредактировать байты для активных устройств
     void editByteForSelected(const UCHAR &stateByte, const QByteArray &byte);
     // Выделить все устройства
@@ -122,18 +140,22 @@ private slots:
     void onSendStateButtonClicked();
     void onOpenIniFileActionTriggered();
     void onSaveValuesButtonStateChanged(int state);
-    void updateDeviceStatus(QTableWidgetItem* item, const QString &status);
     void onRelayManualButtonToggled(bool checked);
     void onSelectionChanged(const QItemSelection &selected, const QItemSelection &deselected);
     void onEnableLogForAllButtonToggled(bool checked);
     void onEnableLogForSelectedButtonToggled(bool checked);
     void onDisableLogButtonToggled(bool checked);
     void onClearLogButtonClicked();
+    void onLogLevelBoxChanged(int index);
+    void onLogFilterEditChanged(const QString &text);
+    void onLogRowsInserted();
     void onTurnOnDevicesButtonClicked();
     void onTurnOffDevicesButtonClicked();
     void onByteCalculated(const QByteArray &byte);
     void onListOfLampsActionTriggered();
     void onAhpStateActionTriggered();
+    void onStatsTimerTimeout();
+    void onSaveLatencyActionTriggered();
 };
 
 #endif // MAINWINDOW_H
@@ -1,15 +1,74 @@
 #include "modbushandler.h"
+#include <QMutex>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Requests per command code seen by one thread. Only the owner writes
+struct CommandCounters
+{
+    std::array<std::atomic<quint64>, 256> hits{};
+};
+
+struct CounterRegistry
+{
+    QMutex mutex;
+    std::vector<CommandCounters*> shards;
+    // Finished threads
+    std::array<quint64, 256> retired{};
+};
+
+CounterRegistry &counterRegistry()
+{
+    static CounterRegistry instance;
+    return instance;
+}
+
+// Registers the counters of the thread and keeps them when the thread finishes
+struct CountersHolder
+{
+    CommandCounters *counters = new CommandCounters;
+
+    CountersHolder()
+    {
+        CounterRegistry &r = counterRegistry();
+        QMutexLocker locker(&r.mutex);
+        r.shards.push_back(counters);
+    }
+
+    ~CountersHolder()
+    {
+        CounterRegistry &r = counterRegistry();
+        QMutexLocker locker(&r.mutex);
+        for (int command = 0; command < 256; command++)
+            r.retired[command] += counters->hits[command].load(std::memory_order_relaxed);
+        r.shards.erase(std::find(r.shards.begin(), r.shards.end(), counters));
+        delete counters;
+    }
+};
+
+CommandCounters &localCounters()
+{
+    static thread_local CountersHolder holder;
+    return *holder.counters;
+}
+
+}
 
 ModbusHandler::ModbusHandler(QObject *parent)
     : QObject{parent},
-    currentFileIterator(filesMap.begin()),
-    currentFileInfo{},
-    endOfFile{false}
-{}
+    stateDirty{true},
+    currentFileInfo{}
+{
+    handlersInUse.store(true, std::memory_order_relaxed);
+}
 
 void ModbusHandler::initModbusHandler(const QString &phone)
 {
     devicePhone = phone;
+    // ID reply contains the phone
+    responseTemplates.clear();
 
     // Fill 0x2C block with default values
     editCounterArrayByte(counterArray, 9, voltage*100);
@@ -31,141 +90,211 @@ void ModbusHandler::initModbusHandler(const QString &phone)
 
 void ModbusHandler::parseMessage(const QByteArray &message)
 {
-    receivedMessage = message;
-    QList<QByteArray> messages = message.split(0xC0);
+    frameDecoder.feed(message.constData(), message.size(), [this](const char *frame, int size) {
+        handleFrame(QByteArray::fromRawData(frame, size));
+    });
+}
 
-    for (const QByteArray &message : messages)
-    {
-        QByteArray rawMessage = transformToRaw(message);
-        if (rawMessage.isEmpty())
-            continue;
+void ModbusHandler::resetConnection()
+{
+    frameDecoder.reset();
+    connectedAt = 0;
+    pushedAt = 0;
+    lastPollAt.clear();
+}
+
+void ModbusHandler::connectionEstablished()
+{
+    connectedAt = LatencyStats::now();
+    pushedAt = 0;
+    lastPollAt.clear();
+}
 
-        // Sync message case
-        if (rawMessage == SYNC_MESSAGE)
+void ModbusHandler::handleFrame(const QByteArray &rawMessage)
+{
+    // Sync message case
+    if (rawMessage == SYNC_MESSAGE)
+    {
+        if (connectedAt)
         {
-            formSyncMessage();
+            LatencyStats::record(LatencyMetric::ConnectToSync, LatencyStats::now() - connectedAt);
+            connectedAt = 0;
         }
+        formSyncMessage();
+    }
 
-        // FL_MODBUS_MESSAGE case
-        else if (static_cast<unsigned char>(rawMessage[3]) == 0x6E)
-        { 
-            // HEADER
-            FL_MODBUS_MESSAGE modbusMessage;
-            memcpy(&modbusMessage, rawMessage.constData(), sizeof(FL_MODBUS_MESSAGE));
-            // Основной Кулон
-            if (modbusMessage.dist_addressMB == 0x00 || modbusMessage.dist_addressMB == 0xD0)
-                deviceAddress = 0xD0;
-            // Для файлов
-            else if (modbusMessage.dist_addressMB == 0xDC)
-                deviceAddress = 0xDC;
-            // Возможно придется поменять
-            else
-                deviceAddress = modbusMessage.dist_addressMB;
-            serverAddress = modbusMessage.sour_address;
-
-            // DATA
-            int dataLength = modbusMessage.len;
-            QByteArray rawData = rawMessage.mid(sizeof(FL_MODBUS_MESSAGE), dataLength);
-
-            // CRC
-            UCHAR crc[2];
-            CalculateCRC(modbusMessage, rawData, crc);
-            if ((static_cast<UCHAR>(crc[1]) != static_cast<UCHAR>(rawMessage.at(rawMessage.size() - 1))) &&
-                (static_cast<UCHAR>(crc[0]) != static_cast<UCHAR>(rawMessage.at(rawMessage.size() - 2))))
-            {
-                emit wrongCRC(rawMessage.at(rawMessage.size() - 1), crc[1],
-                              rawMessage.at(rawMessage.size() - 2), crc[0]);
-                continue;
-            }
+    // FL_MODBUS_MESSAGE case
+    else if (rawMessage.size() >= static_cast<int>(sizeof(FL_MODBUS_MESSAGE)) + 2 &&
+             static_cast<unsigned char>(rawMessage[3]) == 0x6E)
+    {
+        // HEADER
+        FL_MODBUS_MESSAGE modbusMessage;
+        memcpy(&modbusMessage, rawMessage.constData(), sizeof(FL_MODBUS_MESSAGE));
+        // Основной Кулон
+        if (modbusMessage.dist_addressMB == 0x00 || modbusMessage.dist_addressMB == 0xD0)
+            deviceAddress = 0xD0;
+        // Для файлов
+        else if (modbusMessage.dist_addressMB == 0xDC)
+            deviceAddress = 0xDC;
+        // Возможно придется поменять
+        else
+            deviceAddress = modbusMessage.dist_addressMB;
+        serverAddress = modbusMessage.sour_address;
+
+        // DATA
+        int dataLength = qMin(static_cast<int>(modbusMessage.len),
+                              rawMessage.size() - static_cast<int>(sizeof(FL_MODBUS_MESSAGE)));
+
+        // CRC
+        UCHAR crc[2];
+        Crc16 crc16;
+        crc16.update(rawMessage.constData(), sizeof(FL_MODBUS_MESSAGE) + dataLength);
+        crc16.finish(crc);
+        if ((static_cast<UCHAR>(crc[1]) != static_cast<UCHAR>(rawMessage.at(rawMessage.size() - 1))) &&
+            (static_cast<UCHAR>(crc[0]) != static_cast<UCHAR>(rawMessage.at(rawMessage.size() - 2))))
+        {
+            emit wrongCRC(rawMessage.at(rawMessage.size() - 1), crc[1],
+                          rawMessage.at(rawMessage.size() - 2), crc[0]);
+            return;
+        }
 
-            // Check Tx
-            // Same message case
-            if (currentTx == modbusMessage.tx_id)
-            {
-                emit messageToSend(currentMessage);
-            }
-            // Next message case
-            else if (currentTx + 0x01 == modbusMessage.tx_id)
-            {
-                performCommand(rawMessage);
-            }
-            // Wrong message
-            else
-            {
-                emit wrongTx(currentTx, modbusMessage.tx_id);
-            }
+        // Check Tx
+        // Same message case
+        if (currentTx == modbusMessage.tx_id)
+        {
+            emit messageToSend(frameWriter.frame());
+        }
+        // Next message case
+        else if (currentTx + 0x01 == modbusMessage.tx_id)
+        {
+            performCommand(rawMessage);
+        }
+        // Wrong message
+        else
+        {
+            emit wrongTx(currentTx, modbusMessage.tx_id);
         }
-        // FL_MODBUS_MESSAGE_SHORT case
-        // Пока что таких сообщений не приходило и обрабатывать их не умеем
     }
+    // FL_MODBUS_MESSAGE_SHORT case
+    // Пока что таких сообщений не приходило и обрабатывать их не умеем
 }
 
-void ModbusHandler::performCommand(const QByteArray &message)
+constexpr std::array<ModbusHandler::CommandHandler, 256> ModbusHandler::buildCommandHandlers()
 {
-    switch (message[6])
+    std::array<CommandHandler, 256> handlers{};
+
+    // Codes outside of the protocol
+    for (CommandHandler &entry : handlers)
     {
-    case PROT_ID_CMD:
-        formIdentificationMessage();
-        break;
-
-    case PROT_STATE_REQ_CMD:
-        formStateMessage(false);
-        break;
-
-    case PROT_RELAY_SET_CMD:
-        setRelay(message);
-        break;
-
-    case PROT_FILE_SRCH_INIT_CMD:
-        initFileSearch(message);
-        break;
-
-    case PROT_FILE_SRCH_CMD:
-        searchFile(message);
-        break;
-
-    case PROT_FILE_RESULT_CMD:
-        fileResult(true);
-        break;
-
-    case PROT_FILE_OPEN_RD_CMD:
-        openReadFile(message);
-        break;
-
-    case PROT_FILE_RD_CMD:
-        readFile(message);
-        break;
-
-    case PROT_FILE_CLOSE_CMD:
-        closeFile(message);
-        break;
-
-    default:
-        emit unknownCommand(message[6]);
-        formDefaultAnswer(message);
-        break;
+        entry = [](ModbusHandler &handler, const QByteArray &message) {
+            emit handler.unknownCommand(message[6]);
+            handler.formDefaultAnswer(message);
+        };
     }
+
+    // Known commands without own emulation get plain OK answer
+    for (const ProtCommand &command : PROT_COMMANDS)
+    {
+        handlers[command.cmd] = [](ModbusHandler &handler, const QByteArray &message) {
+            handler.formDefaultAnswer(message);
+        };
+    }
+
+    handlers[PROT_ID_CMD] = [](ModbusHandler &handler, const QByteArray &) {
+        handler.formIdentificationMessage();
+    };
+    handlers[PROT_STATE_REQ_CMD] = [](ModbusHandler &handler, const QByteArray &) {
+        handler.formStateMessage(false);
+    };
+    handlers[PROT_RELAY_SET_CMD] = [](ModbusHandler &handler, const QByteArray &message) {
+        handler.setRelay(message);
+    };
+    handlers[PROT_FILE_SRCH_INIT_CMD] = [](ModbusHandler &handler, const QByteArray &message) {
+        handler.initFileSearch(message);
+    };
+    handlers[PROT_FILE_SRCH_CMD] = [](ModbusHandler &handler, const QByteArray &message) {
+        handler.searchFile(message);
+    };
+    handlers[PROT_FILE_RESULT_CMD] = [](ModbusHandler &handler, const QByteArray &) {
+        handler.fileResult(true);
+    };
+    handlers[PROT_FILE_OPEN_RD_CMD] = [](ModbusHandler &handler, const QByteArray &message) {
+        handler.openReadFile(message);
+    };
+    handlers[PROT_FILE_RD_CMD] = [](ModbusHandler &handler, const QByteArray &message) {
+        handler.readFile(message);
+    };
+    handlers[PROT_FILE_CLOSE_CMD] = [](ModbusHandler &handler, const QByteArray &message) {
+        handler.closeFile(message);
+    };
+
+    return handlers;
 }
 
-void ModbusHandler::formSyncMessage()
+std::array<ModbusHandler::CommandHandler, 256> ModbusHandler::commandHandlers = ModbusHandler::buildCommandHandlers();
+std::atomic<bool> ModbusHandler::handlersInUse{false};
+
+void ModbusHandler::registerCommandHandler(UCHAR command, CommandHandler handler)
 {
-    QByteArray syncData;
-    syncData.append(static_cast<char>(0x00));
-    syncData.append(static_cast<char>(0x80));
-    CalculateCRC(syncData);
+    // Devices are created in their own threads, which start after this call
+    Q_ASSERT_X(!handlersInUse.load(std::memory_order_relaxed), "registerCommandHandler",
+               "handlers must be registered before the first device is created");
+    if (handler && !handlersInUse.load(std::memory_order_relaxed))
+        commandHandlers[command] = handler;
+}
 
-    QByteArray byteArray;
-    byteArray.append(static_cast<char>(0xC0));
-    byteArray.append(syncData);
-    byteArray.append(static_cast<char>(0xC0));
+quint64 ModbusHandler::commandHits(UCHAR command)
+{
+    CounterRegistry &r = counterRegistry();
+    QMutexLocker locker(&r.mutex);
+    quint64 hits = r.retired[command];
+    for (const CommandCounters *counters : r.shards)
+        hits += counters->hits[command].load(std::memory_order_relaxed);
+    return hits;
+}
 
-    currentMessage = byteArray;
+void ModbusHandler::performCommand(const QByteArray &message)
+{
+    const UCHAR command = static_cast<UCHAR>(message[6]);
+    // Single writer, no locked add on a line shared with other threads
+    std::atomic<quint64> &hits = localCounters().hits[command];
+    hits.store(hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    const quint64 now = LatencyStats::now();
+    if (pushedAt)
+    {
+        LatencyStats::record(LatencyMetric::PushToPoll, now - pushedAt);
+        pushedAt = 0;
+    }
+    auto lastPoll = lastPollAt.find(command);
+    if (lastPoll != lastPollAt.end())
+    {
+        LatencyStats::record(LatencyMetric::PollInterval, now - lastPoll.value(), command);
+        lastPoll.value() = now;
+    }
+    else
+    {
+        lastPollAt.insert(command, now);
+    }
+    commandHandlers[command](*this, message);
+}
+
+void ModbusHandler::formSyncMessage()
+{
+    // The frame never changes, build it once for all devices
+    static const QByteArray syncFrame = [] {
+        FrameWriter writer;
+        writer.beginRaw();
+        writer.append(static_cast<UCHAR>(0x00));
+        writer.append(static_cast<UCHAR>(0x80));
+        return writer.finish();
+    }();
 
     // Reset Tx Rx
     currentTx = 0x80;
     currentRx = 0x00;
 
-    emit messageToSend(currentMessage);
+    emit messageToSend(frameWriter.assign(syncFrame));
 }
 
 void ModbusHandler::setRelay(const QByteArray &message)
@@ -185,36 +314,17 @@ void ModbusHandler::setRelay(const QByteArray &message)
 
 void ModbusHandler::formDefaultAnswer(const QByteArray &message)
 {
-    UCHAR crc[2];
-    QByteArray rawData{};
-    FL_MODBUS_MESSAGE modbusMessage;
-    modbusMessage.tx_id = currentTx + 0x01;
-    modbusMessage.rx_id = currentRx + 0x01;
-    modbusMessage.dist_addressMB = deviceAddress;
+    FL_MODBUS_MESSAGE modbusMessage = formHeader(message[6] + 0x80, 0x00);
     modbusMessage.FUNCT = message[3];
-    modbusMessage.sour_address = deviceAddress;
-    modbusMessage.dist_address = serverAddress;
-    modbusMessage.command = message[6] + 0x80;
-    modbusMessage.len = 0x00;
-    QByteArray header(reinterpret_cast<const char*>(&modbusMessage), sizeof(modbusMessage));
 
-    // CRC
-    CalculateCRC(modbusMessage, rawData, crc);
-
-    // Transform to modbus protocol
-    QByteArray messageArray;
-    messageArray.append(header);
-    messageArray.append(rawData);
-    messageArray.append(crc[0]);
-    messageArray.append(crc[1]);
-    messageArray = transformToData(messageArray);
-    QByteArray byteArray = addMarkerBytes(messageArray);
-
-    currentMessage = byteArray;
-    currentTx = modbusMessage.tx_id;
-    currentRx = modbusMessage.rx_id;
+    if (modbusMessage.FUNCT != PROT_FUNC_SYSTEM)
+    {
+        frameWriter.begin(modbusMessage);
+        sendFrame(modbusMessage);
+        return;
+    }
 
-    emit messageToSend(byteArray);
+    sendTemplate(responseTemplate(modbusMessage, nullptr, 0));
 }
 
 void ModbusHandler::formStateMessage(const bool &outsideCall)
@@ -223,57 +333,42 @@ void ModbusHandler::formStateMessage(const bool &outsideCall)
     {
         deviceAddress = 0xD0;
         formSyncMessage();
+        pushedAt = LatencyStats::now();
     }
 
-    UCHAR crc[2];
-
     // DATA
-    QByteArray data;
-    for (const auto& message : stateMessage)
+    // Encoded once per change, resend only writes new header and CRC
+    if (stateDirty)
     {
-        data.append(reinterpret_cast<const char*>(&message.len), sizeof(UCHAR));
-        data.append(reinterpret_cast<const char*>(&message.type), sizeof(UCHAR));
-        data.append(message.data);
+        QByteArray data;
+        for (const auto& message : stateMessage)
+        {
+            data.append(static_cast<char>(message.len));
+            data.append(static_cast<char>(message.type));
+            data.append(message.data);
+        }
+        statePayload.encode(data);
+        stateDirty = false;
     }
-    QByteArray rawData(transformToRaw(data));
 
     // HEADER
-    FL_MODBUS_MESSAGE modbusMessage;
+    FL_MODBUS_MESSAGE modbusMessage = formHeader(PROT_STATE_REQ_OK, static_cast<UCHAR>(statePayload.rawSize()));
     if (outsideCall)
         modbusMessage.tx_id = currentTx;
-    else
-        modbusMessage.tx_id = currentTx + 0x01;
-    modbusMessage.rx_id = currentRx + 0x01;
-    modbusMessage.dist_addressMB = deviceAddress;
-    modbusMessage.FUNCT = 0x6E;
-    modbusMessage.sour_address = deviceAddress;
-    modbusMessage.dist_address = serverAddress;
-    modbusMessage.command = PROT_STATE_REQ_OK;
-    modbusMessage.len = static_cast<unsigned char>(rawData.size());
-    QByteArray header(reinterpret_cast<const char*>(&modbusMessage), sizeof(modbusMessage));
-
-    // CRC
-    CalculateCRC(modbusMessage, rawData, crc);
-
-    // Transform to modbus protocol
-    QByteArray messageArray;
-    messageArray.append(header);
-    messageArray.append(rawData);
-    messageArray.append(crc[0]);
-    messageArray.append(crc[1]);
-    messageArray = transformToData(messageArray);
-    QByteArray byteArray = addMarkerBytes(messageArray);
-
-    currentMessage = byteArray;
-    currentTx = modbusMessage.tx_id;
-    currentRx = modbusMessage.rx_id;
 
-    emit messageToSend(byteArray);
+    frameWriter.begin(modbusMessage);
+    frameWriter.append(statePayload);
+    sendFrame(modbusMessage);
 }
 
 void ModbusHandler::formIdentificationMessage()
 {
-    UCHAR crc[2];
+    const auto cached = responseTemplates.constFind(templateKey(PROT_ID_OK));
+    if (cached != responseTemplates.constEnd())
+    {
+        sendTemplate(cached.value());
+        return;
+    }
 
     // DATA
     // For now it's hardcoded data.
@@ -287,79 +382,33 @@ void ModbusHandler::formIdentificationMessage()
     idMessage.firmware_version[0] = static_cast<UCHAR>(0x01);
     idMessage.firmware_version[1] = static_cast<UCHAR>(0x33);
     memset(idMessage.phone, 0, sizeof(idMessage.phone));
-    memcpy(idMessage.phone, devicePhone.toUtf8().constData(), devicePhone.toUtf8().size());
-    QByteArray rawData(reinterpret_cast<const char*>(&idMessage), sizeof(idMessage));
+    const QByteArray phone = devicePhone.toUtf8();
+    memcpy(idMessage.phone, phone.constData(), qMin(static_cast<size_t>(phone.size()), sizeof(idMessage.phone)));
 
     // HEADER
-    FL_MODBUS_MESSAGE modbusMessage;
-    modbusMessage.tx_id = currentTx + 0x01;
-    modbusMessage.rx_id = currentRx + 0x01;
-    modbusMessage.dist_addressMB = deviceAddress;
-    modbusMessage.FUNCT = 0x6E;
-    modbusMessage.sour_address = deviceAddress;
-    modbusMessage.dist_address = serverAddress;
-    modbusMessage.command = PROT_ID_OK;
-    modbusMessage.len = static_cast<unsigned char>(rawData.size());
-    QByteArray header(reinterpret_cast<const char*>(&modbusMessage), sizeof(modbusMessage));
-
-    // CRC
-    CalculateCRC(modbusMessage, rawData, crc);
+    FL_MODBUS_MESSAGE modbusMessage = formHeader(PROT_ID_OK, sizeof(idMessage));
 
-    // Transform to modbus protocol
-    QByteArray messageArray;
-    messageArray.append(header);
-    messageArray.append(rawData);
-    messageArray.append(crc[0]);
-    messageArray.append(crc[1]);
-    messageArray = transformToData(messageArray);
-    QByteArray byteArray = addMarkerBytes(messageArray);
-
-    currentMessage = byteArray;
-    currentTx = modbusMessage.tx_id;
-    currentRx = modbusMessage.rx_id;
-
-    emit messageToSend(byteArray);
+    sendTemplate(responseTemplate(modbusMessage, &idMessage, sizeof(idMessage)));
 }
 
 /* РАБОТА С ФАЙЛАМИ */
 
 void ModbusHandler::initFileSearch(const QByteArray &message)
 {
-    currentFileIterator = filesMap.begin();
+    files.startSearch();
     currentFileInfo.clear();
     formDefaultAnswer(message);
 }
 
 void ModbusHandler::searchFile(const QByteArray &message)
 {
-    QString fileNameTemplate = extractFileNameTemplate(message);
-    QRegularExpression regex(fileNameTemplate.replace("*", ".*"));
-
-    for (; currentFileIterator != filesMap.end(); ++currentFileIterator)
-    {
-        const QString &fileName = currentFileIterator.key();
-
-        if (regex.match(fileName).hasMatch())
-        {
-            currentFileInfo.clear();
-            currentFileInfo.append(static_cast<UCHAR>(PROT_FILE_NAME_EQ)); // имя совпадает с шаблоном
-            currentFileInfo.append(QByteArray(5, '\0')); // зарезервировано
-            int size = currentFileIterator.value().size();
-            size = qToBigEndian(size);
-            currentFileInfo.append(reinterpret_cast<const char*>(&size), sizeof(int));
-            QByteArray dateArray = extractDateTime();
-            currentFileInfo.append(dateArray); // дата и время
-            currentFileInfo.append(fileName.toUtf8()); // имя файла
-            currentFileInfo.append('\0');
-
-            ++currentFileIterator;
-            formDefaultAnswer(message);
-            return;
-        }
-    }
+    const VirtualFiles::File *file = files.nextMatch(extractSearchQuery(message));
+    if (file)
+        fillFileInfo(*file);
+    else
+        currentFileInfo.clear();
 
     formDefaultAnswer(message);
-    currentFileInfo.clear();
 }
 
 void ModbusHandler::fileResult(bool calledAsResult)
@@ -370,187 +419,169 @@ void ModbusHandler::fileResult(bool calledAsResult)
         return;
     }
 
-    UCHAR crc[2];
-
-    // DATA
-    QByteArray rawData(transformToRaw(currentFileInfo));
-
     // HEADER
-    FL_MODBUS_MESSAGE modbusMessage;
-    modbusMessage.tx_id = currentTx + 0x01;
-    modbusMessage.rx_id = currentRx + 0x01;
-    modbusMessage.dist_addressMB = deviceAddress;
-    modbusMessage.FUNCT = 0x6E;
-    modbusMessage.sour_address = deviceAddress;
-    modbusMessage.dist_address = serverAddress;
-    if (calledAsResult)
-        modbusMessage.command = PROT_FILE_RESULT_OK;
-    else
-        modbusMessage.command = PROT_FILE_OPEN_RD_OK;
-    modbusMessage.len = static_cast<unsigned char>(rawData.size());
-    QByteArray header(reinterpret_cast<const char*>(&modbusMessage), sizeof(modbusMessage));
-
-    // CRC
-    CalculateCRC(modbusMessage, rawData, crc);
-
-    // Transform to modbus protocol
-    QByteArray messageArray;
-    messageArray.append(header);
-    messageArray.append(rawData);
-    messageArray.append(crc[0]);
-    messageArray.append(crc[1]);
-    messageArray = transformToData(messageArray);
-    QByteArray byteArray = addMarkerBytes(messageArray);
+    FL_MODBUS_MESSAGE modbusMessage = formHeader(calledAsResult ? PROT_FILE_RESULT_OK : PROT_FILE_OPEN_RD_OK,
+                                                 static_cast<UCHAR>(currentFileInfo.size()));
 
-    currentMessage = byteArray;
-    currentTx = modbusMessage.tx_id;
-    currentRx = modbusMessage.rx_id;
+    // DATA
+    frameWriter.begin(modbusMessage);
+    frameWriter.append(currentFileInfo);
+    sendFrame(modbusMessage);
+}
 
-    emit messageToSend(byteArray);
+void ModbusHandler::fillFileInfo(const VirtualFiles::File &file)
+{
+    currentFileInfo.clear();
+    currentFileInfo.append(static_cast<UCHAR>(PROT_FILE_NAME_EQ)); // имя совпадает с шаблоном
+    currentFileInfo.append(QByteArray(5, '\0')); // зарезервировано
+    int size = file.data.size();
+    size = qToBigEndian(size);
+    currentFileInfo.append(reinterpret_cast<const char*>(&size), sizeof(int));
+    currentFileInfo.append(extractDateTime(file.modified)); // дата и время
+    currentFileInfo.append(file.name.toUtf8()); // имя файла
+    currentFileInfo.append('\0');
 }
 
 void ModbusHandler::openReadFile(const QByteArray &message)
 {
-    QString fileName = extractFileNameTemplate(message);
+    const VirtualFiles::File *file = files.find(extractFileNameTemplate(message));
 
-    for(auto it = filesMap.begin(); it != filesMap.end(); ++it)
+    // По идее если не нашли по каким то причинам файл надо кинуть ошибку
+    if (!file)
     {
-        if(it.key() == fileName)
-        {
-            currentFileInfo.clear();
-            currentFileInfo.append(static_cast<UCHAR>(PROT_FILE_NAME_EQ)); // имя совпадает с шаблоном
-            currentFileInfo.append(QByteArray(5, '\0')); // зарезервировано
-            int size = it.value().size();
-            size = qToBigEndian(size);
-            currentFileInfo.append(reinterpret_cast<const char*>(&size), sizeof(int));
-            QByteArray dateArray = extractDateTime();
-            currentFileInfo.append(dateArray); // дата и время
-            currentFileInfo.append(fileName.toUtf8()); // имя файла
-            currentFileInfo.append('\0');
-            currentFileData.append(it.value());
-            fileResult(false);
-            return;
-        }
+        replyError(PROT_ERR_NO_FILE);
+        return;
     }
 
-    // По идее если не нашли по каким то причинам файл надо кинуть ошибку
-    replyError(PROT_ERR_NO_FILE);
+    fillFileInfo(*file);
+    readSession.open(file->data);
+    fileResult(false);
 }
 
 void ModbusHandler::readFile(const QByteArray &message)
 {
-    if (endOfFile)
+    if (readSession.atEnd())
     {
         replyError(PROT_ERR_END_OF_FILE);
         return;
     }
-    UCHAR crc[2];
-
-    QByteArray messageData = message.mid(8, 5);
-
-
-    quint32 offset = static_cast<quint32>((unsigned char)(messageData[0]) << 24 |
-                                          (unsigned char)(messageData[1]) << 16 |
-                                          (unsigned char)(messageData[2]) << 8  |
-                                          (unsigned char)(messageData[3]));
-    quint8 blockLength = static_cast<quint8>(messageData[4]);
 
-    if (offset + blockLength >= currentFileData.size())
-        endOfFile = true;
+    // Offset (big endian) and block length
+    if (message.size() < 13)
+    {
+        replyError(PROT_ERR_INVALID_DATA);
+        return;
+    }
+    const UCHAR *request = reinterpret_cast<const UCHAR*>(message.constData());
+    quint32 offset = static_cast<quint32>(request[8]) << 24 |
+                     static_cast<quint32>(request[9]) << 16 |
+                     static_cast<quint32>(request[10]) << 8 |
+                     static_cast<quint32>(request[11]);
+    quint8 blockLength = request[12];
 
-    // DATA
-    QByteArray data;
-    data.append(static_cast<char>((offset >> 24) & 0xFF));
-    data.append(static_cast<char>((offset >> 16) & 0xFF));
-    data.append(static_cast<char>((offset >> 8) & 0xFF));
-    data.append(static_cast<char>(offset & 0xFF));
-    data.append(currentFileData.mid(offset, blockLength));
-    QByteArray rawData(transformToRaw(data));
+    // Block is sent straight from the file data, clipped to its end
+    const char *chunk;
+    int chunkLength = readSession.read(offset, blockLength, &chunk);
 
     // HEADER
-    FL_MODBUS_MESSAGE modbusMessage;
-    modbusMessage.tx_id = currentTx + 0x01;
-    modbusMessage.rx_id = currentRx + 0x01;
-    modbusMessage.dist_addressMB = deviceAddress;
-    modbusMessage.FUNCT = 0x6E;
-    modbusMessage.sour_address = deviceAddress;
-    modbusMessage.dist_address = serverAddress;
-    modbusMessage.command = PROT_FILE_RD_OK;
-    modbusMessage.len = static_cast<unsigned char>(rawData.size());
-    QByteArray header(reinterpret_cast<const char*>(&modbusMessage), sizeof(modbusMessage));
-
-    // CRC
-    CalculateCRC(modbusMessage, rawData, crc);
-
-    // Transform to modbus protocol
-    QByteArray messageArray;
-    messageArray.append(header);
-    messageArray.append(rawData);
-    messageArray.append(crc[0]);
-    messageArray.append(crc[1]);
-    messageArray = transformToData(messageArray);
-    QByteArray byteArray = addMarkerBytes(messageArray);
-
-    currentMessage = byteArray;
-    currentTx = modbusMessage.tx_id;
-    currentRx = modbusMessage.rx_id;
+    FL_MODBUS_MESSAGE modbusMessage = formHeader(PROT_FILE_RD_OK, static_cast<UCHAR>(4 + chunkLength));
 
-    emit messageToSend(byteArray);
+    // DATA
+    frameWriter.begin(modbusMessage);
+    frameWriter.append(static_cast<UCHAR>((offset >> 24) & 0xFF));
+    frameWriter.append(static_cast<UCHAR>((offset >> 16) & 0xFF));
+    frameWriter.append(static_cast<UCHAR>((offset >> 8) & 0xFF));
+    frameWriter.append(static_cast<UCHAR>(offset & 0xFF));
+    frameWriter.append(chunk, chunkLength);
+    sendFrame(modbusMessage);
 }
 
 void ModbusHandler::closeFile(const QByteArray &message)
 {
-    endOfFile = false;
-    currentFileData.clear();
+    readSession.close();
     currentFileInfo.clear();
     formDefaultAnswer(message);
 }
 
 void ModbusHandler::addFileToMap(const QString &fileName, const QByteArray &fileData)
 {
-    filesMap.insert(fileName, fileData);
-    endOfFile = false;
-    currentFileData.clear();
+    // Open read session keeps reading the old data until the file is reopened
+    files.insert(fileName, fileData, QDateTime::currentSecsSinceEpoch());
     currentFileInfo.clear();
     editState(0x08, QByteArray::fromHex("6400"));
 }
 
 void ModbusHandler::replyError(UCHAR errorCode)
 {
-    UCHAR crc[2];
+    // HEADER
+    FL_MODBUS_MESSAGE modbusMessage = formHeader(PROT_REPLY_ERROR, 1);
 
-    QByteArray rawData;
-    rawData.append(errorCode);
+    // DATA
+    frameWriter.begin(modbusMessage);
+    frameWriter.append(errorCode);
+    sendFrame(modbusMessage);
+}
 
-    // HEADER
+FL_MODBUS_MESSAGE ModbusHandler::formHeader(UCHAR command, UCHAR length)
+{
     FL_MODBUS_MESSAGE modbusMessage;
     modbusMessage.tx_id = currentTx + 0x01;
     modbusMessage.rx_id = currentRx + 0x01;
     modbusMessage.dist_addressMB = deviceAddress;
-    modbusMessage.FUNCT = 0x6E;
+    modbusMessage.FUNCT = PROT_FUNC_SYSTEM;
     modbusMessage.sour_address = deviceAddress;
     modbusMessage.dist_address = serverAddress;
-    modbusMessage.command = PROT_REPLY_ERROR;
-    modbusMessage.len = static_cast<unsigned char>(rawData.size());
-    QByteArray header(reinterpret_cast<const char*>(&modbusMessage), sizeof(modbusMessage));
+    modbusMessage.command = command;
+    modbusMessage.len = length;
+    return modbusMessage;
+}
 
-    // CRC
-    CalculateCRC(modbusMessage, rawData, crc);
+void ModbusHandler::sendFrame(const FL_MODBUS_MESSAGE &header)
+{
+    const QByteArray &frame = frameWriter.finish();
+    currentTx = header.tx_id;
+    currentRx = header.rx_id;
 
-    // Transform to modbus protocol
-    QByteArray messageArray;
-    messageArray.append(header);
-    messageArray.append(rawData);
-    messageArray.append(crc[0]);
-    messageArray.append(crc[1]);
-    messageArray = transformToData(messageArray);
-    QByteArray byteArray = addMarkerBytes(messageArray);
+    emit messageToSend(frame);
+}
 
-    currentMessage = byteArray;
-    currentTx = modbusMessage.tx_id;
-    currentRx = modbusMessage.rx_id;
+quint32 ModbusHandler::templateKey(UCHAR command) const
+{
+    return static_cast<quint32>(command) | static_cast<quint32>(deviceAddress) << 8 |
+           static_cast<quint32>(serverAddress) << 16;
+}
 
-    emit messageToSend(byteArray);
+// Everything after tx and rx is constant for given command and addresses
+const EncodedPayload &ModbusHandler::responseTemplate(const FL_MODBUS_MESSAGE &header, const void *data, int len)
+{
+    const quint32 key = templateKey(header.command);
+    auto it = responseTemplates.find(key);
+    if (it != responseTemplates.end())
+        return it.value();
+
+    const int headerTail = sizeof(FL_MODBUS_MESSAGE) - sizeof(header.tx_id) - sizeof(header.rx_id);
+    QByteArray constant(reinterpret_cast<const char*>(&header) + sizeof(header.tx_id) + sizeof(header.rx_id), headerTail);
+    constant.append(static_cast<const char*>(data), len);
+
+    it = responseTemplates.insert(key, EncodedPayload());
+    it.value().encode(constant);
+    return it.value();
+}
+
+void ModbusHandler::sendTemplate(const EncodedPayload &tail)
+{
+    const UCHAR tx = currentTx + 0x01;
+    const UCHAR rx = currentRx + 0x01;
+
+    frameWriter.beginRaw();
+    frameWriter.append(tx);
+    frameWriter.append(rx);
+    frameWriter.append(tail);
+    const QByteArray &frame = frameWriter.finish();
+    currentTx = tx;
+    currentRx = rx;
+
+    emit messageToSend(frame);
 }
 
 /* БЛОКИ СОСТОЯНИЙ */
@@ -562,6 +593,7 @@ void ModbusHandler::addNewState(const UCHAR &type, const QByteArray &data)
     newState.type = type;
     newState.data = data;
     stateMessage.push_back(newState);
+    stateDirty = true;
     if (type == 0x08)
         editCounterArray();
 }
@@ -582,6 +614,7 @@ void ModbusHandler::editRelayByte(UCHAR relayByte)
         else
             it->data[0] &= ~(1 << relayIndex);
     }
+    stateDirty = true;
     editCounterArray();
 }
 
@@ -607,6 +640,7 @@ void ModbusHandler::editRelayByte(const QByteArray &relayMask)
             }
         }
     }
+    stateDirty = true;
     editCounterArray();
 }
 
@@ -693,11 +727,13 @@ void ModbusHandler::randomiseRelayStates()
             state.data[1] = randomByte23_2;
         }
     }
+    stateDirty = true;
     editCounterArray();
 }
 
 void ModbusHandler::editState(const UCHAR &stateByte, const QByteArray &data)
 {
+    stateDirty = true;
     for (auto& state : stateMessage)
     {
         // Костыль чтобы не возникло рекурсии при обновлении реле из ГУИ и обновлением блока 0x2C
@@ -718,84 +754,6 @@ void ModbusHandler::editState(const UCHAR &stateByte, const QByteArray &data)
     addNewState(stateByte, data);
 }
 
-QByteArray ModbusHandler::addMarkerBytes(const QByteArray &input)
-{
-    QByteArray output;
-    output.append(static_cast<char>(0xC0));
-    output.append(input);
-    output.append(static_cast<char>(0xC0));
-    return output;
-}
-
-QByteArray ModbusHandler::transformToData(const QByteArray& message)
-{
-    QByteArray output;
-    output.reserve(message.size() * 2);
-
-    for (unsigned char byte : message)
-    {
-        if (byte == 0xC0)
-        {
-            output.append(static_cast<char>(0xDB));
-            output.append(static_cast<char>(0xDC));
-        }
-        else if (byte == 0xDB)
-        {
-            output.append(static_cast<char>(0xDB));
-            output.append(static_cast<char>(0xDD));
-        }
-        else
-        {
-            output.append(byte);
-        }
-    }
-
-    return output;
-}
-
-QByteArray ModbusHandler::transformToRaw(const QByteArray& message)
-{
-    QByteArray output;
-    output.reserve(message.size());
-
-    for (int i = 0; i < message.size(); ++i)
-    {
-        char currentByte = message.at(i);
-
-        if (currentByte == char(0xDB))
-        {
-            if (i + 1 < message.size())
-            {
-                char nextByte = message.at(i + 1);
-                if (nextByte == char(0xDC))
-                {
-                    output.append(char(0xC0));
-                    i++;
-                }
-                else if (nextByte == char(0xDD))
-                {
-                    output.append(char(0xDB));
-                    i++;
-                }
-                else
-                {
-                    output.append(currentByte);
-                }
-            }
-            else
-            {
-                output.append(currentByte);
-            }
-        }
-        else
-        {
-            output.append(currentByte);
-        }
-    }
-
-    return output;
-}
-
 QString ModbusHandler::extractFileNameTemplate(const QByteArray &message)
 {
     int nullIndex = message.indexOf('\0', 24);
@@ -808,9 +766,28 @@ QString ModbusHandler::extractFileNameTemplate(const QByteArray &message)
     return QString();
 }
 
-QByteArray ModbusHandler::extractDateTime()
+// Search request data has the same layout as file info in the reply:
+// flags, 5 reserved bytes, size (big endian), date and time, name template
+FileSearchQuery ModbusHandler::extractSearchQuery(const QByteArray &message)
+{
+    FileSearchQuery query;
+    query.nameTemplate = extractFileNameTemplate(message);
+    if (message.size() < 24)
+        return query;
+
+    const UCHAR *data = reinterpret_cast<const UCHAR*>(message.constData());
+    query.flags = data[8];
+    query.size = static_cast<quint32>(data[14] << 24 | data[15] << 16 | data[16] << 8 | data[17]);
+
+    const QDateTime dateTime(QDate(2000 + data[18], data[19], data[20]),
+                             QTime(data[21], data[22], data[23]));
+    query.modified = dateTime.isValid() ? dateTime.toSecsSinceEpoch() : -1;
+    return query;
+}
+
+QByteArray ModbusHandler::extractDateTime(qint64 secsSinceEpoch)
 {
-    QDateTime dateTime = QDateTime::currentDateTime();
+    QDateTime dateTime = QDateTime::fromSecsSinceEpoch(secsSinceEpoch);
     int year = dateTime.date().year();
     int month = dateTime.date().month();
     int day = dateTime.date().day();
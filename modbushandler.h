@@ -2,10 +2,16 @@
 #define MODBUSHANDLER_H
 
 #include <QObject>
-#include <QRegularExpression>
 #include <QMap>
+#include <QHash>
 #include <QDateTime>
+#include <array>
+#include <atomic>
 #include "Prot.h"
+#include "framewriter.h"
+#include "framedecoder.h"
+#include "virtualfiles.h"
+#include "latencystats.h"
 
 class ModbusHandler : public QObject
 {
@@ -17,8 +23,25 @@ public:
     void randomiseRelayStates();
     void addFileToMap(const QString &fileName, const QByteArray &fileData);
     void editState(const UCHAR &stateByte, const QByteArray &data);
+    void resetConnection();
+    // Starts latency measurement of a new connection
+    void connectionEstablished();
+
+    // Command handler gets the whole unescaped frame
+    using CommandHandler = void (*)(ModbusHandler &handler, const QByteArray &message);
+    // Replaces handler of one command code for all devices. Device threads read
+    // the table without locks, so it is ignored once any handler was created
+    static void registerCommandHandler(UCHAR command, CommandHandler handler);
+    // Number of requests with this command code received by all devices
+    static quint64 commandHits(UCHAR command);
 
 private:
+    // Handlers for all 256 command codes, built at compile time from PROT_COMMANDS
+    static std::array<CommandHandler, 256> commandHandlers;
+    // Set by the first constructor, commandHandlers is read-only from then on
+    static std::atomic<bool> handlersInUse;
+    static constexpr std::array<CommandHandler, 256> buildCommandHandlers();
+
     const QByteArray SYNC_MESSAGE = QByteArray::fromHex("00800010");
 
     QString devicePhone;
@@ -27,20 +50,31 @@ private:
     UCHAR deviceAddress;
     UCHAR serverAddress;
 
-    QByteArray currentMessage;
-    QByteArray receivedMessage;
+    // Keeps partial frames between socket reads
+    FrameDecoder frameDecoder;
+    // Per-connection buffer for outgoing frames, also keeps the last one for retransmission
+    FrameWriter frameWriter;
+    // Encoded constant replies (ID, default answer), key is command and both addresses
+    QHash<quint32, EncodedPayload> responseTemplates;
 
     // Stores relay state. Has default states, new can be added
     std::vector<FL_MODBUS_STATE_CMD_MESSAGE> stateMessage;
-    // Map for storing all virtual files.
-    QMap<QString, QByteArray> filesMap;
-    // Map's iterator to store current file.
-    QMap<QString, QByteArray>::iterator currentFileIterator;
+    // Encoded stateMessage, rebuilt only after it changes
+    EncodedPayload statePayload;
+    bool stateDirty;
+    // All virtual files with search indexes
+    VirtualFiles files;
     // Stores current file
     QByteArray currentFileInfo;
-    QByteArray currentFileData;
-    bool endOfFile;
+    // File opened by PROT_FILE_OPEN_RD_CMD
+    FileReadSession readSession;
+
+    // Server latency (LatencyStats), microseconds of LatencyStats::now(), 0 if not waiting
+    quint64 connectedAt = 0;
+    quint64 pushedAt = 0;
+    QHash<UCHAR, quint64> lastPollAt;
 
+    void handleFrame(const QByteArray &rawMessage);
     void performCommand(const QByteArray &message);
     void formSyncMessage();
     void setRelay(const QByteArray &message);
@@ -50,10 +84,16 @@ private:
     void initFileSearch(const QByteArray &message);
     void searchFile(const QByteArray &message);
     void fileResult(bool calledAsResult);
+    void fillFileInfo(const VirtualFiles::File &file);
     void openReadFile(const QByteArray &message);
     void readFile(const QByteArray &message);
     void closeFile(const QByteArray &message);
     void replyError(UCHAR errorCode);
+    FL_MODBUS_MESSAGE formHeader(UCHAR command, UCHAR length);
+    void sendFrame(const FL_MODBUS_MESSAGE &header);
+    quint32 templateKey(UCHAR command) const;
+    const EncodedPayload &responseTemplate(const FL_MODBUS_MESSAGE &header, const void *data, int len);
+    void sendTemplate(const EncodedPayload &tail);
 
     void editRelayByte(UCHAR relayByte);
     void editRelayByte(const QByteArray &relayMask);
@@ -71,11 +111,9 @@ private:
     void calcFrequency();
     void editCounterArray();
 
-    QByteArray addMarkerBytes(const QByteArray& input);
-    QByteArray transformToData(const QByteArray& input);
-    QByteArray transformToRaw(const QByteArray& message);
     QString extractFileNameTemplate(const QByteArray &message);
-    QByteArray extractDateTime();
+    FileSearchQuery extractSearchQuery(const QByteArray &message);
+    QByteArray extractDateTime(qint64 secsSinceEpoch);
 
 signals:
     QByteArray messageToSend(const QByteArray& message);
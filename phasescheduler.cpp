@@ -0,0 +1,57 @@
+#include "phasescheduler.h"
+#include <QRandomGenerator>
+#include <chrono>
+
+PhaseScheduler &PhaseScheduler::instance()
+{
+    static PhaseScheduler scheduler;
+    return scheduler;
+}
+
+void PhaseScheduler::configure(Mode newMode, int newJitter)
+{
+    mode = newMode;
+    jitter = qMax(newJitter, 0);
+    counter = 0;
+}
+
+double PhaseScheduler::nextPhase()
+{
+    if (mode == Mode::Herd)
+        return 0;
+
+    // Bit reversed counter: 0, 1/2, 1/4, 3/4, 1/8...
+    quint32 bits = counter.fetch_add(1, std::memory_order_relaxed);
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x00ff00ff) << 8) | ((bits & 0xff00ff00) >> 8);
+    bits = ((bits & 0x0f0f0f0f) << 4) | ((bits & 0xf0f0f0f0) >> 4);
+    bits = ((bits & 0x33333333) << 2) | ((bits & 0xcccccccc) >> 2);
+    bits = ((bits & 0x55555555) << 1) | ((bits & 0xaaaaaaaa) >> 1);
+    return bits / 4294967296.0;
+}
+
+qint64 PhaseScheduler::firstPoint(double phase, int interval) const
+{
+    interval = qMax(interval, 1);
+    const qint64 current = now();
+    const qint64 offset = static_cast<qint64>(phase * interval);
+    qint64 point = current - current % interval + offset;
+    if (point <= current)
+        point += interval;
+    return point;
+}
+
+int PhaseScheduler::delayTo(qint64 point) const
+{
+    qint64 delay = point - now();
+    const int spread = jitter.load(std::memory_order_relaxed);
+    if (spread > 0)
+        delay += QRandomGenerator::global()->bounded(-spread, spread + 1);
+    return static_cast<int>(qMax<qint64>(delay, 0));
+}
+
+qint64 PhaseScheduler::now()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
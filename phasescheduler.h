@@ -0,0 +1,40 @@
+#ifndef PHASESCHEDULER_H
+#define PHASESCHEDULER_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// Фазы периодической отправки состояния. Каждое устройство получает свою
+// фазу внутри sendStatusInterval один раз и держит ее между переподключениями,
+// моменты отправки считаются от общих для процесса часов. Фазы идут по
+// последовательности ван дер Корпута, так что любое число устройств делит
+// интервал почти поровну и поток сообщений ровный. Режим Herd ставит всех в
+// одну фазу для проверки сервера пачками, jitter размывает моменты в обоих режимах.
+class PhaseScheduler
+{
+public:
+    enum class Mode { Spread, Herd };
+
+    static PhaseScheduler &instance();
+
+    void configure(Mode mode, int jitter);
+
+    // Phase in [0, 1) for a device that has none yet
+    double nextPhase();
+    // First send point of the phase after now, ms of the shared clock
+    qint64 firstPoint(double phase, int interval) const;
+    // Delay until the point with jitter applied
+    int delayTo(qint64 point) const;
+
+    static qint64 now();
+
+private:
+    PhaseScheduler() = default;
+    Q_DISABLE_COPY(PhaseScheduler)
+
+    std::atomic<Mode> mode{Mode::Spread};
+    std::atomic<int> jitter{0};
+    std::atomic<quint32> counter{0};
+};
+
+#endif // PHASESCHEDULER_H
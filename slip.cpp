@@ -0,0 +1,280 @@
+#include "slip.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+    #define SLIP_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define SLIP_TARGET_AVX2
+    #else
+        #define SLIP_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+namespace {
+
+typedef int (*EscapeFn)(const UCHAR *src, int len, char *dst);
+typedef int (*UnescapeFn)(const char *src, int len, char *dst);
+
+inline int escapeByte(UCHAR byte, char *out)
+{
+    if (byte == 0xC0)
+    {
+        out[0] = static_cast<char>(0xDB);
+        out[1] = static_cast<char>(0xDC);
+        return 2;
+    }
+    if (byte == 0xDB)
+    {
+        out[0] = static_cast<char>(0xDB);
+        out[1] = static_cast<char>(0xDD);
+        return 2;
+    }
+    out[0] = static_cast<char>(byte);
+    return 1;
+}
+
+// src[i] is 0xDB. Writes one byte to out and returns number of consumed bytes.
+// Unknown sequences and trailing 0xDB are kept as is
+inline int unescapeAt(const char *src, int i, int len, char *out)
+{
+    if (i + 1 < len)
+    {
+        if (src[i + 1] == static_cast<char>(0xDC))
+        {
+            *out = static_cast<char>(0xC0);
+            return 2;
+        }
+        if (src[i + 1] == static_cast<char>(0xDD))
+        {
+            *out = static_cast<char>(0xDB);
+            return 2;
+        }
+    }
+    *out = static_cast<char>(0xDB);
+    return 1;
+}
+
+int escapeScalar(const UCHAR *src, int len, char *dst)
+{
+    char *out = dst;
+    for (int i = 0; i < len; ++i)
+        out += escapeByte(src[i], out);
+    return static_cast<int>(out - dst);
+}
+
+int unescapeScalar(const char *src, int len, char *dst)
+{
+    char *out = dst;
+    int i = 0;
+    while (i < len)
+    {
+        if (src[i] == static_cast<char>(0xDB))
+            i += unescapeAt(src, i, len, out++);
+        else
+            *out++ = src[i++];
+    }
+    return static_cast<int>(out - dst);
+}
+
+#ifdef SLIP_X86
+
+inline int lowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Escaping writes whole blocks even if they contain a special byte: dst has
+// room for 2 * len bytes, so the store never leaves the output buffer
+int escapeSse2(const UCHAR *src, int len, char *dst)
+{
+    const __m128i c0 = _mm_set1_epi8(static_cast<char>(0xC0));
+    const __m128i db = _mm_set1_epi8(static_cast<char>(0xDB));
+    char *out = dst;
+    int i = 0;
+
+    while (i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, c0), _mm_cmpeq_epi8(v, db)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+        if (mask == 0)
+        {
+            i += 16;
+            out += 16;
+            continue;
+        }
+        int clean = lowestBit(mask);
+        i += clean;
+        out += clean;
+        out += escapeByte(src[i++], out);
+    }
+
+    out += escapeScalar(src + i, len - i, out);
+    return static_cast<int>(out - dst);
+}
+
+SLIP_TARGET_AVX2 int escapeAvx2(const UCHAR *src, int len, char *dst)
+{
+    const __m256i c0 = _mm256_set1_epi8(static_cast<char>(0xC0));
+    const __m256i db = _mm256_set1_epi8(static_cast<char>(0xDB));
+    char *out = dst;
+    int i = 0;
+
+    while (i + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        unsigned int mask = static_cast<unsigned int>(
+            _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, c0), _mm256_cmpeq_epi8(v, db))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+        if (mask == 0)
+        {
+            i += 32;
+            out += 32;
+            continue;
+        }
+        int clean = lowestBit(mask);
+        i += clean;
+        out += clean;
+        out += escapeByte(src[i++], out);
+    }
+
+    out += escapeScalar(src + i, len - i, out);
+    return static_cast<int>(out - dst);
+}
+
+// Unescaping may run in place, so only fully clean blocks are stored as a whole
+int unescapeSse2(const char *src, int len, char *dst)
+{
+    const __m128i db = _mm_set1_epi8(static_cast<char>(0xDB));
+    char *out = dst;
+    int i = 0;
+
+    while (i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, db));
+        if (mask == 0)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+            i += 16;
+            out += 16;
+            continue;
+        }
+        int clean = lowestBit(mask);
+        memmove(out, src + i, clean);
+        i += clean;
+        out += clean;
+        i += unescapeAt(src, i, len, out++);
+    }
+
+    out += unescapeScalar(src + i, len - i, out);
+    return static_cast<int>(out - dst);
+}
+
+SLIP_TARGET_AVX2 int unescapeAvx2(const char *src, int len, char *dst)
+{
+    const __m256i db = _mm256_set1_epi8(static_cast<char>(0xDB));
+    char *out = dst;
+    int i = 0;
+
+    while (i + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, db)));
+        if (mask == 0)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+            i += 32;
+            out += 32;
+            continue;
+        }
+        int clean = lowestBit(mask);
+        memmove(out, src + i, clean);
+        i += clean;
+        out += clean;
+        i += unescapeAt(src, i, len, out++);
+    }
+
+    out += unescapeScalar(src + i, len - i, out);
+    return static_cast<int>(out - dst);
+}
+
+bool cpuHasAvx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+EscapeFn selectEscape()
+{
+    return cpuHasAvx2() ? escapeAvx2 : escapeSse2;
+}
+
+UnescapeFn selectUnescape()
+{
+    return cpuHasAvx2() ? unescapeAvx2 : unescapeSse2;
+}
+
+#else
+
+EscapeFn selectEscape()
+{
+    return escapeScalar;
+}
+
+UnescapeFn selectUnescape()
+{
+    return unescapeScalar;
+}
+
+#endif
+
+}
+
+int SlipEscape(const UCHAR *src, int len, char *dst)
+{
+    static const EscapeFn escape = selectEscape();
+    return escape(src, len, dst);
+}
+
+int SlipUnescape(const char *src, int len, char *dst)
+{
+    static const UnescapeFn unescape = selectUnescape();
+    return unescape(src, len, dst);
+}
+
+QByteArray SlipEscape(const QByteArray &data)
+{
+    QByteArray output(data.size() * 2, Qt::Uninitialized);
+    output.resize(SlipEscape(reinterpret_cast<const UCHAR*>(data.constData()), data.size(), output.data()));
+    return output;
+}
+
+QByteArray SlipUnescape(const QByteArray &data)
+{
+    QByteArray output(data.size(), Qt::Uninitialized);
+    output.resize(SlipUnescape(data.constData(), data.size(), output.data()));
+    return output;
+}
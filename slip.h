@@ -0,0 +1,19 @@
+#ifndef SLIP_H
+#define SLIP_H
+
+#include <QByteArray>
+#include "Prot.h"
+
+// Экранирование байтов кадра: 0xC0 -> DB DC, 0xDB -> DB DD.
+// Чистые участки копируются блоками по 16/32 байта (SSE2/AVX2), скалярный код
+// работает только вокруг экранируемых байтов.
+
+// dst must have room for 2 * len bytes. Returns number of bytes written
+int SlipEscape(const UCHAR *src, int len, char *dst);
+// dst must have room for len bytes and may be the same as src. Returns number of bytes written
+int SlipUnescape(const char *src, int len, char *dst);
+
+QByteArray SlipEscape(const QByteArray &data);
+QByteArray SlipUnescape(const QByteArray &data);
+
+#endif // SLIP_H
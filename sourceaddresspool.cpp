@@ -0,0 +1,152 @@
+#include "sourceaddresspool.h"
+#include <QFile>
+#include <QStringList>
+
+namespace {
+
+// IPv4 ranges are expanded, keep the pool sane
+constexpr quint32 MAX_ADDRESSES = 65536;
+
+bool appendRange(std::vector<QHostAddress> &result, quint32 first, quint32 last)
+{
+    if (last < first || last - first >= MAX_ADDRESSES - result.size())
+        return false;
+    for (quint64 ip = first; ip <= last; ip++)
+        result.emplace_back(static_cast<quint32>(ip));
+    return true;
+}
+
+bool parseEntry(const QString &entry, std::vector<QHostAddress> &result)
+{
+    if (entry.contains('/'))
+    {
+        const QPair<QHostAddress, int> subnet = QHostAddress::parseSubnet(entry);
+        if (subnet.first.protocol() != QAbstractSocket::IPv4Protocol || subnet.second < 0)
+            return false;
+        const quint32 mask = subnet.second == 0 ? 0 : ~quint32(0) << (32 - subnet.second);
+        const quint32 base = subnet.first.toIPv4Address() & mask;
+        // Network and broadcast addresses can't be bound for /31 and wider
+        if (subnet.second >= 31)
+            return appendRange(result, base, base | ~mask);
+        return appendRange(result, base + 1, (base | ~mask) - 1);
+    }
+
+    const int dash = entry.indexOf('-');
+    if (dash > 0)
+    {
+        const QHostAddress first(entry.left(dash).trimmed());
+        const QHostAddress last(entry.mid(dash + 1).trimmed());
+        if (first.protocol() != QAbstractSocket::IPv4Protocol || last.protocol() != QAbstractSocket::IPv4Protocol)
+            return false;
+        return appendRange(result, first.toIPv4Address(), last.toIPv4Address());
+    }
+
+    const QHostAddress address(entry);
+    if (address.isNull() || result.size() >= MAX_ADDRESSES)
+        return false;
+    result.push_back(address);
+    return true;
+}
+
+}
+
+SourceAddressPool &SourceAddressPool::instance()
+{
+    static SourceAddressPool pool;
+    return pool;
+}
+
+bool SourceAddressPool::configure(const QString &list, int portsPerAddress)
+{
+    std::vector<QHostAddress> parsed;
+    bool ok = true;
+    for (const QString &part : list.split(',', Qt::SkipEmptyParts))
+    {
+        const QString entry = part.trimmed();
+        if (!entry.isEmpty() && !parseEntry(entry, parsed))
+        {
+            ok = false;
+            parsed.clear();
+            break;
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    addresses = std::move(parsed);
+    used.assign(addresses.size(), 0);
+    portLimit = portsPerAddress > 0 ? portsPerAddress : ephemeralPorts();
+    next = 0;
+    total = 0;
+    generation++;
+    return ok;
+}
+
+bool SourceAddressPool::isEmpty() const
+{
+    QMutexLocker locker(&mutex);
+    return addresses.empty();
+}
+
+int SourceAddressPool::addressCount() const
+{
+    QMutexLocker locker(&mutex);
+    return static_cast<int>(addresses.size());
+}
+
+int SourceAddressPool::connectionCount() const
+{
+    QMutexLocker locker(&mutex);
+    return total;
+}
+
+SourceAddressPool::Lease SourceAddressPool::acquire()
+{
+    QMutexLocker locker(&mutex);
+    Lease lease;
+    const int count = static_cast<int>(addresses.size());
+    for (int tries = 0; tries < count; tries++)
+    {
+        const int index = next;
+        next = next + 1 == count ? 0 : next + 1;
+        if (used[index] < portLimit)
+        {
+            used[index]++;
+            total++;
+            lease.index = index;
+            lease.generation = generation;
+            lease.address = addresses[index];
+            break;
+        }
+    }
+    return lease;
+}
+
+void SourceAddressPool::release(Lease &lease)
+{
+    if (!lease.isValid())
+        return;
+
+    QMutexLocker locker(&mutex);
+    if (lease.generation == generation)
+    {
+        used[lease.index]--;
+        total--;
+    }
+    lease = Lease();
+}
+
+int SourceAddressPool::ephemeralPorts()
+{
+    // Linux default range 32768-60999
+    int ports = 28232;
+#ifdef Q_OS_LINUX
+    QFile range("/proc/sys/net/ipv4/ip_local_port_range");
+    if (range.open(QIODevice::ReadOnly))
+    {
+        const QList<QByteArray> bounds = range.readAll().simplified().split(' ');
+        if (bounds.size() == 2 && bounds[1].toInt() > bounds[0].toInt())
+            ports = bounds[1].toInt() - bounds[0].toInt() + 1;
+    }
+#endif
+    return ports;
+}
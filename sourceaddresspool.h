@@ -0,0 +1,56 @@
+#ifndef SOURCEADDRESSPOOL_H
+#define SOURCEADDRESSPOOL_H
+
+#include <QHostAddress>
+#include <QMutex>
+#include <QString>
+#include <vector>
+
+// Локальные адреса, с которых устройства подключаются к серверу. С одного
+// адреса к одному ip:port сервера помещается не больше соединений, чем
+// эфемерных портов (обычно 28-64 тысячи), поэтому сокеты привязываются к
+// адресам пула по кругу, с учетом занятых портов каждого адреса.
+// Пустой пул - адрес выбирает система.
+class SourceAddressPool
+{
+public:
+    struct Lease
+    {
+        int index = -1;
+        quint32 generation = 0;
+        QHostAddress address;
+
+        bool isValid() const { return index >= 0; }
+    };
+
+    static SourceAddressPool &instance();
+
+    // Comma separated list of "a.b.c.d", "a.b.c.d-a.b.c.e" and "a.b.c.d/n".
+    // Returns false and keeps the pool empty on a bad entry
+    bool configure(const QString &addresses, int portsPerAddress = 0);
+    bool isEmpty() const;
+    int addressCount() const;
+    int connectionCount() const;
+
+    // Next address with a free port, invalid lease if all are used up
+    Lease acquire();
+    void release(Lease &lease);
+
+    // Size of the system ephemeral port range
+    static int ephemeralPorts();
+
+private:
+    SourceAddressPool() = default;
+    Q_DISABLE_COPY(SourceAddressPool)
+
+    mutable QMutex mutex;
+    std::vector<QHostAddress> addresses;
+    std::vector<int> used;
+    int portLimit = 0;
+    int next = 0;
+    int total = 0;
+    // Leases of the previous configuration are ignored on release
+    quint32 generation = 0;
+};
+
+#endif // SOURCEADDRESSPOOL_H
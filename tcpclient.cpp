@@ -3,21 +3,18 @@
 TcpClient::TcpClient(Logger* logger, const QString& phone, QObject *parent)
     : QObject{parent},
     devicePhone{phone},
+    captureIndex{TrafficCapture::instance().registerDevice(phone)},
     connectionStatus{false},
     logAllowed(true),
     logger{logger}
-{
-    connect(&tcpSocket, &QTcpSocket::connected, this, &TcpClient::onSocketConnected);
-    connect(&tcpSocket, &QTcpSocket::disconnected, this, &TcpClient::onSocketDisconnected);
-    connect(&tcpSocket, &QAbstractSocket::errorOccurred, this, &TcpClient::onSocketError);
-    connect(&tcpSocket, &QTcpSocket::readyRead, this, &TcpClient::onSocketReadyRead);
-}
+{}
 
 
 TcpClient::~TcpClient()
 {
-    if (tcpSocket.state() == QAbstractSocket::ConnectedState)
+    if (connectionStatus)
         disconnectFromServer();
+    SourceAddressPool::instance().release(sourceLease);
 }
 
 bool TcpClient::isConnected() const
@@ -27,12 +24,29 @@ bool TcpClient::isConnected() const
 
 void TcpClient::connectToServer(const QString &serverAddress, quint16 serverPort)
 {
-    tcpSocket.connectToHost(serverAddress, serverPort);
+    if (!transport)
+        transport = Transport::create(this, this);
+
+    SourceAddressPool &sources = SourceAddressPool::instance();
+    if (!sourceLease.isValid() && !sources.isEmpty())
+    {
+        sourceLease = sources.acquire();
+        if (!sourceLease.isValid())
+        {
+            if (logAllowed)
+                logger->logError(tr("Устройство с ID ") + devicePhone + tr(": закончились порты на всех исходящих адресах"));
+            emit socketError();
+            return;
+        }
+    }
+    transport->setSourceAddress(sourceLease.address);
+    transport->connectToServer(serverAddress, serverPort);
 }
 
 void TcpClient::disconnectFromServer()
 {
-    tcpSocket.disconnectFromHost();
+    if (transport)
+        transport->disconnectFromServer();
 }
 
 void TcpClient::editLogStatus(const bool &status)
@@ -45,79 +59,75 @@ bool TcpClient::checkConnection()
     if (!connectionStatus)
     {
         if (logAllowed)
-            logger->logWarning(tr("Устройство c ID ") + devicePhone + tr(" не подключено к серверу!"));
+            logger->logEvent(LogLevel::Warning, LogEvent::NotConnected, devicePhone);
         return false;
     }
     else return true;
 }
 
-void TcpClient::onSocketConnected()
+void TcpClient::onTransportConnected()
 {
     connectionStatus = true;
     if (logAllowed)
-        logger->logInfo(tr("Устройство с ID ") + devicePhone + tr(" подключено к серверу. Выполняется синхронизация..."));
+        logger->logEvent(LogLevel::Info, LogEvent::Connected, devicePhone);
     emit connectionChanged(connectionStatus);
 }
 
-void TcpClient::onSocketDisconnected()
+void TcpClient::onTransportDisconnected()
 {
     connectionStatus = false;
+    SourceAddressPool::instance().release(sourceLease);
     if (logAllowed)
-        logger->logInfo(tr("Устройство с ID ") + devicePhone + tr(" отключилось от сервера."));
+        logger->logEvent(LogLevel::Info, LogEvent::Disconnected, devicePhone);
     emit connectionChanged(connectionStatus);
 }
 
-void TcpClient::onSocketReadyRead()
+void TcpClient::onTransportData(const char *data, int size)
 {
-    receivedMessage = tcpSocket.readAll();
+    // No copy: the capture, the logger and FrameDecoder copy what they keep
+    const QByteArray message = QByteArray::fromRawData(data, size);
+    TrafficCapture::instance().record(captureIndex, Capture::Direction::FromServer, message);
     if (logAllowed)
-        logger->logInfo(tr("ID ") + devicePhone + tr(" Получило сообщение: ") + logger->byteArrToStr(receivedMessage));
-    emit messageReceived(receivedMessage);
+        logger->logEvent(LogLevel::Info, LogEvent::FrameReceived, devicePhone, 0, message);
+    emit messageReceived(message);
 }
 
-void TcpClient::onSocketError()
+void TcpClient::onTransportError(const QString &error)
 {
-    QString errorString = tcpSocket.errorString();
+    // Failed connect, a connected socket releases it on disconnect
+    if (!connectionStatus)
+        SourceAddressPool::instance().release(sourceLease);
     if (logAllowed)
-        logger->logError(tr("Ошибка сокета: ") + errorString);
+        logger->logEvent(LogLevel::Error, LogEvent::SocketError, devicePhone, 0, QByteArray(), error);
+    emit socketError();
 }
 
 void TcpClient::onWrongCRC(const UCHAR &expected1, const UCHAR &received1, const UCHAR &expected2, const UCHAR &received2)
 {
-    QString message = tr("Неправильная контрольная сумма. Ожидалось: %1%2 | Получено: %3%4").arg(
-        QString::number(expected1, 16).rightJustified(2, '0'),
-        QString::number(expected2, 16).rightJustified(2, '0'),
-        QString::number(received1, 16).rightJustified(2, '0'),
-        QString::number(received2, 16).rightJustified(2, '0'));
-
     if (logAllowed)
-        logger->logError(message);
+        logger->logEvent(LogLevel::Error, LogEvent::WrongCrc, devicePhone,
+                         quint32(expected1) << 24 | quint32(received1) << 16 | quint32(expected2) << 8 | received2);
 }
 
 void TcpClient::onWrongTx(const UCHAR &expected, const UCHAR &received)
 {
-    QString message = tr("Tx не совпадают. Ожидалось: %1 | Получено: %2").arg(
-        QString::number(expected, 16).rightJustified(2, '0'),
-        QString::number(received, 16).rightJustified(2, '0'));
-
     if (logAllowed)
-        logger->logError(message);
+        logger->logEvent(LogLevel::Error, LogEvent::WrongTx, devicePhone, quint32(expected) << 8 | received);
 }
 
 void TcpClient::onUnknownCommand(const UCHAR &command)
 {
-    QString commandString = QString("0x%1").arg(command, 2, 16, QChar('0'));
     if (logAllowed)
-        logger->logWarning(tr("Устройство с ID ") + devicePhone + tr(" встретило незнакомую команду: ") + commandString + tr(" Отправляю стандартный ответ..."));
+        logger->logEvent(LogLevel::Warning, LogEvent::UnknownCommand, devicePhone, command);
 }
 
 void TcpClient::sendMessage(const QByteArray &message)
 {
     if (!checkConnection())
         return;
-    currentMessage = message;
-    tcpSocket.write(message);
+    transport->send(message);
+    TrafficCapture::instance().record(captureIndex, Capture::Direction::ToServer, message);
 
     if (logAllowed)
-        logger->logInfo(tr("ID ") + devicePhone + tr(" Отправило сообщение: ") + logger->byteArrToStr(currentMessage));
+        logger->logEvent(LogLevel::Info, LogEvent::FrameSent, devicePhone, 0, message);
 }
@@ -2,12 +2,15 @@
 #define TCPCLIENT_H
 
 #include <QObject>
-#include <QTcpSocket>
 #include <QDebug>
+#include <memory>
 #include "modbushandler.h"
 #include "logger.h"
+#include "transport.h"
+#include "sourceaddresspool.h"
+#include "trafficcapture.h"
 
-class TcpClient : public QObject
+class TcpClient : public QObject, private TransportListener
 {
     Q_OBJECT
 public:
@@ -21,7 +24,10 @@ public:
 
 signals:
     void connectionChanged(const bool &status);
+    // View of the transport read buffer, valid only during the call. Receivers
+    // must be in the device thread (direct connection) and copy what they keep
     void messageReceived(const QByteArray &message);
+    void socketError();
 
 public slots:
     void sendMessage(const QByteArray& message);
@@ -32,11 +38,13 @@ public slots:
 
 private:
     QString devicePhone;
-    QTcpSocket tcpSocket;
+    // Device index in TrafficCapture files
+    quint32 captureIndex;
+    // Created in the device thread on the first connect
+    std::unique_ptr<Transport> transport;
+    // Source address of the current connection, released when it is closed or fails
+    SourceAddressPool::Lease sourceLease;
     bool connectionStatus;
-    QByteArray currentMessage;
-    QByteArray receivedMessage;
-    ModbusHandler _modbusHandler;
     bool logAllowed;
 
     Logger* logger;
@@ -45,15 +53,12 @@ private:
 
     void sendDefaultResponce(const QByteArray &message);
 
-    QByteArray transformToData(const QByteArray &input);
-    QByteArray transformToRaw(const QByteArray &input);
     bool checkConnection();
 
-private slots:
-    void onSocketConnected();
-    void onSocketDisconnected();
-    void onSocketReadyRead();
-    void onSocketError();
+    void onTransportConnected() override;
+    void onTransportDisconnected() override;
+    void onTransportData(const char *data, int size) override;
+    void onTransportError(const QString &error) override;
 };
 
 #endif // TCPCLIENT_H
@@ -0,0 +1,213 @@
+#include "timingwheel.h"
+#include <memory>
+
+namespace {
+
+void unlink(WheelLink *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = nullptr;
+}
+
+void linkBefore(WheelLink *head, WheelLink *link)
+{
+    link->prev = head->prev;
+    link->next = head;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+// Moves all links of from to the empty list to
+void takeAll(WheelLink &from, WheelLink &to)
+{
+    to.next = to.prev = &to;
+    if (from.next == &from)
+        return;
+    to.next = from.next;
+    to.prev = from.prev;
+    to.next->prev = &to;
+    to.prev->next = &to;
+    from.next = from.prev = &from;
+}
+
+}
+
+WheelTimer::WheelTimer(std::function<void()> callback)
+    : callback{std::move(callback)}
+{}
+
+WheelTimer::~WheelTimer()
+{
+    stop();
+}
+
+void WheelTimer::setCallback(std::function<void()> callback)
+{
+    this->callback = std::move(callback);
+}
+
+void WheelTimer::setSingleShot(bool singleShot)
+{
+    this->singleShot = singleShot;
+}
+
+void WheelTimer::start(int msec)
+{
+    stop();
+    TimingWheel *target = TimingWheel::forCurrentThread();
+    msec = qMax(msec, 0);
+    intervalTicks = qMax<quint64>((msec + TimingWheel::TICK_MS - 1) / TimingWheel::TICK_MS, 1);
+    expires = target->ticksAfter(msec);
+    target->add(this);
+}
+
+void WheelTimer::stop()
+{
+    if (wheel)
+        wheel->remove(this);
+}
+
+bool WheelTimer::isActive() const
+{
+    return wheel != nullptr;
+}
+
+TimingWheel *TimingWheel::forCurrentThread()
+{
+    static thread_local std::unique_ptr<TimingWheel> wheel;
+    if (!wheel)
+        wheel.reset(new TimingWheel);
+    return wheel.get();
+}
+
+TimingWheel::TimingWheel()
+{
+    for (auto &level : wheelSlots)
+    {
+        for (WheelLink &slot : level)
+            slot.next = slot.prev = &slot;
+    }
+
+    clock.start();
+    ticker.setInterval(TICK_MS);
+    QObject::connect(&ticker, &QTimer::timeout, &ticker, [this] { advance(); });
+}
+
+TimingWheel::~TimingWheel()
+{
+    // Timers outliving the thread must not touch the wheel
+    for (auto &level : wheelSlots)
+    {
+        for (WheelLink &slot : level)
+        {
+            while (slot.next != &slot)
+            {
+                WheelTimer *timer = static_cast<WheelTimer*>(slot.next);
+                unlink(timer);
+                timer->wheel = nullptr;
+            }
+        }
+    }
+}
+
+void TimingWheel::add(WheelTimer *timer)
+{
+    // Idle wheel didn't tick, catch up before placing
+    if (activeCount == 0)
+        currentTick = clock.elapsed() / TICK_MS;
+    if (timer->expires <= currentTick)
+        timer->expires = currentTick + 1;
+
+    timer->wheel = this;
+    place(timer);
+    activeCount++;
+
+    if (!ticker.isActive())
+        ticker.start();
+}
+
+void TimingWheel::remove(WheelTimer *timer)
+{
+    unlink(timer);
+    timer->wheel = nullptr;
+    activeCount--;
+}
+
+quint64 TimingWheel::ticksAfter(int msec) const
+{
+    return (static_cast<quint64>(clock.elapsed()) + msec + TICK_MS - 1) / TICK_MS;
+}
+
+void TimingWheel::place(WheelTimer *timer)
+{
+    constexpr quint64 range = quint64(1) << (LEVELS * SLOT_BITS);
+    if (timer->expires - currentTick >= range)
+        timer->expires = currentTick + range - 1;
+
+    const quint64 delta = timer->expires - currentTick;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (quint64(1) << ((level + 1) * SLOT_BITS)))
+        level++;
+
+    const quint64 index = (timer->expires >> (level * SLOT_BITS)) & SLOT_MASK;
+    linkBefore(&wheelSlots[level][index], timer);
+}
+
+// Spreads the slot of the upper level that starts now over the lower levels
+void TimingWheel::cascade(int level)
+{
+    const quint64 index = (currentTick >> (level * SLOT_BITS)) & SLOT_MASK;
+    WheelLink pending;
+    takeAll(wheelSlots[level][index], pending);
+    while (pending.next != &pending)
+    {
+        WheelTimer *timer = static_cast<WheelTimer*>(pending.next);
+        unlink(timer);
+        place(timer);
+    }
+}
+
+void TimingWheel::advance()
+{
+    const quint64 target = clock.elapsed() / TICK_MS;
+    while (currentTick < target)
+    {
+        if (activeCount == 0)
+        {
+            currentTick = target;
+            break;
+        }
+
+        currentTick++;
+        for (int level = 1; level < LEVELS; level++)
+        {
+            if (currentTick & ((quint64(1) << (level * SLOT_BITS)) - 1))
+                break;
+            cascade(level);
+        }
+        expire(wheelSlots[0][currentTick & SLOT_MASK]);
+    }
+
+    if (activeCount == 0)
+        ticker.stop();
+}
+
+// Callbacks may start and stop any timers, including the ones still pending here
+void TimingWheel::expire(WheelLink &slot)
+{
+    WheelLink pending;
+    takeAll(slot, pending);
+    while (pending.next != &pending)
+    {
+        WheelTimer *timer = static_cast<WheelTimer*>(pending.next);
+        remove(timer);
+        if (!timer->singleShot)
+        {
+            timer->expires += timer->intervalTicks;
+            add(timer);
+        }
+        if (timer->callback)
+            timer->callback();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <QElapsedTimer>
+#include <QTimer>
+#include <functional>
+
+class TimingWheel;
+
+// Node of the circular slot lists of TimingWheel
+struct WheelLink
+{
+    WheelLink *prev = nullptr;
+    WheelLink *next = nullptr;
+};
+
+// Легкий таймер устройства. Не QObject: хранится в колесе своего потока,
+// запуск и остановка O(1). Методы вызываются только в потоке, где таймер запущен
+class WheelTimer : private WheelLink
+{
+public:
+    explicit WheelTimer(std::function<void()> callback = {});
+    ~WheelTimer();
+
+    void setCallback(std::function<void()> callback);
+    void setSingleShot(bool singleShot);
+
+    // Like QTimer::start(): restarts if active, repeats unless single shot
+    void start(int msec);
+    void stop();
+    bool isActive() const;
+
+private:
+    friend class TimingWheel;
+
+    std::function<void()> callback;
+    bool singleShot = false;
+    quint64 intervalTicks = 0;
+    quint64 expires = 0;
+
+    // Wheel the timer is linked into, nullptr while inactive
+    TimingWheel *wheel = nullptr;
+
+    Q_DISABLE_COPY(WheelTimer)
+};
+
+// Иерархическое колесо таймеров одного потока (4 уровня по 64 слота, шаг 10 мс).
+// Вместо тысяч QTimer в цикле событий стоит один, он тикает пока есть активные
+// таймеры и за один вызов обрабатывает все истекшие слоты.
+class TimingWheel
+{
+public:
+    static constexpr int TICK_MS = 10;
+
+    // Wheel of the calling thread, created on first use
+    static TimingWheel *forCurrentThread();
+    ~TimingWheel();
+
+    void add(WheelTimer *timer);
+    void remove(WheelTimer *timer);
+
+    // Tick at which a timer started now for msec expires
+    quint64 ticksAfter(int msec) const;
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr quint64 SLOT_MASK = SLOTS - 1;
+
+    // Sentinels of the slot lists
+    WheelLink wheelSlots[LEVELS][SLOTS];
+    quint64 currentTick = 0;
+    int activeCount = 0;
+    QElapsedTimer clock;
+    QTimer ticker;
+
+    TimingWheel();
+
+    void place(WheelTimer *timer);
+    void cascade(int level);
+    void advance();
+    void expire(WheelLink &slot);
+
+    Q_DISABLE_COPY(TimingWheel)
+};
+
+#endif // TIMINGWHEEL_H
@@ -0,0 +1,16 @@
+QT       = core
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = crcbench
+
+# Crc16 is taken from the simulator sources as is
+INCLUDEPATH += ../..
+
+SOURCES += \
+    ../../Prot.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../Prot.h
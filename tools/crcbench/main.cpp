@@ -0,0 +1,190 @@
+// crcbench: сравнение старого побайтового CRC (CRC_Table_Hi/Lo) с Crc16 на
+// буферах размера кадра и проверка Crc16 по побитовому эталону на случайных
+// буферах и точках разбиения, включая склейку через Crc16Shift.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "Prot.h"
+
+namespace {
+
+// Tables the simulator used before Crc16, kept here for comparison
+const UCHAR CRC_Table_Hi[0x100] = {
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
+    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40
+};
+
+const UCHAR CRC_Table_Lo[0x100] = {
+    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7, 0x05, 0xC5, 0xC4, 0x04,
+    0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B, 0xC9, 0x09, 0x08, 0xC8,
+    0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE, 0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC,
+    0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6, 0xD2, 0x12, 0x13, 0xD3, 0x11, 0xD1, 0xD0, 0x10,
+    0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3, 0xF2, 0x32, 0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4,
+    0x3C, 0xFC, 0xFD, 0x3D, 0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38,
+    0x28, 0xE8, 0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF, 0x2D, 0xED, 0xEC, 0x2C,
+    0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26, 0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21, 0x20, 0xE0,
+    0xA0, 0x60, 0x61, 0xA1, 0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67, 0xA5, 0x65, 0x64, 0xA4,
+    0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A, 0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68,
+    0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA, 0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C,
+    0xB4, 0x74, 0x75, 0xB5, 0x77, 0xB7, 0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0,
+    0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54,
+    0x9C, 0x5C, 0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98,
+    0x88, 0x48, 0x49, 0x89, 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D, 0x4C, 0x8C,
+    0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83, 0x41, 0x81, 0x80, 0x40
+};
+
+// Legacy loop as it was in CalculateCRC
+quint16 legacyCrc(const UCHAR *data, size_t size)
+{
+    UCHAR c, CRChi, CRClo;
+    CRChi = CRClo = 0xFF;
+    for (size_t i = 0; i < size; i++)
+    {
+        c = data[i];
+        c ^= CRClo;
+        CRClo = CRChi ^ CRC_Table_Hi[c];
+        CRChi = CRC_Table_Lo[c];
+    }
+    return static_cast<quint16>(CRClo | (CRChi << 8));
+}
+
+// Modbus CRC16 bit by bit, the definition the tables are built from
+quint16 bitwiseCrc(const UCHAR *data, size_t size, quint16 reg = 0xFFFF)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        reg ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            reg = (reg & 1) ? static_cast<quint16>((reg >> 1) ^ 0xA001) : static_cast<quint16>(reg >> 1);
+    }
+    return reg;
+}
+
+// Number of mismatches, details of the first few are printed
+int check(int rounds, quint32 seed)
+{
+    std::mt19937 random(seed);
+    std::vector<UCHAR> buffer(2 * PROT_MAX_SIZE + 2);
+    int failures = 0;
+
+    auto report = [&](const char *what, size_t size, size_t split, quint16 got, quint16 expected) {
+        if (failures++ < 10)
+            printf("MISMATCH %s: size %zu split %zu got %04X expected %04X\n", what, size, split, got, expected);
+    };
+
+    for (int round = 0; round < rounds; round++)
+    {
+        const size_t size = random() % (buffer.size() + 1);
+        for (size_t i = 0; i < size; i++)
+            buffer[i] = static_cast<UCHAR>(random());
+        const size_t split = size ? random() % (size + 1) : 0;
+        const quint16 expected = bitwiseCrc(buffer.data(), size);
+
+        Crc16 whole;
+        whole.update(buffer.data(), size);
+        if (whole.state() != expected)
+            report("update", size, 0, whole.state(), expected);
+
+        Crc16 parts;
+        parts.update(buffer.data(), split);
+        for (size_t i = split; i < size; i++)
+            parts.update(buffer[i]);
+        if (parts.state() != expected)
+            report("split", size, split, parts.state(), expected);
+
+        Crc16 combined;
+        combined.update(buffer.data(), split);
+        combined.combine(bitwiseCrc(buffer.data() + split, size - split, 0), Crc16Shift(size - split));
+        if (combined.state() != expected)
+            report("combine", size, split, combined.state(), expected);
+
+        const quint16 legacy = legacyCrc(buffer.data(), size);
+        if (legacy != expected)
+            report("legacy", size, 0, legacy, expected);
+    }
+    return failures;
+}
+
+// Results of the timed loops, so the compiler keeps them
+volatile quint16 crcSink;
+
+template <typename Func>
+double nsPerFrame(const std::vector<UCHAR> &buffer, size_t size, quint64 frames, Func &&crc)
+{
+    // Result feeds the next frame, so the calls can't be dropped or overlapped
+    quint16 sink = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (quint64 i = 0; i < frames; i++)
+        sink ^= crc(buffer.data() + (sink & 7), size);
+    const qint64 elapsed = timer.nsecsElapsed();
+    crcSink = sink;
+    return double(elapsed) / frames;
+}
+
+void bench(double megabytes)
+{
+    std::vector<UCHAR> buffer(2 * PROT_MAX_SIZE + 2 + 8);
+    std::mt19937 random(1);
+    for (UCHAR &byte : buffer)
+        byte = static_cast<UCHAR>(random());
+
+    printf("%8s %14s %14s %10s\n", "bytes", "legacy ns", "Crc16 ns", "speedup");
+    // Sync, state reply, full frame and the largest escaped frame
+    for (size_t size : {8, 16, 64, 128, 256, 514})
+    {
+        const quint64 frames = qMax<quint64>(1, static_cast<quint64>(megabytes * 1024 * 1024 / size));
+        const double legacy = nsPerFrame(buffer, size, frames, legacyCrc);
+        const double sliced = nsPerFrame(buffer, size, frames, [](const UCHAR *data, size_t size) {
+            Crc16 crc;
+            crc.update(data, size);
+            return crc.state();
+        });
+        printf("%8zu %14.1f %14.1f %9.2fx\n", size, legacy, sliced, legacy / sliced);
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("crcbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compares the legacy table CRC with Crc16 and checks Crc16 against a bitwise reference");
+    parser.addHelpOption();
+    QCommandLineOption checkOption("check", "Only run the randomized check");
+    QCommandLineOption roundsOption("rounds", "Random buffers to check, 100000 by default", "count", "100000");
+    QCommandLineOption seedOption("seed", "Seed of the random buffers", "seed", "1");
+    QCommandLineOption sizeOption("mbytes", "Megabytes hashed per frame size, 256 by default", "mbytes", "256");
+    parser.addOptions({checkOption, roundsOption, seedOption, sizeOption});
+    parser.process(app);
+
+    const int failures = check(parser.value(roundsOption).toInt(), parser.value(seedOption).toUInt());
+    printf("Check: %d mismatches in %s buffers\n", failures, qPrintable(parser.value(roundsOption)));
+    if (failures)
+        return 1;
+
+    if (!parser.isSet(checkOption))
+        bench(parser.value(sizeOption).toDouble());
+    return 0;
+}
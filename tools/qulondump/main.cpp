@@ -0,0 +1,381 @@
+// qulondump: просмотр файлов захвата трафика .qcap симулятора.
+// Файл отображается в память целиком, записи разбираются на месте, кадры
+// собираются из потока по устройству и направлению и декодируются по
+// заголовку FL_MODBUS_MESSAGE только если запись прошла фильтр устройства.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "Prot.h"
+#include "capturefile.h"
+#include "framedecoder.h"
+
+namespace {
+
+struct Filter
+{
+    QSet<QByteArray> phones;
+    // Request and reply codes
+    QSet<int> commands;
+    // -1 both, otherwise Capture::Direction
+    int direction = -1;
+    bool raw = false;
+    bool statsOnly = false;
+};
+
+struct Stats
+{
+    quint64 records = 0;
+    quint64 bytes = 0;
+    quint64 frames = 0;
+    quint64 badCrc = 0;
+    // command code and direction -> frames
+    std::map<std::pair<int, int>, quint64> commands;
+};
+
+// Output is built here and written in large blocks
+class Output
+{
+public:
+    ~Output() { flush(); }
+
+    void append(const char *data, int size)
+    {
+        buffer.append(data, size);
+        if (buffer.size() >= 1 << 20)
+            flush();
+    }
+    void append(const QByteArray &data) { append(data.constData(), static_cast<int>(data.size())); }
+    void append(const char *text) { append(text, static_cast<int>(strlen(text))); }
+    void append(char c) { buffer.append(c); }
+
+    void appendHex(const char *data, int size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < size; i++)
+        {
+            const UCHAR byte = static_cast<UCHAR>(data[i]);
+            if (i)
+                buffer.append(' ');
+            buffer.append(digits[byte >> 4]);
+            buffer.append(digits[byte & 0x0F]);
+        }
+    }
+
+    void flush()
+    {
+        fwrite(buffer.constData(), 1, static_cast<size_t>(buffer.size()), stdout);
+        buffer.clear();
+    }
+
+private:
+    QByteArray buffer;
+};
+
+class Dumper
+{
+public:
+    Dumper(const Filter &filter, Output &out) : filter(filter), out(out) {}
+
+    bool dump(const QString &fileName);
+    const Stats &stats() const { return total; }
+
+private:
+    const Filter &filter;
+    Output &out;
+    Stats total;
+
+    qint64 wallBase = 0;
+    // Phones by device index, UTF-8
+    std::vector<QByteArray> names;
+    // Per device index: 1 passes the device filter, 0 not, -1 not resolved yet
+    std::vector<signed char> allowed;
+    QHash<quint64, FrameDecoder> decoders;
+    // Formatted time prefix is reused within one second
+    qint64 cachedSecond = -1;
+    QByteArray cachedPrefix;
+
+    bool deviceAllowed(quint32 device);
+    void frame(const Capture::RecordHeader &record, const char *data, int size);
+    void prefix(const Capture::RecordHeader &record);
+};
+
+bool Dumper::dump(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        fprintf(stderr, "%s: %s\n", qPrintable(fileName), qPrintable(file.errorString()));
+        return false;
+    }
+
+    const qint64 size = file.size();
+    const uchar *map = size > 0 ? file.map(0, size) : nullptr;
+    Capture::FileHeader header;
+    if (!map || size < static_cast<qint64>(sizeof(header)))
+    {
+        fprintf(stderr, "%s: not a capture file\n", qPrintable(fileName));
+        return false;
+    }
+    memcpy(&header, map, sizeof(header));
+    if (!Capture::isValidHeader(header))
+    {
+        fprintf(stderr, "%s: not a capture file or unsupported version\n", qPrintable(fileName));
+        return false;
+    }
+
+    // Every file starts with its own device names and a fresh stream
+    wallBase = header.wallBase;
+    names.clear();
+    allowed.clear();
+    decoders.clear();
+    cachedSecond = -1;
+
+    qint64 position = header.headerSize;
+    while (position + static_cast<qint64>(sizeof(Capture::RecordHeader)) <= size)
+    {
+        Capture::RecordHeader record;
+        memcpy(&record, map + position, sizeof(record));
+        const qint64 span = Capture::recordSpan(record.size);
+        // The last record of a file being written can be incomplete
+        if (position + static_cast<qint64>(sizeof(record)) + record.size > size)
+            break;
+
+        const char *data = reinterpret_cast<const char*>(map + position + sizeof(record));
+        position += span;
+
+        if (record.direction == Capture::Direction::DeviceName)
+        {
+            if (names.size() <= record.device)
+            {
+                names.resize(record.device + 1);
+                allowed.resize(record.device + 1, -1);
+            }
+            names[record.device] = QByteArray(data, record.size);
+            allowed[record.device] = -1;
+            continue;
+        }
+
+        if (filter.direction >= 0 && static_cast<int>(record.direction) != filter.direction)
+            continue;
+        if (!deviceAllowed(record.device))
+            continue;
+
+        total.records++;
+        total.bytes += record.size;
+
+        if (filter.raw)
+        {
+            if (!filter.statsOnly)
+            {
+                prefix(record);
+                out.append(": ");
+                out.appendHex(data, record.size);
+                out.append('\n');
+            }
+            continue;
+        }
+
+        const quint64 key = (static_cast<quint64>(record.device) << 8) | static_cast<quint8>(record.direction);
+        decoders[key].feed(data, record.size, [&](const char *frameData, int frameSize) {
+            frame(record, frameData, frameSize);
+        });
+    }
+    return true;
+}
+
+bool Dumper::deviceAllowed(quint32 device)
+{
+    if (filter.phones.isEmpty())
+        return true;
+    if (device >= allowed.size())
+        return false;
+    if (allowed[device] < 0)
+        allowed[device] = filter.phones.contains(names[device]) ? 1 : 0;
+    return allowed[device] == 1;
+}
+
+void Dumper::frame(const Capture::RecordHeader &record, const char *data, int size)
+{
+    const bool modbus = size >= static_cast<int>(sizeof(FL_MODBUS_MESSAGE)) + 2 &&
+                        static_cast<UCHAR>(data[3]) == 0x6E;
+    FL_MODBUS_MESSAGE header;
+    if (modbus)
+        memcpy(&header, data, sizeof(header));
+
+    if (!filter.commands.isEmpty() && (!modbus || !filter.commands.contains(header.command)))
+        return;
+
+    total.frames++;
+    bool crcOk = true;
+    if (modbus)
+    {
+        const int dataLength = qMin(static_cast<int>(header.len), size - static_cast<int>(sizeof(header)) - 2);
+        UCHAR crc[2];
+        Crc16 crc16;
+        crc16.update(data, sizeof(header) + dataLength);
+        crc16.finish(crc);
+        crcOk = crc[0] == static_cast<UCHAR>(data[size - 2]) && crc[1] == static_cast<UCHAR>(data[size - 1]);
+        if (!crcOk)
+            total.badCrc++;
+        total.commands[{header.command, static_cast<int>(record.direction)}]++;
+    }
+    else
+    {
+        total.commands[{-1, static_cast<int>(record.direction)}]++;
+    }
+
+    if (filter.statsOnly)
+        return;
+
+    prefix(record);
+    if (modbus)
+    {
+        const char *name = ProtCommandName(header.command);
+        char line[96];
+        const int length = snprintf(line, sizeof(line), " %s(0x%02x) tx=%02x rx=%02x src=%02x dst=%02x len=%u%s: ",
+                                    name ? name : "?", header.command, header.tx_id, header.rx_id,
+                                    header.sour_address, header.dist_address, header.len, crcOk ? "" : " CRC!");
+        out.append(line, qMin(length, static_cast<int>(sizeof(line)) - 1));
+        out.appendHex(data + sizeof(header), size - static_cast<int>(sizeof(header)) - 2);
+    }
+    else
+    {
+        out.append(": ");
+        out.appendHex(data, size);
+    }
+    out.append('\n');
+}
+
+void Dumper::prefix(const Capture::RecordHeader &record)
+{
+    const qint64 wall = wallBase + record.time;
+    const qint64 second = wall / 1000000;
+    if (second != cachedSecond)
+    {
+        cachedSecond = second;
+        cachedPrefix = QDateTime::fromSecsSinceEpoch(second).toString("yyyy-MM-dd hh:mm:ss").toLatin1();
+    }
+
+    char line[64];
+    const int length = snprintf(line, sizeof(line), ".%06lld ", static_cast<long long>(wall % 1000000));
+    out.append(cachedPrefix);
+    out.append(line, length);
+    if (record.device < names.size())
+        out.append(names[record.device]);
+    else
+        out.append(QByteArray::number(record.device));
+    out.append(record.direction == Capture::Direction::ToServer ? " ->" : " <-");
+}
+
+// Hex code or name from PROT_COMMANDS, name matches the request and the reply
+bool parseCommand(const QString &text, QSet<int> &commands)
+{
+    bool ok;
+    const int code = text.toInt(&ok, 0);
+    if (ok && code >= 0 && code <= 0xFF)
+    {
+        commands.insert(code);
+        return true;
+    }
+
+    for (const ProtCommand &command : PROT_COMMANDS)
+    {
+        if (text.compare(QLatin1String(command.name), Qt::CaseInsensitive) == 0)
+        {
+            commands.insert(command.cmd);
+            commands.insert(command.ok);
+            return true;
+        }
+    }
+    return false;
+}
+
+void printStats(const Stats &stats)
+{
+    printf("records %llu, bytes %llu, frames %llu, bad crc %llu\n",
+           static_cast<unsigned long long>(stats.records), static_cast<unsigned long long>(stats.bytes),
+           static_cast<unsigned long long>(stats.frames), static_cast<unsigned long long>(stats.badCrc));
+    for (const auto &entry : stats.commands)
+    {
+        const int code = entry.first.first;
+        const char *name = code >= 0 ? ProtCommandName(static_cast<UCHAR>(code)) : "other";
+        printf("%-3s %-16s 0x%02x %llu\n",
+               entry.first.second == static_cast<int>(Capture::Direction::ToServer) ? "->" : "<-",
+               name ? name : "?", code >= 0 ? code : 0, static_cast<unsigned long long>(entry.second));
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qulondump");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Prints traffic capture files (.qcap) of the Qulon server simulator");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "Capture files in the order they were written", "files...");
+    QCommandLineOption deviceOption({"d", "device"}, "Only the device with this phone, can be repeated", "phone");
+    QCommandLineOption commandOption({"c", "command"}, "Only frames with this command code or name, can be repeated", "command");
+    QCommandLineOption directionOption("direction", "Only frames to the server (out) or from it (in)", "in|out");
+    QCommandLineOption rawOption("raw", "Print socket reads and writes as is, without splitting into frames");
+    QCommandLineOption statsOption("stats", "Print only frame counts by command");
+    parser.addOptions({deviceOption, commandOption, directionOption, rawOption, statsOption});
+    parser.process(app);
+
+    const QStringList files = parser.positionalArguments();
+    if (files.isEmpty())
+        parser.showHelp(1);
+
+    Filter filter;
+    for (const QString &phone : parser.values(deviceOption))
+        filter.phones.insert(phone.toUtf8());
+    for (const QString &command : parser.values(commandOption))
+    {
+        if (!parseCommand(command, filter.commands))
+        {
+            fprintf(stderr, "unknown command %s\n", qPrintable(command));
+            return 1;
+        }
+    }
+    if (parser.isSet(directionOption))
+    {
+        const QString direction = parser.value(directionOption);
+        if (direction == "in")
+            filter.direction = static_cast<int>(Capture::Direction::FromServer);
+        else if (direction == "out")
+            filter.direction = static_cast<int>(Capture::Direction::ToServer);
+        else
+        {
+            fprintf(stderr, "direction must be in or out\n");
+            return 1;
+        }
+    }
+    filter.raw = parser.isSet(rawOption);
+    filter.statsOnly = parser.isSet(statsOption);
+    if (filter.raw && !filter.commands.isEmpty())
+    {
+        fprintf(stderr, "--command needs decoded frames, it can't be used with --raw\n");
+        return 1;
+    }
+
+    Output out;
+    Dumper dumper(filter, out);
+    bool ok = true;
+    for (const QString &file : files)
+        ok = dumper.dump(file) && ok;
+    out.flush();
+
+    if (filter.statsOnly)
+        printStats(dumper.stats());
+    return ok ? 0 : 2;
+}
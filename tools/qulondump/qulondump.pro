@@ -0,0 +1,21 @@
+QT       = core
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = qulondump
+
+# Frame layout and decoding are shared with the simulator
+INCLUDEPATH += ../..
+
+SOURCES += \
+    ../../Prot.cpp \
+    ../../framedecoder.cpp \
+    ../../slip.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../Prot.h \
+    ../../capturefile.h \
+    ../../framedecoder.h \
+    ../../slip.h
@@ -0,0 +1,406 @@
+#include "trafficcapture.h"
+#include "logger.h"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <chrono>
+#include <vector>
+
+namespace {
+
+// Microseconds of the monotonic clock
+qint64 monotonicNow()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Entries taken from the ring before new device names are checked
+constexpr int BATCH_SIZE = 4096;
+
+}
+
+struct TrafficCapture::ThreadStaging
+{
+    std::vector<StagingBlock*> blocks;
+    StagingBlock *current = nullptr;
+
+    ~ThreadStaging()
+    {
+        TrafficCapture::instance().releaseStaging(blocks);
+    }
+};
+
+TrafficCapture &TrafficCapture::instance()
+{
+    static TrafficCapture capture;
+    return capture;
+}
+
+TrafficCapture::TrafficCapture()
+    : ring(RING_SIZE)
+    , active(false)
+    , stopping(false)
+    , dropped(0)
+    , written(0)
+    , wallBase(QDateTime::currentMSecsSinceEpoch() * 1000 - monotonicNow())
+{}
+
+TrafficCapture::~TrafficCapture()
+{
+    stop();
+}
+
+void TrafficCapture::setLogger(Logger *logger)
+{
+    this->logger = logger;
+}
+
+bool TrafficCapture::start(const QString &directory, qint64 maxFileSize, QString *error)
+{
+    stop();
+
+    if (!QDir().mkpath(directory))
+    {
+        if (error)
+            *error = QObject::tr("Не удалось создать папку ") + directory;
+        return false;
+    }
+
+    this->directory = directory;
+    this->maxFileSize = maxFileSize;
+    // fileNumber is kept, a restart within the same second gets new names
+    buffer.resize(WRITE_SIZE);
+    used = 0;
+    bufferedRecords = 0;
+
+    // The writer is not running yet, the first file is opened here to report errors
+    if (!openNextFile())
+    {
+        if (error)
+            *error = failure;
+        return false;
+    }
+
+    dropped = 0;
+    written = 0;
+    writer.reset(QThread::create([this] { run(); }));
+    writer->setObjectName("Capture");
+    writer->start();
+    active = true;
+    return true;
+}
+
+void TrafficCapture::stop()
+{
+    if (!writer)
+        return;
+
+    active = false;
+    stopping = true;
+    writer->wait();
+    writer.reset();
+    stopping = false;
+
+    const quint64 lost = dropped;
+    if (lost && logger)
+        logger->logWarning(QObject::tr("Запись трафика: потеряно записей: %1").arg(lost));
+}
+
+bool TrafficCapture::isActive() const
+{
+    return active;
+}
+
+quint32 TrafficCapture::registerDevice(const QString &phone)
+{
+    QMutexLocker locker(&namesMutex);
+
+    auto it = indexes.constFind(phone);
+    if (it != indexes.constEnd())
+        return it.value();
+
+    const quint32 index = static_cast<quint32>(names.size());
+    names.append(phone);
+    indexes.insert(phone, index);
+    return index;
+}
+
+void TrafficCapture::record(quint32 device, Capture::Direction direction, const QByteArray &data)
+{
+    if (!active.load(std::memory_order_relaxed) || data.isEmpty())
+        return;
+
+    Entry entry;
+    entry.time = monotonicNow();
+    entry.device = device;
+    entry.direction = direction;
+
+    // Size field is 16 bit, larger reads are split
+    constexpr qsizetype MAX_RECORD = 0xFFFF;
+    for (qsizetype offset = 0; offset < data.size(); offset += MAX_RECORD)
+    {
+        const int size = static_cast<int>(qMin(data.size() - offset, MAX_RECORD));
+        StagingBlock *block = stagingFor(size);
+        if (!block)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        char *copy = block->data.get() + block->used;
+        memcpy(copy, data.constData() + offset, size);
+        block->used += size;
+        block->pending.fetch_add(1, std::memory_order_relaxed);
+
+        entry.size = static_cast<quint16>(size);
+        entry.data = copy;
+        entry.block = block;
+        if (!ring.push(std::move(entry)))
+        {
+            block->pending.fetch_sub(1, std::memory_order_relaxed);
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+TrafficCapture::StagingBlock *TrafficCapture::stagingFor(int size)
+{
+    thread_local ThreadStaging staging;
+
+    StagingBlock *block = staging.current;
+    if (block && block->used + size <= STAGING_BLOCK_SIZE)
+        return block;
+
+    // A block the writer is done with starts over
+    for (StagingBlock *candidate : staging.blocks)
+    {
+        if (candidate->pending.load(std::memory_order_acquire) == 0)
+        {
+            candidate->used = 0;
+            staging.current = candidate;
+            return candidate;
+        }
+    }
+    if (static_cast<int>(staging.blocks.size()) >= STAGING_BLOCKS_PER_THREAD)
+        return nullptr;
+
+    // The writer is behind, take one more block
+    {
+        QMutexLocker locker(&stagingMutex);
+        if (!freeBlocks.empty())
+        {
+            block = freeBlocks.back();
+            freeBlocks.pop_back();
+        }
+        else
+        {
+            stagingBlocks.push_back(std::make_unique<StagingBlock>());
+            block = stagingBlocks.back().get();
+            block->data.reset(new char[STAGING_BLOCK_SIZE]);
+        }
+    }
+    staging.blocks.push_back(block);
+    // A block from a finished thread may still be waiting for the writer
+    if (block->pending.load(std::memory_order_acquire) != 0)
+        return nullptr;
+    block->used = 0;
+    staging.current = block;
+    return block;
+}
+
+void TrafficCapture::releaseStaging(std::vector<StagingBlock*> &blocks)
+{
+    QMutexLocker locker(&stagingMutex);
+    freeBlocks.insert(freeBlocks.end(), blocks.begin(), blocks.end());
+    blocks.clear();
+}
+
+quint64 TrafficCapture::droppedRecords() const
+{
+    return dropped;
+}
+
+qint64 TrafficCapture::bytesWritten() const
+{
+    return written;
+}
+
+void TrafficCapture::run()
+{
+    std::vector<Entry> batch;
+    batch.reserve(BATCH_SIZE);
+    Entry entry;
+    QElapsedTimer sinceFlush;
+    sinceFlush.start();
+
+    while (true)
+    {
+        // Stop only after the ring is drained
+        const bool stop = stopping;
+
+        while (batch.size() < BATCH_SIZE && ring.pop(entry))
+            batch.push_back(std::move(entry));
+
+        if (!batch.empty())
+        {
+            // Devices are registered before their first frame is queued
+            appendNames();
+            for (const Entry &queued : batch)
+            {
+                const qint64 span = Capture::recordSpan(queued.size);
+                if (file.isOpen() && maxFileSize > 0 && fileSize + used + span > maxFileSize &&
+                    fileSize + used > static_cast<qint64>(sizeof(Capture::FileHeader)) + namesSpan)
+                {
+                    openNextFile();
+                }
+                if (file.isOpen())
+                {
+                    appendRecord(queued.time, queued.device, queued.direction, queued.data, queued.size);
+                    bufferedRecords++;
+                }
+                else
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+                // The bytes are in buffer now, the thread may reuse them
+                queued.block->pending.fetch_sub(1, std::memory_order_release);
+            }
+            batch.clear();
+            continue;
+        }
+
+        if (stop)
+            break;
+
+        if (used > 0 && sinceFlush.elapsed() >= FLUSH_INTERVAL_MS)
+        {
+            flush();
+            sinceFlush.restart();
+        }
+        QThread::msleep(5);
+    }
+
+    flush();
+    file.close();
+}
+
+bool TrafficCapture::openNextFile()
+{
+    if (file.isOpen())
+    {
+        flush();
+        file.close();
+    }
+
+    // Names never repeat within a run, NewOnly keeps files of earlier runs
+    const QString stamp = QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss");
+    QString path;
+    do
+    {
+        path = QDir(directory).filePath(QString("capture-%1-%2.qcap").arg(stamp).arg(fileNumber++, 3, 10, QChar('0')));
+    }
+    while (QFile::exists(path));
+    file.setFileName(path);
+    // Writes are already large, no need for the QFile buffer
+    if (!file.open(QIODevice::WriteOnly | QIODevice::NewOnly | QIODevice::Unbuffered))
+    {
+        fail(QObject::tr("не удалось открыть ") + path + ": " + file.errorString());
+        return false;
+    }
+
+    fileSize = 0;
+    namesInFile = 0;
+    namesSpan = 0;
+
+    Capture::FileHeader header;
+    memcpy(header.magic, Capture::MAGIC, sizeof(Capture::MAGIC));
+    header.version = Capture::VERSION;
+    header.headerSize = sizeof(Capture::FileHeader);
+    header.wallBase = wallBase;
+    header.created = QDateTime::currentMSecsSinceEpoch() * 1000;
+    memcpy(buffer.data() + used, &header, sizeof(header));
+    used += sizeof(header);
+
+    appendNames();
+    return true;
+}
+
+void TrafficCapture::appendNames()
+{
+    QVector<QString> added;
+    {
+        QMutexLocker locker(&namesMutex);
+        if (namesInFile == names.size())
+            return;
+        added = names.mid(namesInFile);
+    }
+
+    const qint64 now = monotonicNow();
+    for (const QString &phone : added)
+    {
+        const QByteArray name = phone.toUtf8();
+        appendRecord(now, static_cast<quint32>(namesInFile), Capture::Direction::DeviceName,
+                     name.constData(), static_cast<int>(name.size()));
+        namesSpan += Capture::recordSpan(static_cast<quint16>(name.size()));
+        namesInFile++;
+    }
+}
+
+void TrafficCapture::appendRecord(qint64 time, quint32 device, Capture::Direction direction, const char *data, int size)
+{
+    const qint64 span = Capture::recordSpan(static_cast<quint16>(size));
+    if (used + span > buffer.size())
+        flush();
+
+    Capture::RecordHeader header;
+    header.time = time;
+    header.device = device;
+    header.size = static_cast<quint16>(size);
+    header.direction = direction;
+    header.reserved = 0;
+
+    char *out = buffer.data() + used;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), data, size);
+    // Zero padding, the buffer is reused
+    memset(out + sizeof(header) + size, 0, span - sizeof(header) - size);
+    used += static_cast<int>(span);
+}
+
+void TrafficCapture::flush()
+{
+    if (used == 0)
+        return;
+    if (!file.isOpen())
+    {
+        used = 0;
+        return;
+    }
+
+    if (file.write(buffer.constData(), used) != used)
+    {
+        dropped.fetch_add(bufferedRecords, std::memory_order_relaxed);
+        used = 0;
+        bufferedRecords = 0;
+        fail(QObject::tr("ошибка записи в ") + file.fileName() + ": " + file.errorString());
+        return;
+    }
+
+    fileSize += used;
+    written.fetch_add(used, std::memory_order_relaxed);
+    used = 0;
+    bufferedRecords = 0;
+}
+
+void TrafficCapture::fail(const QString &message)
+{
+    active = false;
+    file.close();
+    used = 0;
+    bufferedRecords = 0;
+    failure = message;
+    // start() returns the error itself before the writer runs
+    if (writer && logger)
+        logger->logError(QObject::tr("Запись трафика остановлена: ") + message);
+}
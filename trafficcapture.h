@@ -0,0 +1,132 @@
+#ifndef TRAFFICCAPTURE_H
+#define TRAFFICCAPTURE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "capturefile.h"
+#include "logring.h"
+
+class Logger;
+
+// Запись всего трафика устройств в двоичные файлы .qcap (формат в capturefile.h).
+// Потоки устройств копируют кадр в свой промежуточный блок и кладут ссылку
+// на копию в очередь без блокировок, отдельный поток собирает записи в большой
+// буфер и пишет его в файл, начиная новый файл при превышении размера.
+// Смотреть - tools/qulondump.
+class TrafficCapture
+{
+public:
+    static TrafficCapture &instance();
+
+    // Open and write errors of the running capture are reported here
+    void setLogger(Logger *logger);
+    // Starts a new file in the directory, an active capture is stopped first
+    bool start(const QString &directory, qint64 maxFileSize, QString *error = nullptr);
+    // Writes everything queued and closes the file
+    void stop();
+    bool isActive() const;
+
+    // Index of the device in capture records, the same phone gets the same index
+    quint32 registerDevice(const QString &phone);
+
+    // Any thread. The bytes are copied, the caller's buffer is not shared
+    void record(quint32 device, Capture::Direction direction, const QByteArray &data);
+
+    quint64 droppedRecords() const;
+    qint64 bytesWritten() const;
+
+private:
+    TrafficCapture();
+    ~TrafficCapture();
+    Q_DISABLE_COPY(TrafficCapture)
+
+    // Copies of frames made by one device thread. The block is reused once the
+    // writer has written every record in it
+    struct StagingBlock
+    {
+        std::unique_ptr<char[]> data;
+        int used = 0;
+        // Records queued from the block and not yet written
+        std::atomic<int> pending{0};
+    };
+    // Blocks of the calling thread, given back to the pool when it exits
+    struct ThreadStaging;
+
+    struct Entry
+    {
+        qint64 time = 0;
+        quint32 device = 0;
+        Capture::Direction direction = Capture::Direction::FromServer;
+        quint16 size = 0;
+        const char *data = nullptr;
+        StagingBlock *block = nullptr;
+    };
+
+    static constexpr quint32 RING_SIZE = 1 << 18;
+    static constexpr int STAGING_BLOCK_SIZE = 256 * 1024;
+    // Backlog a thread may have before its records are dropped
+    static constexpr int STAGING_BLOCKS_PER_THREAD = 16;
+    // One write() to the file
+    static constexpr int WRITE_SIZE = 4 * 1024 * 1024;
+    // Idle writer flushes a partial buffer after this time
+    static constexpr int FLUSH_INTERVAL_MS = 200;
+
+    MpscRing<Entry> ring;
+    std::atomic<bool> active;
+    std::atomic<bool> stopping;
+    std::atomic<quint64> dropped;
+    std::atomic<qint64> written;
+    std::unique_ptr<QThread> writer;
+    // Wall clock at the monotonic zero, microseconds
+    const qint64 wallBase;
+    Logger *logger = nullptr;
+
+    // All staging blocks, and those left by finished threads
+    QMutex stagingMutex;
+    std::vector<std::unique_ptr<StagingBlock>> stagingBlocks;
+    std::vector<StagingBlock*> freeBlocks;
+
+    // Device names, the writer copies new ones into the current file
+    mutable QMutex namesMutex;
+    QVector<QString> names;
+    QHash<QString, quint32> indexes;
+
+    // Writer thread only
+    QString directory;
+    qint64 maxFileSize = 0;
+    int fileNumber = 0;
+    QFile file;
+    qint64 fileSize = 0;
+    int namesInFile = 0;
+    // Header and names at the start of the file, a file is never rotated with only them
+    qint64 namesSpan = 0;
+    QByteArray buffer;
+    int used = 0;
+    // Frame records in buffer, lost if the write fails
+    int bufferedRecords = 0;
+
+    // Calling thread's block with room for size bytes, nullptr if its backlog is full
+    StagingBlock *stagingFor(int size);
+    void releaseStaging(std::vector<StagingBlock*> &blocks);
+    // Why the last file failed, for start()
+    QString failure;
+
+    // Closes the file and reports why, later records are counted as dropped
+    void fail(const QString &message);
+
+    void run();
+    bool openNextFile();
+    void appendNames();
+    void appendRecord(qint64 time, quint32 device, Capture::Direction direction, const char *data, int size);
+    void flush();
+};
+
+#endif // TRAFFICCAPTURE_H
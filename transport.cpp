@@ -0,0 +1,106 @@
+#include "transport.h"
+#include <QTcpSocket>
+#include <atomic>
+
+#ifdef QULON_IO_URING
+#include "uringtransport.h"
+#endif
+
+namespace {
+
+std::atomic<Transport::Backend> currentBackend{Transport::Backend::QtSocket};
+
+class QtSocketTransport : public Transport
+{
+public:
+    QtSocketTransport(TransportListener *listener, QObject *parent)
+        : listener(listener),
+        socket(new QTcpSocket(parent))
+    {
+        QObject::connect(socket, &QTcpSocket::connected, socket, [listener] {
+            listener->onTransportConnected();
+        });
+        QObject::connect(socket, &QTcpSocket::disconnected, socket, [listener] {
+            listener->onTransportDisconnected();
+        });
+        QObject::connect(socket, &QAbstractSocket::errorOccurred, socket, [this, listener] {
+            listener->onTransportError(socket->errorString());
+        });
+        QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, listener] {
+            // Read into the same buffer every time, listener doesn't keep it
+            readBuffer.resize(socket->bytesAvailable());
+            qint64 size = qMax(socket->read(readBuffer.data(), readBuffer.size()), qint64(0));
+            listener->onTransportData(readBuffer.constData(), static_cast<int>(size));
+        });
+    }
+
+    ~QtSocketTransport() override
+    {
+        // Listener is being destroyed, nothing must reach it from here
+        QObject::disconnect(socket, nullptr, nullptr, nullptr);
+        delete socket;
+    }
+
+    void setSourceAddress(const QHostAddress &address) override
+    {
+        sourceAddress = address;
+    }
+
+    void connectToServer(const QString &address, quint16 port) override
+    {
+        // Bound socket keeps the address only until it is closed
+        if (!sourceAddress.isNull() && !socket->bind(sourceAddress))
+        {
+            listener->onTransportError(socket->errorString());
+            return;
+        }
+        socket->connectToHost(address, port);
+    }
+
+    void disconnectFromServer() override
+    {
+        socket->disconnectFromHost();
+    }
+
+    void send(const QByteArray &data) override
+    {
+        socket->write(data);
+    }
+
+private:
+    TransportListener *listener;
+    QTcpSocket *socket;
+    QByteArray readBuffer;
+    QHostAddress sourceAddress;
+};
+
+}
+
+void Transport::setBackend(Backend backend)
+{
+    currentBackend = backend;
+}
+
+Transport::Backend Transport::backend()
+{
+    return currentBackend;
+}
+
+bool Transport::isCompiledIn(Backend backend)
+{
+#ifdef QULON_IO_URING
+    Q_UNUSED(backend);
+    return true;
+#else
+    return backend == Backend::QtSocket;
+#endif
+}
+
+std::unique_ptr<Transport> Transport::create(TransportListener *listener, QObject *parent)
+{
+#ifdef QULON_IO_URING
+    if (currentBackend == Backend::IoUring && UringTransport::isAvailable())
+        return std::make_unique<UringTransport>(listener);
+#endif
+    return std::make_unique<QtSocketTransport>(listener, parent);
+}
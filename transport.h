@@ -0,0 +1,53 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QString>
+#include <memory>
+
+class QObject;
+
+// Получатель событий соединения (TcpClient). Вызывается в потоке устройства
+class TransportListener
+{
+public:
+    virtual void onTransportConnected() = 0;
+    virtual void onTransportDisconnected() = 0;
+    // Data is valid only during the call
+    virtual void onTransportData(const char *data, int size) = 0;
+    virtual void onTransportError(const QString &error) = 0;
+
+protected:
+    ~TransportListener() = default;
+};
+
+// TCP соединение одного устройства. Обычная реализация на QTcpSocket,
+// на Linux при сборке с CONFIG+=io_uring доступна реализация на io_uring
+// без QObject и буферов на каждый сокет.
+class Transport
+{
+public:
+    enum class Backend { QtSocket, IoUring };
+
+    virtual ~Transport() = default;
+
+    // Local address for the following connects, null lets the system choose
+    virtual void setSourceAddress(const QHostAddress &address) = 0;
+    virtual void connectToServer(const QString &address, quint16 port) = 0;
+    virtual void disconnectFromServer() = 0;
+    virtual void send(const QByteArray &data) = 0;
+
+    // Backend for new connections, set from #SIMULATOR before devices start
+    static void setBackend(Backend backend);
+    static Backend backend();
+    // False if the backend was not compiled in
+    static bool isCompiledIn(Backend backend);
+
+    // Creates transport of the current backend in the calling thread. Falls back
+    // to QTcpSocket if io_uring can't be used on this kernel.
+    // QObject based transports become children of parent
+    static std::unique_ptr<Transport> create(TransportListener *listener, QObject *parent);
+};
+
+#endif // TRANSPORT_H
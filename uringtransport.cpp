@@ -0,0 +1,583 @@
+#include "uringtransport.h"
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QSocketNotifier>
+#include <QThread>
+#include <liburing.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+struct UringSocket
+{
+    int fd = -1;
+    // Cleared when the transport is destroyed, completions after that only clean up
+    TransportListener *listener = nullptr;
+    bool connected = false;
+    bool closing = false;
+    sockaddr_storage address{};
+    socklen_t addressLength = 0;
+    // Local address to bind, length 0 lets the system choose
+    sockaddr_storage source{};
+    socklen_t sourceLength = 0;
+    // One send in flight per socket keeps the byte order, the rest waits here
+    std::deque<QByteArray> sendQueue;
+    bool sending = false;
+};
+
+// Кольцо io_uring одного потока устройств. Завершения приходят через eventfd
+// в цикл событий потока, новые запросы копятся и отправляются в ядро одним
+// io_uring_submit() за проход цикла.
+class UringReactor
+{
+public:
+    // Ring of the calling thread, nullptr if io_uring can't be used
+    static std::shared_ptr<UringReactor> forCurrentThread();
+    ~UringReactor();
+
+    void connect(const std::shared_ptr<UringSocket> &socket);
+    void send(const std::shared_ptr<UringSocket> &socket, const QByteArray &data);
+    void close(const std::shared_ptr<UringSocket> &socket);
+
+private:
+    enum class OpType { Connect, Receive, Send, Close };
+
+    struct Op
+    {
+        OpType type;
+        std::shared_ptr<UringSocket> socket;
+        // Descriptor the request was made for, completions for an old one are stale
+        int fd;
+        QByteArray data;
+        int offset = 0;
+    };
+
+    static constexpr unsigned RING_ENTRIES = 4096;
+    // Receive buffers registered in the ring, power of two
+    static constexpr unsigned BUFFER_COUNT = 4096;
+    static constexpr unsigned BUFFER_SIZE = 2048;
+    static constexpr int BUFFER_GROUP = 0;
+
+    io_uring ring;
+    bool ringInitialized = false;
+    bool ready = false;
+    io_uring_buf_ring *bufferRing = nullptr;
+    char *buffers = nullptr;
+    int eventFd = -1;
+    QSocketNotifier *notifier = nullptr;
+    bool submitPending = false;
+    // Requests that found the submission queue full, retried after completions are reaped
+    std::deque<std::function<void()>> deferred;
+    std::unordered_map<quint64, Op> ops;
+    quint64 nextOpId = 1;
+
+    UringReactor();
+
+    // nullptr if the kernel does not take requests now, the caller defers
+    io_uring_sqe *getSqe(unsigned count = 1);
+    void addOp(io_uring_sqe *sqe, Op op);
+    void retryDeferred();
+    void submitConnect(const std::shared_ptr<UringSocket> &socket);
+    void submitClose(const std::shared_ptr<UringSocket> &socket);
+    void armReceive(const std::shared_ptr<UringSocket> &socket);
+    void startSend(const std::shared_ptr<UringSocket> &socket);
+    void submitSend(Op op);
+    void recycleBuffer(unsigned id);
+    void reportError(const std::shared_ptr<UringSocket> &socket, int error);
+    void processCompletions();
+    void complete(quint64 id, int result, unsigned flags);
+};
+
+std::shared_ptr<UringReactor> UringReactor::forCurrentThread()
+{
+    static thread_local std::shared_ptr<UringReactor> reactor;
+    static thread_local bool failed = false;
+
+    if (!reactor && !failed)
+    {
+        std::shared_ptr<UringReactor> created(new UringReactor);
+        if (!created->ready)
+        {
+            failed = true;
+            return nullptr;
+        }
+        reactor = created;
+        // Devices deleted when the thread finishes still hold the ring,
+        // it goes away with the last of them while the event loop exists
+        QObject::connect(QThread::currentThread(), &QThread::finished, [] { reactor.reset(); });
+    }
+    return reactor;
+}
+
+UringReactor::UringReactor()
+{
+    io_uring_params params{};
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    if (io_uring_queue_init_params(RING_ENTRIES, &ring, &params) < 0)
+    {
+        // Older kernels don't know the flags
+        params = io_uring_params{};
+        if (io_uring_queue_init_params(RING_ENTRIES, &ring, &params) < 0)
+            return;
+    }
+    ringInitialized = true;
+
+    int error = 0;
+    bufferRing = io_uring_setup_buf_ring(&ring, BUFFER_COUNT, BUFFER_GROUP, 0, &error);
+    if (!bufferRing)
+        return;
+
+    buffers = static_cast<char*>(std::aligned_alloc(4096, static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE));
+    if (!buffers)
+        return;
+    for (unsigned id = 0; id < BUFFER_COUNT; id++)
+        io_uring_buf_ring_add(bufferRing, buffers + static_cast<size_t>(id) * BUFFER_SIZE, BUFFER_SIZE, id,
+                              io_uring_buf_ring_mask(BUFFER_COUNT), id);
+    io_uring_buf_ring_advance(bufferRing, BUFFER_COUNT);
+
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0 || io_uring_register_eventfd(&ring, eventFd) < 0)
+        return;
+
+    notifier = new QSocketNotifier(eventFd, QSocketNotifier::Read);
+    QObject::connect(notifier, &QSocketNotifier::activated, notifier, [this] { processCompletions(); });
+    ready = true;
+}
+
+UringReactor::~UringReactor()
+{
+    // Sockets with requests still in the ring are closed here, the ring cancels the rest
+    for (auto &entry : ops)
+    {
+        UringSocket &socket = *entry.second.socket;
+        if (socket.fd >= 0)
+        {
+            ::close(socket.fd);
+            socket.fd = -1;
+        }
+    }
+
+    delete notifier;
+    if (ringInitialized)
+    {
+        if (bufferRing)
+            io_uring_free_buf_ring(&ring, bufferRing, BUFFER_COUNT, BUFFER_GROUP);
+        io_uring_queue_exit(&ring);
+    }
+    if (eventFd >= 0)
+        ::close(eventFd);
+    std::free(buffers);
+}
+
+void UringReactor::connect(const std::shared_ptr<UringSocket> &socket)
+{
+    // Blocking socket, io_uring waits for the handshake itself
+    socket->fd = ::socket(socket->address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (socket->fd < 0)
+    {
+        reportError(socket, errno);
+        return;
+    }
+
+    if (socket->sourceLength > 0)
+    {
+        // Port is picked at connect, so one address serves every server ip:port
+        int one = 1;
+        setsockopt(socket->fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+        if (::bind(socket->fd, reinterpret_cast<sockaddr*>(&socket->source), socket->sourceLength) < 0)
+        {
+            const int error = errno;
+            ::close(socket->fd);
+            socket->fd = -1;
+            reportError(socket, error);
+            return;
+        }
+    }
+
+    submitConnect(socket);
+}
+
+void UringReactor::submitConnect(const std::shared_ptr<UringSocket> &socket)
+{
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+    {
+        const int fd = socket->fd;
+        deferred.push_back([this, socket, fd] {
+            if (socket->fd == fd && !socket->closing)
+                submitConnect(socket);
+        });
+        return;
+    }
+    io_uring_prep_connect(sqe, socket->fd, reinterpret_cast<sockaddr*>(&socket->address), socket->addressLength);
+    addOp(sqe, Op{OpType::Connect, socket, socket->fd, {}, 0});
+}
+
+void UringReactor::send(const std::shared_ptr<UringSocket> &socket, const QByteArray &data)
+{
+    if (socket->fd < 0 || socket->closing || !socket->connected)
+        return;
+
+    socket->sendQueue.push_back(data);
+    if (!socket->sending)
+        startSend(socket);
+}
+
+void UringReactor::close(const std::shared_ptr<UringSocket> &socket)
+{
+    if (socket->fd < 0 || socket->closing)
+        return;
+    socket->closing = true;
+    submitClose(socket);
+}
+
+void UringReactor::submitClose(const std::shared_ptr<UringSocket> &socket)
+{
+    // Cancel everything on the descriptor, then close it. Hard link runs the close
+    // even if there was nothing to cancel
+    io_uring_sqe *sqe = getSqe(2);
+    if (!sqe)
+    {
+        const int fd = socket->fd;
+        deferred.push_back([this, socket, fd] {
+            if (socket->fd == fd)
+                submitClose(socket);
+        });
+        return;
+    }
+    io_uring_prep_cancel_fd(sqe, socket->fd, IORING_ASYNC_CANCEL_ALL);
+    sqe->flags |= IOSQE_IO_HARDLINK;
+    io_uring_sqe_set_data64(sqe, 0);
+
+    sqe = getSqe();
+    io_uring_prep_close(sqe, socket->fd);
+    addOp(sqe, Op{OpType::Close, socket, socket->fd, {}, 0});
+}
+
+// Requests made during one pass of the event loop go to the kernel together
+io_uring_sqe *UringReactor::getSqe(unsigned count)
+{
+    // Submit fails with -EBUSY while the completion queue overflows, the queue
+    // stays full until processCompletions() reaps completions
+    if (io_uring_sq_space_left(&ring) < count &&
+        (io_uring_submit(&ring) < 0 || io_uring_sq_space_left(&ring) < count))
+        return nullptr;
+
+    if (!submitPending)
+    {
+        submitPending = true;
+        QMetaObject::invokeMethod(notifier, [this] {
+            submitPending = false;
+            io_uring_submit(&ring);
+        }, Qt::QueuedConnection);
+    }
+    return io_uring_get_sqe(&ring);
+}
+
+void UringReactor::addOp(io_uring_sqe *sqe, Op op)
+{
+    const quint64 id = nextOpId++;
+    io_uring_sqe_set_data64(sqe, id);
+    ops.emplace(id, std::move(op));
+}
+
+void UringReactor::retryDeferred()
+{
+    // Requests failing again go back to the queue in the same order
+    std::deque<std::function<void()>> waiting;
+    waiting.swap(deferred);
+    for (const std::function<void()> &request : waiting)
+        request();
+}
+
+void UringReactor::armReceive(const std::shared_ptr<UringSocket> &socket)
+{
+    if (socket->fd < 0 || socket->closing)
+        return;
+
+    // Multishot: one request delivers all data until it is cancelled or buffers run out
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+    {
+        const int fd = socket->fd;
+        deferred.push_back([this, socket, fd] {
+            if (socket->fd == fd)
+                armReceive(socket);
+        });
+        return;
+    }
+    io_uring_prep_recv_multishot(sqe, socket->fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    addOp(sqe, Op{OpType::Receive, socket, socket->fd, {}, 0});
+}
+
+void UringReactor::startSend(const std::shared_ptr<UringSocket> &socket)
+{
+    if (socket->sendQueue.empty())
+    {
+        socket->sending = false;
+        return;
+    }
+    socket->sending = true;
+
+    // Frames queued while the previous send was in flight go out in one request
+    QByteArray data = std::move(socket->sendQueue.front());
+    socket->sendQueue.pop_front();
+    while (!socket->sendQueue.empty())
+    {
+        data.append(socket->sendQueue.front());
+        socket->sendQueue.pop_front();
+    }
+
+    submitSend(Op{OpType::Send, socket, socket->fd, std::move(data), 0});
+}
+
+void UringReactor::submitSend(Op op)
+{
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+    {
+        deferred.push_back([this, op] {
+            if (op.fd == op.socket->fd && !op.socket->closing)
+                submitSend(op);
+        });
+        return;
+    }
+    io_uring_prep_send(sqe, op.fd, op.data.constData() + op.offset,
+                       static_cast<size_t>(op.data.size() - op.offset), MSG_NOSIGNAL);
+    addOp(sqe, std::move(op));
+}
+
+void UringReactor::recycleBuffer(unsigned id)
+{
+    io_uring_buf_ring_add(bufferRing, buffers + static_cast<size_t>(id) * BUFFER_SIZE, BUFFER_SIZE, id,
+                          io_uring_buf_ring_mask(BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(bufferRing, 1);
+}
+
+void UringReactor::reportError(const std::shared_ptr<UringSocket> &socket, int error)
+{
+    if (socket->listener)
+        socket->listener->onTransportError(QString::fromLocal8Bit(strerror(error)));
+}
+
+void UringReactor::processCompletions()
+{
+    quint64 counter;
+    if (::read(eventFd, &counter, sizeof(counter)) < 0 && errno != EAGAIN)
+        return;
+
+    // Handlers may queue new requests, so each entry is released before it is handled
+    io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&ring, &cqe) == 0)
+    {
+        const quint64 id = io_uring_cqe_get_data64(cqe);
+        const int result = cqe->res;
+        const unsigned flags = cqe->flags;
+        io_uring_cqe_seen(&ring, cqe);
+        complete(id, result, flags);
+    }
+
+    // Requests left in the queue by a refused submit, then the deferred ones
+    if (io_uring_sq_ready(&ring) > 0)
+        io_uring_submit(&ring);
+    if (!deferred.empty())
+        retryDeferred();
+}
+
+void UringReactor::complete(quint64 id, int result, unsigned flags)
+{
+    const bool more = flags & IORING_CQE_F_MORE;
+    auto it = ops.find(id);
+    if (it == ops.end())
+        return;
+    Op op = more ? it->second : std::move(it->second);
+    if (!more)
+        ops.erase(it);
+
+    const std::shared_ptr<UringSocket> &socket = op.socket;
+    const bool current = op.fd == socket->fd && !socket->closing;
+
+    switch (op.type)
+    {
+    case OpType::Connect:
+        if (!current)
+            break;
+        if (result < 0)
+        {
+            reportError(socket, -result);
+            close(socket);
+            break;
+        }
+        socket->connected = true;
+        if (socket->listener)
+            socket->listener->onTransportConnected();
+        armReceive(socket);
+        break;
+
+    case OpType::Receive:
+        if (flags & IORING_CQE_F_BUFFER)
+        {
+            const unsigned bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (result > 0 && current && socket->listener)
+                socket->listener->onTransportData(buffers + static_cast<size_t>(bufferId) * BUFFER_SIZE, result);
+            recycleBuffer(bufferId);
+        }
+        if (!current || socket->closing)
+            break;
+        if (result == 0)
+        {
+            // Server closed the connection
+            close(socket);
+        }
+        else if (result < 0 && result != -ENOBUFS)
+        {
+            if (result != -ECANCELED)
+                reportError(socket, -result);
+            close(socket);
+        }
+        else if (!more)
+        {
+            armReceive(socket);
+        }
+        break;
+
+    case OpType::Send:
+        if (!current)
+            break;
+        if (result < 0)
+        {
+            reportError(socket, -result);
+            close(socket);
+            break;
+        }
+        op.offset += result;
+        if (op.offset < op.data.size())
+            submitSend(std::move(op));
+        else
+            startSend(socket);
+        break;
+
+    case OpType::Close:
+    {
+        const bool wasConnected = socket->connected;
+        socket->fd = -1;
+        socket->connected = false;
+        socket->closing = false;
+        socket->sending = false;
+        socket->sendQueue.clear();
+        if (wasConnected && socket->listener)
+            socket->listener->onTransportDisconnected();
+        break;
+    }
+    }
+}
+
+namespace {
+
+socklen_t fillAddress(const QHostAddress &address, quint16 port, sockaddr_storage &storage)
+{
+    if (address.protocol() == QAbstractSocket::IPv4Protocol)
+    {
+        sockaddr_in *in = reinterpret_cast<sockaddr_in*>(&storage);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        in->sin_addr.s_addr = htonl(address.toIPv4Address());
+        return sizeof(sockaddr_in);
+    }
+
+    sockaddr_in6 *in6 = reinterpret_cast<sockaddr_in6*>(&storage);
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons(port);
+    const Q_IPV6ADDR ip = address.toIPv6Address();
+    memcpy(&in6->sin6_addr, &ip, sizeof(ip));
+    return sizeof(sockaddr_in6);
+}
+
+bool resolveAddress(const QString &host, quint16 port, UringSocket &socket)
+{
+    QHostAddress address(host);
+    if (address.isNull())
+    {
+        // Blocking lookup in the device thread, the server is normally given by IP
+        const QList<QHostAddress> found = QHostInfo::fromName(host).addresses();
+        if (found.isEmpty())
+            return false;
+        address = found.first();
+    }
+
+    socket.addressLength = fillAddress(address, port, socket.address);
+    return true;
+}
+
+}
+
+UringTransport::UringTransport(TransportListener *listener)
+    : listener{listener},
+    reactor{UringReactor::forCurrentThread()}
+{}
+
+UringTransport::~UringTransport()
+{
+    if (socket)
+    {
+        socket->listener = nullptr;
+        if (reactor)
+            reactor->close(socket);
+    }
+}
+
+void UringTransport::connectToServer(const QString &address, quint16 port)
+{
+    if (!reactor)
+    {
+        listener->onTransportError(QObject::tr("io_uring недоступен"));
+        return;
+    }
+    // Connecting, connected or still closing
+    if (socket && socket->fd >= 0)
+        return;
+
+    auto next = std::make_shared<UringSocket>();
+    next->listener = listener;
+    if (!resolveAddress(address, port, *next))
+    {
+        listener->onTransportError(QObject::tr("Адрес не найден: ") + address);
+        return;
+    }
+    if (!sourceAddress.isNull())
+        next->sourceLength = fillAddress(sourceAddress, 0, next->source);
+    socket = next;
+    reactor->connect(socket);
+}
+
+void UringTransport::setSourceAddress(const QHostAddress &address)
+{
+    sourceAddress = address;
+}
+
+void UringTransport::disconnectFromServer()
+{
+    if (socket && reactor)
+        reactor->close(socket);
+}
+
+void UringTransport::send(const QByteArray &data)
+{
+    if (socket && reactor)
+        reactor->send(socket, data);
+}
+
+bool UringTransport::isAvailable()
+{
+    return UringReactor::forCurrentThread() != nullptr;
+}
@@ -0,0 +1,34 @@
+#ifndef URINGTRANSPORT_H
+#define URINGTRANSPORT_H
+
+#include "transport.h"
+
+class UringReactor;
+struct UringSocket;
+
+// Соединение поверх io_uring общего для потока кольца (UringReactor).
+// Прием идет multishot recv в зарегистрированные буферы кольца, отправки и
+// подключения всех устройств потока отправляются в ядро одним вызовом за
+// проход цикла событий.
+class UringTransport : public Transport
+{
+public:
+    explicit UringTransport(TransportListener *listener);
+    ~UringTransport() override;
+
+    void setSourceAddress(const QHostAddress &address) override;
+    void connectToServer(const QString &address, quint16 port) override;
+    void disconnectFromServer() override;
+    void send(const QByteArray &data) override;
+
+    // io_uring with provided buffer rings works in the calling thread
+    static bool isAvailable();
+
+private:
+    TransportListener *listener;
+    std::shared_ptr<UringReactor> reactor;
+    std::shared_ptr<UringSocket> socket;
+    QHostAddress sourceAddress;
+};
+
+#endif // URINGTRANSPORT_H
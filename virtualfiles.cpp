@@ -0,0 +1,285 @@
+#include "virtualfiles.h"
+#include "filestore.h"
+#include <algorithm>
+
+namespace {
+
+// cmp is PROT_FILE_SIZE_* bits (time bits shifted down). No bits means no condition
+template <typename Key>
+bool compareKey(Key key, Key value, UCHAR cmp)
+{
+    if (cmp == 0)
+        return true;
+    return ((cmp & PROT_FILE_SIZE_LT) && key < value) ||
+           ((cmp & PROT_FILE_SIZE_GT) && key > value) ||
+           ((cmp & PROT_FILE_SIZE_EQ) && key == value);
+}
+
+// Part of the sorted index where compareKey() holds. "Not equal" is two ranges,
+// in this case the whole index is returned and the condition is checked per file
+template <typename KeyOf, typename Key>
+void comparisonRange(const std::vector<int> &index, KeyOf keyOf, Key value, UCHAR cmp,
+                     size_t &begin, size_t &end)
+{
+    begin = 0;
+    end = index.size();
+    const bool lt = cmp & PROT_FILE_SIZE_LT;
+    const bool gt = cmp & PROT_FILE_SIZE_GT;
+    const bool eq = cmp & PROT_FILE_SIZE_EQ;
+    if (cmp == 0 || (lt && gt))
+        return;
+
+    const size_t lower = std::partition_point(index.begin(), index.end(),
+                                              [&](int i) { return keyOf(i) < value; }) - index.begin();
+    const size_t upper = std::partition_point(index.begin() + lower, index.end(),
+                                              [&](int i) { return !(value < keyOf(i)); }) - index.begin();
+    begin = lt ? 0 : (eq ? lower : upper);
+    end = gt ? index.size() : (eq ? upper : lower);
+}
+
+}
+
+GlobMatcher::GlobMatcher(const QString &pattern)
+    : pattern{pattern}
+{
+    const int firstWildcard = [&] {
+        for (int i = 0; i < pattern.size(); i++)
+        {
+            if (pattern[i] == '*' || pattern[i] == '?')
+                return i;
+        }
+        return -1;
+    }();
+
+    // Empty template matches any name, as the regex did before
+    if (pattern.isEmpty() || pattern == "*")
+    {
+        kind = Kind::Any;
+        return;
+    }
+    if (firstWildcard == -1)
+    {
+        kind = Kind::Exact;
+        literalPrefix = pattern;
+        return;
+    }
+
+    literalPrefix = pattern.left(firstWildcard);
+    const QString rest = pattern.mid(firstWildcard + 1);
+    const bool restIsLiteral = !rest.contains('*') && !rest.contains('?');
+
+    if (pattern[firstWildcard] == '*' && rest.isEmpty())
+        kind = Kind::Prefix;
+    else if (pattern[firstWildcard] == '*' && firstWildcard == 0 && restIsLiteral)
+    {
+        kind = Kind::Suffix;
+        literalSuffix = rest;
+    }
+    else
+        kind = Kind::Generic;
+}
+
+bool GlobMatcher::matches(const QString &name) const
+{
+    switch (kind)
+    {
+    case Kind::Any:
+        return true;
+    case Kind::Exact:
+        return name == pattern;
+    case Kind::Prefix:
+        return name.startsWith(literalPrefix);
+    case Kind::Suffix:
+        return name.endsWith(literalSuffix);
+    case Kind::Generic:
+        return matchGeneric(name);
+    }
+    return false;
+}
+
+// Linear wildcard matching: on mismatch go back to the last '*' and let it take one more char
+bool GlobMatcher::matchGeneric(const QString &name) const
+{
+    int p = 0;
+    int n = 0;
+    int starP = -1;
+    int starN = 0;
+
+    while (n < name.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+        {
+            ++p;
+            ++n;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            starP = p++;
+            starN = n;
+        }
+        else if (starP != -1)
+        {
+            p = starP + 1;
+            n = ++starN;
+        }
+        else
+            return false;
+    }
+
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
+
+VirtualFiles::~VirtualFiles()
+{
+    for (const File &file : files)
+        FileStore::instance().release(file.data);
+}
+
+void VirtualFiles::insert(const QString &name, const QByteArray &fileData, qint64 modified)
+{
+    sessionCompiled = false;
+    const QByteArray data = FileStore::instance().acquire(fileData);
+
+    auto it = byName.constFind(name);
+    if (it != byName.constEnd())
+    {
+        const int position = it.value();
+        removeFromIndexes(position);
+        FileStore::instance().release(files[position].data);
+        files[position].data = data;
+        files[position].modified = modified;
+        addToIndexes(position);
+        return;
+    }
+
+    const int position = static_cast<int>(files.size());
+    files.push_back(File{name, data, modified});
+    byName.insert(name, position);
+    addToIndexes(position);
+}
+
+const VirtualFiles::File *VirtualFiles::find(const QString &name) const
+{
+    auto it = byName.constFind(name);
+    return it != byName.constEnd() ? &files[it.value()] : nullptr;
+}
+
+void VirtualFiles::startSearch()
+{
+    sessionCompiled = false;
+}
+
+const VirtualFiles::File *VirtualFiles::nextMatch(const FileSearchQuery &query)
+{
+    if (!sessionCompiled || query != sessionQuery)
+        compileSession(query);
+
+    while (cursor < rangeEnd)
+    {
+        const File &file = files[(*sessionRange)[cursor++]];
+        if (accepts(file))
+            return &file;
+    }
+    return nullptr;
+}
+
+void VirtualFiles::compileSession(const FileSearchQuery &query)
+{
+    sessionCompiled = true;
+    sessionQuery = query;
+    sessionMatcher = GlobMatcher(query.nameTemplate);
+    // Time that could not be parsed puts no condition
+    sessionFlags = query.modified < 0 ? static_cast<UCHAR>(query.flags & ~PROT_FILE_TIME_MASK) : query.flags;
+
+    // Names with the literal prefix of the template
+    const QString &prefix = sessionMatcher.prefix();
+    const size_t nameBegin = std::partition_point(nameIndex.begin(), nameIndex.end(),
+                                                  [&](int i) { return files[i].name < prefix; }) - nameIndex.begin();
+    const size_t nameEnd = std::partition_point(nameIndex.begin() + nameBegin, nameIndex.end(),
+                                                [&](int i) { return files[i].name.startsWith(prefix); }) - nameIndex.begin();
+    sessionRange = &nameIndex;
+    cursor = nameBegin;
+    rangeEnd = nameEnd;
+
+    size_t begin;
+    size_t end;
+    comparisonRange(sizeIndex, [this](int i) { return static_cast<quint32>(files[i].data.size()); },
+                    sessionQuery.size, static_cast<UCHAR>(sessionFlags & PROT_FILE_SIZE_MASK), begin, end);
+    if (end - begin < rangeEnd - cursor)
+    {
+        sessionRange = &sizeIndex;
+        cursor = begin;
+        rangeEnd = end;
+    }
+
+    comparisonRange(timeIndex, [this](int i) { return files[i].modified; },
+                    sessionQuery.modified, static_cast<UCHAR>((sessionFlags & PROT_FILE_TIME_MASK) >> 3), begin, end);
+    if (end - begin < rangeEnd - cursor)
+    {
+        sessionRange = &timeIndex;
+        cursor = begin;
+        rangeEnd = end;
+    }
+}
+
+bool VirtualFiles::accepts(const File &file) const
+{
+    return compareKey(static_cast<quint32>(file.data.size()), sessionQuery.size,
+                      static_cast<UCHAR>(sessionFlags & PROT_FILE_SIZE_MASK)) &&
+           compareKey(file.modified, sessionQuery.modified,
+                      static_cast<UCHAR>((sessionFlags & PROT_FILE_TIME_MASK) >> 3)) &&
+           sessionMatcher.matches(file.name);
+}
+
+void VirtualFiles::removeFromIndexes(int position)
+{
+    for (std::vector<int> *index : {&nameIndex, &sizeIndex, &timeIndex})
+        index->erase(std::find(index->begin(), index->end(), position));
+}
+
+void VirtualFiles::addToIndexes(int position)
+{
+    auto byNameLess = [this](int a, int b) { return files[a].name < files[b].name; };
+    auto bySizeLess = [this](int a, int b) {
+        const auto sa = files[a].data.size();
+        const auto sb = files[b].data.size();
+        return sa != sb ? sa < sb : files[a].name < files[b].name;
+    };
+    auto byTimeLess = [this](int a, int b) {
+        return files[a].modified != files[b].modified ? files[a].modified < files[b].modified
+                                                      : files[a].name < files[b].name;
+    };
+
+    nameIndex.insert(std::upper_bound(nameIndex.begin(), nameIndex.end(), position, byNameLess), position);
+    sizeIndex.insert(std::upper_bound(sizeIndex.begin(), sizeIndex.end(), position, bySizeLess), position);
+    timeIndex.insert(std::upper_bound(timeIndex.begin(), timeIndex.end(), position, byTimeLess), position);
+}
+
+void FileReadSession::open(const QByteArray &fileData)
+{
+    // Shares the buffer, nothing is copied
+    data = fileData;
+    endOfFile = false;
+}
+
+void FileReadSession::close()
+{
+    data = QByteArray();
+    endOfFile = false;
+}
+
+int FileReadSession::read(quint32 offset, int len, const char **chunk)
+{
+    const quint64 fileSize = static_cast<quint64>(data.size());
+    if (static_cast<quint64>(offset) + static_cast<quint64>(len) >= fileSize)
+        endOfFile = true;
+
+    *chunk = data.constData();
+    if (offset >= fileSize)
+        return 0;
+
+    *chunk += offset;
+    return static_cast<int>(qMin(static_cast<quint64>(len), fileSize - offset));
+}
@@ -0,0 +1,125 @@
+#ifndef VIRTUALFILES_H
+#define VIRTUALFILES_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <vector>
+#include "Prot.h"
+
+// Шаблон имени файла с '*' и '?', разобранный один раз.
+// Частые виды шаблонов ("*", "NAME", "LOG*", "*.DAT") проверяются без перебора.
+class GlobMatcher
+{
+public:
+    GlobMatcher() = default;
+    explicit GlobMatcher(const QString &pattern);
+
+    bool matches(const QString &name) const;
+    // Literal part before the first wildcard, every matching name starts with it
+    const QString &prefix() const { return literalPrefix; }
+
+private:
+    enum class Kind { Any, Exact, Prefix, Suffix, Generic };
+
+    Kind kind = Kind::Any;
+    QString pattern;
+    QString literalPrefix;
+    QString literalSuffix;
+
+    bool matchGeneric(const QString &name) const;
+};
+
+// Условия поиска из запроса PROT_FILE_SRCH_CMD
+struct FileSearchQuery
+{
+    QString nameTemplate;
+    // PROT_FILE_SIZE_* | PROT_FILE_TIME_*
+    UCHAR flags = 0;
+    quint32 size = 0;
+    // Seconds since epoch, ignored when invalid (-1)
+    qint64 modified = -1;
+
+    bool operator==(const FileSearchQuery &other) const
+    {
+        return nameTemplate == other.nameTemplate && flags == other.flags &&
+               size == other.size && modified == other.modified;
+    }
+    bool operator!=(const FileSearchQuery &other) const { return !(*this == other); }
+};
+
+// Виртуальные файлы устройства с индексами по имени, размеру и времени изменения.
+// Поиск выбирает самый узкий диапазон одного из индексов (префикс имени,
+// условие по размеру или времени) и проверяет остальные условия только в нем.
+class VirtualFiles
+{
+public:
+    struct File
+    {
+        QString name;
+        QByteArray data;
+        // Seconds since epoch
+        qint64 modified;
+    };
+
+    VirtualFiles() = default;
+    ~VirtualFiles();
+    Q_DISABLE_COPY(VirtualFiles)
+
+    // Adds a file or replaces data of an existing one. Data is shared through
+    // FileStore with identical files of other devices. Drops the search session
+    void insert(const QString &name, const QByteArray &data, qint64 modified);
+    // nullptr if there is no such file
+    const File *find(const QString &name) const;
+    int size() const { return static_cast<int>(files.size()); }
+
+    // Starts search from the beginning (PROT_FILE_SRCH_INIT_CMD)
+    void startSearch();
+    // Next file matching the query or nullptr when there are no more.
+    // The query is compiled once per session, a changed query restarts the search
+    const File *nextMatch(const FileSearchQuery &query);
+
+private:
+    // Files are never removed, so positions in indexes stay valid
+    std::vector<File> files;
+    QHash<QString, int> byName;
+    // Positions in files sorted by name, (size, name) and (modified, name)
+    std::vector<int> nameIndex;
+    std::vector<int> sizeIndex;
+    std::vector<int> timeIndex;
+
+    // Search session
+    bool sessionCompiled = false;
+    FileSearchQuery sessionQuery;
+    UCHAR sessionFlags = 0;
+    GlobMatcher sessionMatcher;
+    const std::vector<int> *sessionRange = nullptr;
+    size_t cursor = 0;
+    size_t rangeEnd = 0;
+
+    void compileSession(const FileSearchQuery &query);
+    bool accepts(const File &file) const;
+    void removeFromIndexes(int position);
+    void addToIndexes(int position);
+};
+
+// Открытый на чтение файл. Хранит только ссылку на общие неизменяемые данные
+// файла, блоки отдаются прямо из них без копирования. Замена файла во время
+// чтения не влияет на открытую сессию.
+class FileReadSession
+{
+public:
+    void open(const QByteArray &fileData);
+    void close();
+    // Previous block reached the end of file
+    bool atEnd() const { return endOfFile; }
+    // Points chunk to at most len bytes from offset, clipped to the end of file.
+    // Returns chunk length, the chunk stays valid until close() or open()
+    int read(quint32 offset, int len, const char **chunk);
+
+private:
+    QByteArray data;
+    bool endOfFile = false;
+};
+
+#endif // VIRTUALFILES_H